@@ -0,0 +1,130 @@
+#if !defined(BRIDGE_H)
+#define BRIDGE_H
+
+/**
+ @addtogroup BRIDGE
+ @{
+ */
+
+/*
+ * Shared memory bridge, a simulator only tool: it is built with OS_SIM
+ * and nowhere else. Other processes map the same POSIX shared memory
+ * object and post requests into one ring; a bridge task turns them into
+ * driver thread events and writes the completions into a response ring
+ * per client. A waiting client is woken with a futex on its response
+ * ring. The bridge task polls the request ring once per tick, a kernel
+ * wait would stop the simulated OS; the request latency is therefore up
+ * to a tick and says nothing about a target build.
+ */
+
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include <Internal.h>
+#include <Main.h>
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+#define BRIDGE_MAGIC 0x42524447U /* "BRDG" */
+#define BRIDGE_VERSION 1
+
+/** \brief Entries of the request ring and of every response ring, power
+ * of two */
+#define BRIDGE_RING_ENTRIES 32
+#define BRIDGE_CLIENTS_MAX 4
+
+/** \brief Request ring polling period of the bridge task */
+#define BRIDGE_POLL_PERIOD 1
+
+/** \brief Below the driver thread, requests queue up as events */
+#define BRIDGE_TASK_PRIORITY ( tskIDLE_PRIORITY + 1 )
+
+/*****************************************************************************/
+/* TYPE DEFINITIONS                                                          */
+/*****************************************************************************/
+/**
+ * \brief Requests of the clients
+ */
+typedef enum
+{
+    BRIDGE_REQ_SET_MODE = 0,  /**< arg ON / OFF, Main_reqSetMode */
+    BRIDGE_REQ_SET_MODE_URGENT, /**< arg ON / OFF, Main_reqSetModeUrgent */
+    BRIDGE_REQ_GET_STATE,     /**< Main_getState, ordered with the requests */
+    BRIDGE_REQ_READ_STATE,    /**< Main_readState, answered by the bridge */
+    BRIDGE_REQ_MAX
+} T_BRIDGE_REQ;
+
+typedef struct
+{
+    volatile U32 ready; /**< Ring position + 1 once the entry is written */
+    U32 client;         /**< Index from Bridge_clientAttach */
+    U32 seq;            /**< Chosen by the client, echoed back */
+    U32 type;           /**< T_BRIDGE_REQ */
+    U32 arg;
+} T_BRIDGE_REQUEST;
+
+typedef struct
+{
+    U32 seq;
+    U32 type;
+    U32 result;                  /**< T_RESULT */
+    U32 value;                   /**< Mode set, state got */
+    T_MAIN_STATE_SNAPSHOT state; /**< BRIDGE_REQ_READ_STATE */
+} T_BRIDGE_RESPONSE;
+
+/**
+ * \brief Response ring of one client, written by the driver process only
+ */
+typedef struct
+{
+    volatile U32 head;    /**< Next position written, futex word */
+    volatile U32 tail;    /**< Next position read by the client */
+    volatile U32 waiting; /**< Client sleeps on head */
+    T_BRIDGE_RESPONSE entry[BRIDGE_RING_ENTRIES];
+} T_BRIDGE_RSP_RING;
+
+/**
+ * \brief Layout of the shared memory object. Positions run freely, a
+ * ring is full when head - tail == BRIDGE_RING_ENTRIES.
+ */
+typedef struct
+{
+    U32 magic;
+    U32 version;
+    volatile U32 clients;  /**< Bit n set while client n is attached */
+    volatile U32 req_head; /**< Next position reserved by a client */
+    volatile U32 req_tail; /**< Next position read by the bridge */
+    T_BRIDGE_REQUEST req[BRIDGE_RING_ENTRIES];
+    T_BRIDGE_RSP_RING rsp[BRIDGE_CLIENTS_MAX];
+} T_BRIDGE_SHM;
+
+typedef struct
+{
+    U32 requests;     /**< Requests taken from the ring */
+    U32 responses;    /**< Responses written */
+    U32 rsp_dropped;  /**< Responses lost, client ring full */
+    U32 bad_requests; /**< Unknown type or client */
+    U32 wakeups;      /**< Futex wake ups of waiting clients */
+} T_BRIDGE_STAT;
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+/* driver process */
+T_RESULT Bridge_open(const char * P_NAME);
+void Bridge_close(void);
+void Bridge_getStat(T_BRIDGE_STAT * P_STAT);
+
+/* clients, any process */
+T_BRIDGE_SHM *Bridge_clientAttach(const char * P_NAME, U32 * p_client);
+void Bridge_clientDetach(T_BRIDGE_SHM * p_shm, U32 client);
+T_RESULT Bridge_clientPost(T_BRIDGE_SHM * p_shm, U32 client, U32 seq,
+                           T_BRIDGE_REQ type, U32 arg);
+T_RESULT Bridge_clientPoll(T_BRIDGE_SHM * p_shm, U32 client,
+                           T_BRIDGE_RESPONSE * p_rsp);
+T_RESULT Bridge_clientWait(T_BRIDGE_SHM * p_shm, U32 client,
+                           T_BRIDGE_RESPONSE * p_rsp, U32 timeout_us);
+
+/*@}*/
+
+#endif /* BRIDGE_H */
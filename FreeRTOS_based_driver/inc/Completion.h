@@ -0,0 +1,100 @@
+/**
+ * \file Completion.h
+ * \brief Completion callbacks of the driver requests delivered out of the
+ * driver thread, in batches
+ */
+
+/**
+ * @addtogroup Module Name
+ * @{
+ */
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include "Internal.h"
+#include "Thread.h"
+
+/*******************************************************************
+ *  MACRO DEFINITIONS
+ ******************************************************************/
+/** \brief Completions a queue holds, a full queue pushes back on the
+ *  poster (Completion_post_drain) */
+#define COMPLETION_QUEUE_ENTRIES 32
+
+/*******************************************************************
+ *  TYPE DEFINITIONS
+ ******************************************************************/
+typedef enum
+{
+    COMPLETION_CFG = 0, /**< T_EVENT_CFG.completion_callback */
+    COMPLETION_STATE    /**< T_GET_STATE_EVENT.completion_callback */
+} T_COMPLETION_TYPE;
+
+/**
+ * \brief A completion callback with its argument
+ */
+typedef struct
+{
+    T_COMPLETION_TYPE type;
+    union
+    {
+        void (*cfg)(void *p_data);
+        void (*state)(U32 state);
+    } cb;
+    union
+    {
+        void *p_data;
+        U32 state;
+    } arg;
+} T_COMPLETION;
+
+/**
+ * \brief Completion queue. The owner either polls it from its own task
+ * with Completion_poll, or has it dispatched by a completion thread
+ * (use_thread TRUE).
+ */
+typedef struct
+{
+    /** Static information */
+    const char *queue_name;
+    BOOL use_thread;            /**< Dispatch on a completion thread */
+    void (*notify)(void *p_data); /**< Polled queue only: called by the
+                                       poster when the queue was empty,
+                                       may be NULL */
+    void *p_notify_data;
+
+    /** Runtime Information */
+    BOOL initialized;
+    spinlock_t lock;            /**< Spinlock for the entries */
+    BOOL dispatching;           /**< A consumer runs callbacks */
+    U32 wr;                     /**< Next entry written, runs freely */
+    U32 rd;                     /**< Next entry dispatched */
+    T_COMPLETION entry[COMPLETION_QUEUE_ENTRIES];
+    T_THREAD thread;            /**< Completion thread (use_thread) */
+    T_THREAD_CB handlers[2];
+
+    struct {
+        U32 posted;     /**< Completions queued */
+        U32 overflows;  /**< Refused, queue full */
+        U32 drained;    /**< Run by a poster waiting for room */
+        U32 dispatched; /**< Callbacks run from the queue */
+        U32 batches;    /**< Dispatch runs which found work */
+        U32 batch_max;  /**< Most callbacks run by one dispatch */
+    } stat;
+} T_COMPLETION_QUEUE;
+
+/*******************************************************************
+ *  FUNCTION PROTOTYPES
+ ******************************************************************/
+
+T_RESULT Completion_init(T_COMPLETION_QUEUE *queue);
+T_RESULT Completion_post(T_COMPLETION_QUEUE *queue,
+                         const T_COMPLETION *P_COMPLETION);
+T_RESULT Completion_post_drain(T_COMPLETION_QUEUE *queue,
+                               const T_COMPLETION *P_COMPLETION,
+                               T_THREAD *thread);
+U32 Completion_poll(T_COMPLETION_QUEUE *queue, U32 max);
+BOOL Completion_event_hdlr(T_THREAD_EVENT *event);
+
+#endif /* COMPLETION_H */
+/** @} */
@@ -14,6 +14,8 @@
 /*****************************************************************************/
 /* DEFINES                                                                   */
 /*****************************************************************************/
+/** \brief Longest wait for HW_STATUS_READY after power on */
+#define DRV_POWER_UP_TIMEOUT 10
 
 /*****************************************************************************/
 /* TYPE DEFINITIONS                                                          */
@@ -27,8 +29,15 @@
 /*****************************************************************************/
 /* EXPORTED FUNCTIONS                                                        */
 /*****************************************************************************/
-void Drv_setMode( const t_base_cfg * P_CFG );
-BOOL Drv_isActive(void);
+void Drv_init(volatile t_HW * p_hw, uintptr_t reg_base);
+void Drv_setMode( volatile t_HW * p_hw, const t_base_cfg * P_CFG );
+void Drv_setClock( volatile t_HW * p_hw, const t_base_cfg * P_CFG );
+void Drv_powerUp(volatile t_HW * p_hw);
+void Drv_powerDown(volatile t_HW * p_hw);
+BOOL Drv_isReady(volatile t_HW * p_hw);
+BOOL Drv_waitReady(volatile t_HW * p_hw);
+U32 Drv_ackIrq(volatile t_HW * p_hw);
+BOOL Drv_isActive(volatile t_HW * p_hw);
 /*@}*/
 
 #endif //DRV_H
@@ -0,0 +1,133 @@
+/**
+ * \file Export.h
+ * \brief Batched export of driver records to a sink, through double
+ * buffers flushed by an export thread
+ */
+
+/**
+ * @addtogroup Module Name
+ * @{
+ */
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "Internal.h"
+#include "Thread.h"
+
+/*******************************************************************
+ *  MACRO DEFINITIONS
+ ******************************************************************/
+/** \brief Bytes of one export buffer, record headers included */
+#define EXPORT_BUFFER_SIZE 1024
+#define EXPORT_BUFFERS 2
+
+/** \brief Record payloads are padded to keep the headers aligned */
+#define EXPORT_ALIGN(size_) (((size_) + 3U) & ~3U)
+
+/** \brief Largest record payload */
+#define EXPORT_RECORD_MAX \
+  (EXPORT_BUFFER_SIZE - sizeof(T_EXPORT_RECORD))
+
+/*******************************************************************
+ *  TYPE DEFINITIONS
+ ******************************************************************/
+/**
+ * \brief Header in front of every record of a batch, the payload follows
+ * padded to 4 bytes
+ */
+typedef struct
+{
+    U16 size; /**< Payload bytes */
+    U16 type; /**< Set by the producer */
+    U32 time; /**< OsGetTimestamp() of the append */
+} T_EXPORT_RECORD;
+
+/**
+ * \brief Writes one batch of records. Runs on the export thread and may
+ * block, the other buffer keeps taking records meanwhile.
+ */
+typedef T_RESULT (*T_EXPORT_WRITE)(void *p_sink, const void *data, U32 size);
+
+typedef struct
+{
+    T_EXPORT_WRITE write;
+    void *p_sink;
+} T_EXPORT_SINK;
+
+/**
+ * \brief Result of one flush
+ */
+typedef struct
+{
+    U32 seq;         /**< Batch number */
+    U32 records;
+    U32 bytes;
+    T_RESULT result; /**< Of the sink, RESULT_WRONG_STATE without one */
+} T_EXPORT_BATCH;
+
+/** \brief Called on the export thread after every flush */
+typedef void (*T_EXPORT_FLUSH_CB)(const T_EXPORT_BATCH *P_BATCH, void *p_data);
+
+typedef struct
+{
+    U32 data[EXPORT_BUFFER_SIZE / sizeof(U32)];
+    U32 used;        /**< Bytes appended */
+    U32 records;
+    U32 first_time;  /**< OsGetTimestamp() of the first record */
+    BOOL pending;    /**< Handed to the export thread, not filled */
+} T_EXPORT_BUFFER;
+
+/**
+ * \brief Exporter. Producers append to one buffer while the export
+ * thread writes the other one to the sink.
+ */
+typedef struct
+{
+    /** Static information */
+    const char *export_name;
+    U32 flush_size;             /**< Bytes after which a buffer is
+                                     flushed, 0 for when full */
+    U32 flush_age;              /**< Ticks after its first record a buffer
+                                     is flushed, 0 for never */
+    T_EXPORT_FLUSH_CB flush_cb; /**< May be NULL */
+    void *p_flush_data;
+
+    /** Runtime Information */
+    BOOL initialized;
+    T_EXPORT_SINK sink;
+    spinlock_t lock;            /**< Spinlock for the buffers */
+    U32 fill;                   /**< Buffer taking records */
+    T_EXPORT_BUFFER buffer[EXPORT_BUFFERS];
+    T_THREAD_TIMER age_timer;   /**< Flushes a buffer by age */
+    T_THREAD thread;            /**< Export thread */
+    T_THREAD_CB handlers[2];
+
+    struct {
+        U32 records;      /**< Records appended */
+        U32 dropped;      /**< Records refused, no free buffer */
+        U32 batches;      /**< Buffers flushed */
+        U32 by_size;      /**< Flushes over flush_size */
+        U32 by_age;       /**< Flushes over flush_age */
+        U32 sink_errors;  /**< Batches the sink failed on */
+        U32 bytes;        /**< Bytes written, wraps */
+    } stat;
+} T_EXPORT;
+
+/*******************************************************************
+ *  FUNCTION PROTOTYPES
+ ******************************************************************/
+
+T_RESULT Export_init(T_EXPORT *export);
+T_RESULT Export_set_sink(T_EXPORT *export, const T_EXPORT_SINK *P_SINK);
+T_RESULT Export_append(T_EXPORT *export, U16 type, const void *data,
+                       U32 size);
+U32 Export_free(T_EXPORT *export);
+T_RESULT Export_flush(T_EXPORT *export, void (*cb)(void *p_data),
+                      void *p_data);
+BOOL Export_event_hdlr(T_THREAD_EVENT *event);
+#if defined(OS_SIM)
+T_RESULT Export_fd_write(void *p_sink, const void *data, U32 size);
+#endif
+
+#endif /* EXPORT_H */
+/** @} */
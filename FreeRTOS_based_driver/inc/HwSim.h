@@ -0,0 +1,82 @@
+#if !defined(HWSIM_H)
+#define HWSIM_H
+
+/**
+ @addtogroup HWSIM
+ @{
+ */
+
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include <Internal.h>
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+/** \brief Number of simulated interrupt lines */
+#define HWSIM_IRQ_LINES 16
+
+/** \brief Simulated devices, the register base of one is its index */
+#define HWSIM_DEVICES 4
+
+/** \brief Interrupt line the device at base_ raises its IRQs on */
+#define HWSIM_IRQ_LINE(base_) (T_INTERRUPT_LINE_TIMEOUT + (base_))
+
+/** \brief Most IRQs the generator raises back to back */
+#define HWSIM_BURST_MAX 16
+
+/** \brief Ticks from power on to HW_STATUS_READY unless changed */
+#define HWSIM_POWER_UP_DELAY 1
+
+/** \brief Ticks from leaving a HW_POWER_LEVEL to HW_STATUS_READY, by the
+ * level left. Not ready for register access below full power. */
+#define HWSIM_EXIT_LATENCY_GATED 1
+#define HWSIM_EXIT_LATENCY_RETENTION 3
+#define HWSIM_EXIT_LATENCY_OFF 5
+
+/** \brief The generator preempts every task, like a HW interrupt */
+#define HWSIM_IRQ_TASK_PRIORITY ( configMAX_PRIORITIES - 1 )
+
+/*****************************************************************************/
+/* TYPE DEFINITIONS                                                          */
+/*****************************************************************************/
+/**
+ * \brief Interrupt generator settings
+ */
+typedef struct
+{
+    U32 rate;   /**< IRQs per second */
+    U32 burst;  /**< IRQs raised back to back, 1 .. HWSIM_BURST_MAX */
+    U32 jitter; /**< Random spread of the gap between bursts, 0 .. 100 % */
+    U32 seed;   /**< Seed of the jitter sequence */
+    U32 device; /**< Register base of the device raising them */
+} T_HWSIM_IRQ_CFG;
+
+/**
+ * \brief Statistics of a device model. Once the driver has acknowledged
+ * everything, irq_raised == irq_serviced + irq_coalesced.
+ */
+typedef struct
+{
+    U32 irq_raised;    /**< IRQs raised by the generator */
+    U32 irq_serviced;  /**< Pending IRQs cleared by the driver */
+    U32 irq_coalesced; /**< IRQs raised while the previous one was pending */
+    U32 irq_dropped;   /**< IRQs not raised, the device was not enabled */
+    U32 irq_pending;   /**< HW_REG_IRQ_STATUS now */
+    U32 bursts;        /**< Bursts raised */
+    U32 not_ready;     /**< Register accesses before power up or wake
+                            completed */
+} T_HWSIM_STAT;
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+void HwSim_setPowerUpDelay(U32 ticks);
+T_RESULT HwSim_startIrq(const T_HWSIM_IRQ_CFG * P_CFG);
+void HwSim_stopIrq(void);
+void HwSim_raiseIrq(uintptr_t base, U32 irq);
+void HwSim_getStat(uintptr_t base, T_HWSIM_STAT * P_STAT);
+
+/*@}*/
+
+#endif /* HWSIM_H */
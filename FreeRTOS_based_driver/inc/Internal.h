@@ -39,16 +39,68 @@
 
 #if defined(FAILED)
 #undef FAILED
-#define FAILED(result_) ((int)result_ >= (int)RESULT_FAILURE)
 #endif
+#define FAILED(result_) ((int)result_ >= (int)RESULT_FAILURE)
 
 #if defined(SUCCEEDED)
 #undef SUCCEEDED
-#define SUCCEEDED(result_) ((int)result_ < (int)RESULT_FAILURE)
 #endif
+#define SUCCEEDED(result_) ((int)result_ < (int)RESULT_FAILURE)
 
 #define MAX_THREAD_EVENT_ENTRIES 15
 #define MAX_SCHEDULER_QUEUE_ENTRIES 15
+#define MAX_CFG_TRANSACTION_ITEMS 8
+
+/* Scheduler call arguments up to this size are copied into the queue slot,
+ * larger ones (up to the block size) into the shared argument pool */
+#define SCHEDULER_INLINE_ARGS_SIZE 32
+#define SCHEDULER_ARGS_POOL_BLOCKS 8 /* at most 32 */
+#define SCHEDULER_ARGS_POOL_BLOCK_SIZE 256
+
+/* Bounds of the self adjusting spin window (in ring polls) used by threads
+ * running in THREAD_WAIT_MODE_ADAPTIVE */
+#define THREAD_SPIN_POLLS_MIN 16
+#define THREAD_SPIN_POLLS_MAX 4096
+/* Cycles a thread may spin between two blocks, tasks below it get the
+ * core at least while it blocks */
+#define THREAD_SPIN_BUDGET OS_CYCLES_PER_TICK
+
+/* Thread timer wheel: THREAD_TIMER_LEVELS levels of 2^THREAD_TIMER_SLOT_BITS
+ * slots, timers up to 2^(BITS * LEVELS) ticks ahead are filed directly */
+#define THREAD_TIMER_SLOT_BITS 6
+#define THREAD_TIMER_LEVELS 4
+
+/* CPU accounting: nesting depth of watched callbacks (handler, scheduler
+ * call, completion) and number of callbacks with their own account */
+#define THREAD_WATCH_DEPTH 4
+#define THREAD_ACCOUNT_ENTRIES 16
+
+/**
+ * \brief HW register access of the device at base_ (t_HW.reg_base).
+ * DRV_HW_SIM routes it to the simulated device models (HwSim.c), base_ is
+ * the model index there.
+ */
+#if defined(DRV_HW_SIM)
+#define HW_REG_READ(base_, reg_) HwSim_read(base_, reg_)
+#define HW_REG_WRITE(base_, reg_, value_) HwSim_write(base_, reg_, value_)
+#else
+#define HW_REG_READ(base_, reg_) (((volatile U32 *)(base_))[reg_])
+#define HW_REG_WRITE(base_, reg_, value_) (((volatile U32 *)(base_))[reg_] = (value_))
+#endif
+
+/* HW_REG_CTRL */
+#define HW_CTRL_ENABLE (1U << 0)
+/* HW_REG_STATUS */
+#define HW_STATUS_POWERED (1U << 0)
+#define HW_STATUS_READY (1U << 1)
+#define HW_STATUS_BUSY (1U << 2) /* an IRQ waits for the driver */
+/* HW_REG_POWER, as composed by Pow_setPowCfg */
+#define HW_POWER_ON (1U << 0)
+#define HW_POWER_LEVEL_SHIFT 1
+#define HW_POWER_LEVEL_MASK (3U << HW_POWER_LEVEL_SHIFT)
+#define HW_POWER_CLOCK_SHIFT 8
+/* HW_REG_IRQ_STATUS, write 1 to clear */
+#define HW_IRQ_TIMEOUT (1U << 0)
 
 #define LOG_EVENT(a,b) //printf(#a" - \n");
 #define log_event(a,b) //printf(#a" - \n");
@@ -74,10 +126,23 @@ typedef enum {
   RESULT_WRONG_STATE,
   RESULT_WRONG_CONFIGURATION,
   RESULT_WRONG_CONTEXT,
+  RESULT_TIMEOUT,
+  RESULT_CANCELLED,
 } T_RESULT;
 
 /**
- * \brief Structure of globals
+ * \brief HW registers, word offsets from HW_REG_BASE
+ */
+typedef enum {
+  HW_REG_CTRL,
+  HW_REG_STATUS,     /* read only */
+  HW_REG_POWER,
+  HW_REG_IRQ_STATUS,
+  HW_REG_MAX
+} T_HW_REG;
+
+/**
+ * \brief Driver state of one device
  */
 typedef struct {
   /* Signature to identify this structure in a memory dump */
@@ -86,6 +151,9 @@ typedef struct {
   /* TRUE=initialized, FALSE=NOT initialized */
   BOOL initialized;
 
+  /* Register block of the device, HW_REG_BASE for the first one */
+  uintptr_t reg_base;
+
   struct {
     /* Count total number of export timeout IRQs */
     U32 irq_timeout;
@@ -121,7 +189,11 @@ typedef struct {
 /*****************************************************************************/
 /* GLOBAL DATA                                                               */
 /*****************************************************************************/
-extern volatile t_HW hw;
+
+#if defined(DRV_HW_SIM)
+U32 HwSim_read(uintptr_t base, T_HW_REG reg);
+void HwSim_write(uintptr_t base, T_HW_REG reg, U32 value);
+#endif
 
 /*@}*/
 
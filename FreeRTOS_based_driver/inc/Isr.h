@@ -18,12 +18,36 @@
 /*****************************************************************************/
 /* TYPE DEFINITIONS                                                          */
 /*****************************************************************************/
+/** \brief Called when the worker thread takes a raised line, task context.
+ * IRQs coalesced before the take are seen once. */
+typedef void (*T_ISR_HOOK)(U32 vector_number);
+
+/**
+ * \brief Interrupt line of one device. Its IRQs are counted in the t_HW
+ * of the device and signalled to the worker thread, which may serve
+ * the lines of several devices with one event.
+ */
+typedef struct isr_s
+{
+    U32 line;
+    T_THREAD *worker_thread;
+    volatile t_HW *p_hw;
+
+    OsIrqIsr irq;
+    volatile BOOL pending; /**< Raised, not yet taken by the worker thread */
+
+    /* ISR initialized */
+    BOOL initialized;
+} T_ISR;
 
 /*****************************************************************************/
 /* EXPORTED FUNCTIONS                                                        */
 /*****************************************************************************/
-void Isr_init(T_THREAD *p_worker_thread);
-void Isr_unmaskIrqs( BOOL onOff );
+void Isr_init(T_ISR *p_isr, U32 line, T_THREAD *p_worker_thread,
+              volatile t_HW *p_hw);
+void Isr_unmaskIrqs( T_ISR *p_isr, BOOL onOff );
+BOOL Isr_takePending(T_ISR *p_isr);
+void Isr_setHook( T_ISR_HOOK hook );
 
 /*@}*/
 
@@ -11,12 +11,166 @@
 /* INCLUDES                                                                  */
 /*****************************************************************************/
 #include <stdint.h>
+#include <Thread.h>
+#include <Scheduler.h>
+#include <Isr.h>
+#include <Pow.h>
+#include <Export.h>
+#include <Completion.h>
+
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+/** \brief Driver thread watchdog: check period and the time a single
+ * callback may run before it is reported as hung */
+#define MAIN_WATCHDOG_PERIOD pdMS_TO_TICKS( 10UL )
+#define MAIN_WATCHDOG_LIMIT_TICKS pdMS_TO_TICKS( 100UL )
+
+/** \brief State passed to a Main_getState callback whose request was
+ * dequeued after its TTL */
+#define MAIN_STATE_EXPIRED 0xFFFFFFFFU
+
+/** \brief T_MAIN_STATE_SNAPSHOT.cfg_status, outcome of the last
+ * configuration request completed */
+#define MAIN_CFG_APPLIED 0U
+#define MAIN_CFG_EXPIRED 1U /**< Dequeued after its TTL, HW untouched */
+#define MAIN_CFG_FAILED 2U  /**< HW not ready in DRV_POWER_UP_TIMEOUT, OFF */
+
+/** \brief Export of the published states: a buffer goes to the sink when
+ * full or this long after its first record */
+#define MAIN_EXPORT_FLUSH_AGE pdMS_TO_TICKS( 50UL )
+
+/** \brief Configuration and state requests held back during a power up,
+ * as many as both lanes of the event queue hold */
+#define MAIN_DEFERRED_EVENTS \
+  (THREAD_EVENT_PRIORITY_MAX * MAX_THREAD_EVENT_ENTRIES)
+
+/** \brief Driver threads: the pool shared by the devices and the threads
+ * of devices with one of their own */
+#define MAIN_THREADS_MAX 4
+
+/** \brief Pool threads unless changed by Main_setPoolThreads */
+#define MAIN_POOL_THREADS 1
+
+/*****************************************************************************/
+/* TYPE DEFINITIONS                                                          */
+/*****************************************************************************/
+/**
+ * \brief Driver state as published after the last event handled by the
+ * driver thread
+ */
+typedef struct
+{
+    U32 device;      /**< T_MAIN_DEVICE.index */
+    U32 generation;  /**< Number of snapshots published so far */
+    U32 mode;        /**< ON / OFF */
+    U32 clock;       /**< HW clock setting */
+    U32 power_level; /**< T_POW_LEVEL picked by automatic power management */
+    U32 irq_timeout; /**< Timeout IRQs seen */
+    U32 queue_depth; /**< Events still queued on the driver thread */
+    U32 cfg_status;  /**< MAIN_CFG_APPLIED / _EXPIRED / _FAILED */
+    U32 cfg_expired; /**< Configuration requests completed unapplied */
+} T_MAIN_STATE_SNAPSHOT;
+
+/**
+ * \brief Export record types of the driver thread
+ */
+typedef enum
+{
+    MAIN_EXPORT_STATE = 1 /**< T_MAIN_STATE_SNAPSHOT after every event */
+} T_MAIN_EXPORT_TYPE;
+
+struct main_shard_s;
+
+/**
+ * \brief A device of the driver. device_name, reg_base, irq_line,
+ * scheduler and own_thread are set by the owner before Main_addDevice,
+ * the memory stays valid from then on. The Main_dev* calls take it,
+ * NULL for the first device (Main_init).
+ */
+typedef struct main_device_s
+{
+    /** Static information */
+    const char *device_name;
+    uintptr_t reg_base;     /**< Register block */
+    U32 irq_line;           /**< Timeout interrupt line */
+    T_SCHEDULER *scheduler; /**< Remote calls into the device, may be NULL */
+    BOOL own_thread;        /**< Thread of its own, else a pool thread */
+
+    /** Runtime Information */
+    U32 index;                   /**< Order of Main_addDevice */
+    volatile t_HW hw;
+    T_ISR isr;
+    T_POW pow;                   /**< Idle power levels of the device */
+    struct main_shard_s *shard;  /**< Driver thread serving the device */
+    struct main_device_s *next;  /**< Next device of the same thread */
+    T_COMPLETION_QUEUE *completion_queue; /**< Main_devSetCompletionQueue */
+    U32 cfg_status;              /**< Published as the snapshot fields */
+    U32 cfg_expired;
+
+    /** Seqlock protected state snapshot, written by the driver thread
+     *  only. seq is odd while an update is in progress. */
+    struct
+    {
+        volatile U32 seq;
+        T_MAIN_STATE_SNAPSHOT state;
+    } snapshot;
+
+    /** Drv_setMode ON from OFF as an async handler: the driver thread
+     *  goes on with other events while the HW powers up. Configuration
+     *  and state requests of the device arriving meanwhile are held back
+     *  to keep their order. */
+    struct
+    {
+        BOOL enabled;        /**< Main_devSetPowerUpAsync */
+        T_THREAD_ASYNC async;
+        T_EVENT_CFG set_cfg; /**< Request being applied */
+        U32 rd;
+        U32 wr;
+        T_THREAD_EVENT deferred[MAIN_DEFERRED_EVENTS];
+    } power_up;
+} T_MAIN_DEVICE;
 
 /*****************************************************************************/
 /* EXPORTED FUNCTIONS                                                        */
 /*****************************************************************************/
 void Main_init(void);
+T_RESULT Main_setPoolThreads(U32 count);
+T_RESULT Main_addDevice(T_MAIN_DEVICE * device);
+void Main_reqSetMode(const t_base_cfg * P_MODE, void (*cb)(void*),
+                     void * p_cb_data);
+void Main_reqSetModeUrgent(const t_base_cfg * P_MODE, void (*cb)(void*),
+                           void * p_cb_data);
 void Main_getState(void (*cb)(U32 State));
+void Main_getStateTtl(void (*cb)(U32 State), U32 ttl);
+void Main_readState(T_MAIN_STATE_SNAPSHOT * P_STATE);
+T_RESULT Main_setExportSink(const T_EXPORT_SINK * P_SINK);
+void Main_setPowerUpAsync(BOOL on);
+T_RESULT Main_setCompletionQueue(T_COMPLETION_QUEUE * queue);
+void Main_reqSetPowerPolicy(const T_POW_POLICY * P_POLICY,
+                            void (*cb)(void*), void * p_cb_data);
+T_RESULT Main_reqSetConfigTransaction(const T_CFG_TRANSACTION * P_TRANSACTION,
+                                      void (*cb)(void*), void * p_cb_data);
+
+void Main_devReqSetMode(T_MAIN_DEVICE * device, const t_base_cfg * P_MODE,
+                        void (*cb)(void*), void * p_cb_data);
+void Main_devReqSetModeUrgent(T_MAIN_DEVICE * device,
+                              const t_base_cfg * P_MODE,
+                              void (*cb)(void*), void * p_cb_data);
+T_RESULT Main_devReqSetConfigTransaction(T_MAIN_DEVICE * device,
+                                         const T_CFG_TRANSACTION * P_TRANSACTION,
+                                         void (*cb)(void*), void * p_cb_data);
+void Main_devReqSetPowerPolicy(T_MAIN_DEVICE * device,
+                               const T_POW_POLICY * P_POLICY,
+                               void (*cb)(void*), void * p_cb_data);
+void Main_devGetState(T_MAIN_DEVICE * device, void (*cb)(U32 State));
+void Main_devGetStateTtl(T_MAIN_DEVICE * device, void (*cb)(U32 State),
+                         U32 ttl);
+void Main_devReadState(T_MAIN_DEVICE * device,
+                       T_MAIN_STATE_SNAPSHOT * P_STATE);
+void Main_devSetPowerUpAsync(T_MAIN_DEVICE * device, BOOL on);
+T_RESULT Main_devSetCompletionQueue(T_MAIN_DEVICE * device,
+                                    T_COMPLETION_QUEUE * queue);
 /*@}*/
 
 #endif /* MAIN_H */
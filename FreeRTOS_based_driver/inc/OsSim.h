@@ -0,0 +1,153 @@
+#if !defined(OSSIM_H)
+#define OSSIM_H
+
+/**
+ @addtogroup OSSIM
+ @{
+ */
+
+/*
+ * Host simulation of the FreeRTOS API subset used by the driver. Time is
+ * virtual: it advances while tasks poll the clock or yield (modelled CPU
+ * time) and jumps straight to the next timeout or timer expiry when every
+ * task is blocked. Tasks are switched only inside these calls, in an order
+ * fixed by priority and the seed, so a run is reproducible.
+ */
+
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include <stdint.h>
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+#define OS_SIM_TASKS_MAX 16
+#define OS_SIM_EVENT_GROUPS_MAX 16
+#define OS_SIM_SEMAPHORES_MAX 32
+#define OS_SIM_TIMERS_MAX 16
+/** \brief Every task gets this stack, the requested depth is ignored */
+#define OS_SIM_STACK_SIZE (64 * 1024)
+
+/** \brief Modelled CPU time, in cycles */
+#define OS_SIM_CYCLES_PER_TICK 1000
+#define OS_SIM_TICK_READ_CYCLES 1 /**< xTaskGetTickCount */
+#define OS_SIM_YIELD_CYCLES 10    /**< taskYIELD */
+#define OS_SIM_RELAX_CYCLES 4     /**< OsCpuRelax */
+#define OS_SIM_ISR_CYCLES 2       /**< Interrupt entry and exit */
+
+/** \brief Virtual run time unless given on the command line */
+#define OS_SIM_RUN_TIME_DEFAULT 60 /* s */
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY 0xffffffffUL
+#define tskIDLE_PRIORITY 0
+#define configMAX_PRIORITIES 7
+#define configMINIMAL_STACK_SIZE 128
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(x) ((TickType_t)(((uint64_t)(x) * configTICK_RATE_HZ) / 1000))
+
+#define taskENTER_CRITICAL() OsSim_enterCritical()
+#define taskEXIT_CRITICAL() OsSim_exitCritical()
+#define taskYIELD() OsSim_yield()
+#define taskENTER_CRITICAL_FROM_ISR() OsSim_enterCriticalFromIsr()
+#define taskEXIT_CRITICAL_FROM_ISR(x) OsSim_exitCriticalFromIsr(x)
+#define portYIELD_FROM_ISR(x) ((void)(x))
+
+/*****************************************************************************/
+/* TYPE DEFINITIONS                                                          */
+/*****************************************************************************/
+typedef int BOOL;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t EventBits_t;
+typedef unsigned long StackType_t;
+
+typedef struct os_sim_task_s *TaskHandle_t;
+typedef struct os_sim_event_group_s *EventGroupHandle_t;
+typedef struct os_sim_semaphore_s *SemaphoreHandle_t;
+typedef struct os_sim_timer_s *TimerHandle_t;
+
+typedef void (*TaskFunction_t)(void *);
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t);
+
+/*
+ * Storage of the *CreateStatic variants, sized about like the 32 bit
+ * FreeRTOS port. The simulator keeps its objects in pre-allocated pools and
+ * does not touch this storage; only the dynamic variants count as heap use.
+ */
+typedef struct { uint32_t reserved[24]; } StaticTask_t;
+typedef struct { uint32_t reserved[8]; } StaticEventGroup_t;
+typedef struct { uint32_t reserved[11]; } StaticTimer_t;
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+void OsSim_enterCritical(void);
+void OsSim_exitCritical(void);
+void OsSim_yield(void);
+void OsSim_relax(void);
+UBaseType_t OsSim_enterCriticalFromIsr(void);
+void OsSim_exitCriticalFromIsr(UBaseType_t mask);
+void OsSim_isrEnter(void);
+void OsSim_isrExit(void);
+BaseType_t xPortIsInsideInterrupt(void);
+uint32_t OsSim_rand(void);
+uint32_t OsSim_heapAllocs(void);
+uint32_t OsSim_cycles(void);
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint16_t depth,
+                       void *param, UBaseType_t priority, TaskHandle_t *p_task);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t func, const char *name,
+                               uint32_t depth, void *param,
+                               UBaseType_t priority, StackType_t *stack,
+                               StaticTask_t *tcb);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+void vTaskStartScheduler(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout);
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *storage);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear, BaseType_t all,
+                                TickType_t timeout);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits);
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits,
+                                     BaseType_t *p_woken);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group);
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period,
+                           UBaseType_t auto_reload, void *id,
+                           TimerCallbackFunction_t cb);
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period,
+                                 UBaseType_t auto_reload, void *id,
+                                 TimerCallbackFunction_t cb,
+                                 StaticTimer_t *storage);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period,
+                              TickType_t wait);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+/*@}*/
+
+#endif /* OSSIM_H */
@@ -13,15 +13,74 @@
 /*****************************************************************************/
 /* DEFINES                                                                   */
 /*****************************************************************************/
+/** \brief Max doubling of the idle thresholds after too short sleeps */
+#define POW_BACKOFF_MAX 3
 
 /*****************************************************************************/
 /* TYPE DEFINITIONS                                                          */
 /*****************************************************************************/
+/**
+ * \brief HW power levels, from full power to off
+ */
+typedef enum
+{
+    POW_LEVEL_ON = 0,      /**< Powered and clocked */
+    POW_LEVEL_CLOCK_GATED, /**< Clock gated, state kept */
+    POW_LEVEL_RETENTION,   /**< Retention, slower to wake */
+    POW_LEVEL_OFF,         /**< Power removed, restored on wake */
+    POW_LEVEL_MAX
+} T_POW_LEVEL;
+
+/**
+ * \brief Automatic power management policy
+ */
+typedef struct
+{
+    /** Idle time of the driver thread before entering the level,
+     *  0 if the level is not used. idle_time[POW_LEVEL_ON] is ignored. */
+    U32 idle_time[POW_LEVEL_MAX];
+} T_POW_POLICY;
+
+/**
+ * \brief Power management statistics
+ */
+typedef struct
+{
+    T_POW_LEVEL level;               /**< Current level */
+    U32 residency[POW_LEVEL_MAX];    /**< Time spent per level */
+    U32 entries[POW_LEVEL_MAX];      /**< Times each level was entered */
+    U32 wakeups;                     /**< Wakes from a low power level */
+    U32 wake_latency_max;            /**< Longest wake, request to ready */
+    U32 wake_latency_total;          /**< Sum of wake times */
+    U32 wake_timeouts;               /**< Wakes the HW did not get ready */
+    U32 backoff;                     /**< Current threshold doubling */
+} T_POW_STAT;
+
+/**
+ * \brief Automatic power management state of one device, owned by the
+ * driver thread serving it
+ */
+typedef struct
+{
+    volatile t_HW *p_hw; /**< Managed device, Pow_init */
+    T_POW_POLICY policy;
+    T_POW_LEVEL level;  /**< Current level */
+    U32 level_enter;    /**< Time the current level was entered */
+    U32 backoff;        /**< Idle thresholds are shifted left by this */
+    T_POW_STAT stat;
+} T_POW;
 
 /*****************************************************************************/
 /* EXPORTED FUNCTIONS                                                        */
 /*****************************************************************************/
-U32 Pow_setPowCfg(U32 onOff, U32 clock);
+U32 Pow_setPowCfg(volatile t_HW * p_hw, U32 onOff, U32 clock);
+void Pow_init(T_POW * p_pow, volatile t_HW * p_hw);
+void Pow_setPolicy(T_POW * p_pow, const T_POW_POLICY * P_POLICY);
+const T_POW_POLICY * Pow_getPolicy(const T_POW * P_POW);
+U32 Pow_onIdle(T_POW * p_pow, U32 idle_time);
+void Pow_wake(T_POW * p_pow);
+T_POW_LEVEL Pow_getLevel(const T_POW * P_POW);
+void Pow_getStat(const T_POW * P_POW, T_POW_STAT * P_STAT);
 
 /*@}*/
 
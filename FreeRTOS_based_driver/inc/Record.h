@@ -0,0 +1,142 @@
+#if !defined(RECORD_H)
+#define RECORD_H
+
+/**
+ @addtogroup RECORD
+ @{
+ */
+
+/*
+ * Event stream recorder. Every event posted to the recorded threads and
+ * every interrupt is written as one export record (T_EXPORT_RECORD header,
+ * T_RECORD_EVENT payload) to a sink, the log is the batches back to back.
+ * A replay posts the log again at its original pace or as fast as the
+ * driver takes it and reports the latency distribution.
+ */
+
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include <Thread.h>
+#include <Scheduler.h>
+#include <Export.h>
+#include <Pow.h>
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+#define RECORD_THREADS_MAX 4
+
+/** \brief T_RECORD_EVENT.thread of an interrupt */
+#define RECORD_THREAD_IRQ 0xFFU
+
+/** \brief Ticks a quiet recording stays buffered */
+#define RECORD_FLUSH_AGE pdMS_TO_TICKS( 100UL )
+
+/** \brief Replayed events and calls in flight, below the queue lengths */
+#define RECORD_SLOTS 8
+
+/** \brief Latency buckets of a replay, bucket n counts latencies of n
+ * significant bits in OsGetCycles() units */
+#define RECORD_LATENCY_BUCKETS 24
+
+/** \brief Longest wait of a replay for the driver to finish */
+#define RECORD_DRAIN_TIMEOUT pdMS_TO_TICKS( 1000UL )
+
+/*****************************************************************************/
+/* TYPE DEFINITIONS                                                          */
+/*****************************************************************************/
+/**
+ * \brief Export record types of the log
+ */
+typedef enum
+{
+    RECORD_TYPE_EVENT = 1, /**< Event posted to a recorded thread */
+    RECORD_TYPE_IRQ        /**< Interrupt, once its worker thread takes it */
+} T_RECORD_TYPE;
+
+/**
+ * \brief Payload of a record. Only the part of value used by the event is
+ * written, the header time is the OsGetTimestamp() of the post.
+ */
+typedef struct
+{
+    U8 thread;   /**< Index in T_RECORD_CFG.threads, RECORD_THREAD_IRQ */
+    U8 event;    /**< T_THREAD_EVENT_TYPE */
+    U8 prio;     /**< T_THREAD_EVENT_PRIORITY */
+    U8 cfg_type; /**< T_CFG of THREAD_EVENT_SET_CFG */
+    U32 ttl;
+    union
+    {
+        t_base_cfg mode;     /**< CFG_SET_MODE, CFG_SET_CLOCK */
+        T_POW_POLICY policy; /**< CFG_SET_POWER_POLICY */
+        U32 vector;          /**< Interrupt */
+    } value;
+} T_RECORD_EVENT;
+
+/**
+ * \brief Recording settings
+ */
+typedef struct
+{
+    T_THREAD *threads[RECORD_THREADS_MAX]; /**< Recorded, NULL if unused */
+    T_EXPORT_SINK sink;                    /**< Receives the log */
+} T_RECORD_CFG;
+
+typedef struct
+{
+    U32 records; /**< Written to the log */
+    U32 dropped; /**< Lost, sink too slow; the log has gaps */
+    U32 bytes;
+} T_RECORD_STAT;
+
+typedef enum
+{
+    RECORD_REPLAY_TIMED = 0, /**< Records posted at their original pace */
+    RECORD_REPLAY_FAST       /**< Next record once a slot is free */
+} T_RECORD_REPLAY_MODE;
+
+/**
+ * \brief Replay settings. Thread n of the recording is replayed on
+ * threads[n], which has to handle T_EVENT_CFG and T_GET_STATE_EVENT.
+ */
+typedef struct
+{
+    const void *log;
+    U32 size;
+    T_THREAD *threads[RECORD_THREADS_MAX];
+    T_SCHEDULER *scheduler; /**< Runs a no-op per recorded call, may be NULL */
+    T_RECORD_REPLAY_MODE mode;
+} T_RECORD_REPLAY_CFG;
+
+/**
+ * \brief Replay results, latencies from the post to the completion
+ */
+typedef struct
+{
+    U32 records;   /**< Read from the log */
+    U32 replayed;  /**< Events, calls and interrupts posted again */
+    U32 irqs;      /**< Of replayed, coalesced so not completed */
+    U32 skipped;   /**< Not replayable: pointers, internal events */
+    U32 completed; /**< Replayed events and calls seen finishing */
+    U32 recorded;  /**< Span of the log, OsGetTimestamp() units */
+    U32 duration;  /**< First post to last completion */
+    U32 latency_max;                          /**< OsGetCycles() units */
+    U32 latency[RECORD_LATENCY_BUCKETS];
+} T_RECORD_REPORT;
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+T_RESULT Record_start(const T_RECORD_CFG * P_CFG);
+T_RESULT Record_stop(T_RECORD_STAT * p_stat);
+T_RESULT Record_replay(const T_RECORD_REPLAY_CFG * P_CFG,
+                       T_RECORD_REPORT * p_report);
+#if defined(OS_SIM)
+T_RESULT Record_replayFile(const char * P_PATH,
+                           const T_RECORD_REPLAY_CFG * P_CFG,
+                           T_RECORD_REPORT * p_report);
+#endif
+
+/*@}*/
+
+#endif /* RECORD_H */
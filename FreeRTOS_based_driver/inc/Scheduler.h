@@ -24,9 +24,18 @@
   static struct {                                                  \
     T_SCHEDULER base;                                          \
     T_SCHEDULER_REMOTE_CALL queue[queue_length_];              \
-  } tmp_##name_ = { { #name_, queue_length_ } };               \
+    U16 heap[queue_length_];                                   \
+  } tmp_##name_ = { { .scheduler_name = #name_,                \
+                      .queue_length = queue_length_,           \
+                      .heap = tmp_##name_.heap } };            \
   static T_SCHEDULER *name_ = &tmp_##name_.base
 
+/**
+ * \brief Deficit added per round to a scheduler of share 1 when several
+ * schedulers share a thread
+ */
+#define SCHEDULER_DRR_QUANTUM SCHEDULER_GRANT_1
+
 /*******************************************************************
  *  TYPE DEFINITIONS
  ******************************************************************/
@@ -36,8 +45,39 @@ typedef enum
     SCHEDULER_SUSPEND   /**< Scheduler is suspended */
 } T_SCHEDULER_STATE;
 
+/**
+ * \brief Execution order of the queued remote calls
+ */
+typedef enum
+{
+    SCHEDULER_ORDER_FIFO = 0, /**< Calls run in enqueue order */
+    SCHEDULER_ORDER_EDF       /**< Earliest deadline first, calls without
+                                   deadline run last in enqueue order */
+} T_SCHEDULER_ORDER;
+
 typedef T_RESULT (*T_SCHEDULER_CALLBACK)(void *param);
 
+/**
+ * \brief Reports a call which reached the head of the queue after its
+ * deadline, lateness in OsGetTimestamp() units
+ */
+typedef void (*T_SCHEDULER_MISS_CB)(T_SCHEDULER_CALLBACK func,
+                                    void *func_args, U32 lateness);
+
+/**
+ * \brief Optional per call parameters of Scheduler_run_ex and
+ * Scheduler_run_async_ex (NULL selects the defaults)
+ */
+typedef struct
+{
+    U32 cost; /**< Grant consumed by the call, SCHEDULER_GRANT_1 by default */
+    U32 deadline; /**< Relative to the enqueue time in OsGetTimestamp()
+                       units, 0 for no deadline */
+    U32 args_size; /**< If not 0, func_args is copied at enqueue time and
+                        the callback gets the copy. Up to
+                        SCHEDULER_ARGS_POOL_BLOCK_SIZE bytes */
+} T_SCHEDULER_CALL_PARAMS;
+
 typedef struct
 {
     BOOL processed;
@@ -45,30 +85,84 @@ typedef struct
     void *func_args;
     T_RESULT *result;
     OsSem *sem;
+    U32 cost;
+    U32 enqueue_time;
+    U32 seq;            /**< Enqueue order, breaks deadline ties */
+    U32 deadline;       /**< Absolute deadline if has_deadline */
+    BOOL has_deadline;
+    BOOL deadline_missed; /**< Miss already reported */
+    void *args_pool;      /**< Pool block holding the argument copy */
+    U32 inherit_priority; /**< Priority lent to the thread by a blocked
+                               caller, 0 for none */
+    /** Argument copy of up to SCHEDULER_INLINE_ARGS_SIZE bytes */
+    void *args_inline[SCHEDULER_INLINE_ARGS_SIZE / sizeof(void *)];
 } T_SCHEDULER_REMOTE_CALL;
 
 /**
  * \brief Scheduler instance information
  */
-typedef struct
+typedef struct scheduler_s
 {
     const char *scheduler_name;
     const U16 queue_length;
+    U16 *const heap; /**< queue slot indices ordered by deadline (EDF) */
 
     /** Runtime Information */
     T_THREAD *thread;
     T_SCHEDULER_STATE state; /**< Scheduler running state */
 
+    /* deficit round robin among the schedulers of one thread */
+    struct scheduler_s *next; /**< Next scheduler served by the thread */
+    U32 share;                /**< Weight, 0 is taken as 1 */
+    U32 deficit;              /**< Grant this scheduler may still use in
+                                   the current round */
+
     spinlock_t lock;             /**< Spinlock for object data */
 
     BOOL initialized;
 
     volatile U32 current_grant;
 
-    /* circular work queue */
+    /* token bucket refill, refill_period == 0 disables it */
+    U32 refill_amount;   /**< Grant added every refill period */
+    U32 refill_period;   /**< Refill period in OsGetTimestamp() units */
+    U32 burst;           /**< Refill stops at this grant */
+    U32 last_refill;     /**< Time of the last refill */
+    OsTimer refill_timer; /**< Wakes a starved scheduler at the next refill */
+#if defined(DRV_STATIC_ALLOC)
+    OsTimerMem refill_timer_mem; /**< Storage of refill_timer */
+#endif
+
+    BOOL starving;       /**< Head of the queue is waiting for grant */
+    U32 starve_start;    /**< Time the head of the queue started waiting */
+
+    struct {
+        U32 calls;            /**< Calls executed */
+        U32 inline_calls;     /**< Scheduler_run calls executed inline by
+                                   the scheduler thread itself */
+        U32 grant_consumed;   /**< Sum of the cost of executed calls */
+        U32 wait_time;        /**< Total enqueue to execution time */
+        U32 wait_time_max;    /**< Longest enqueue to execution time */
+        U32 starved;          /**< Times the queue stalled on grant */
+        U32 starved_time;     /**< Total time queued calls waited on grant */
+        U32 starved_time_max; /**< Longest single stall */
+        U32 deadline_missed;  /**< Calls which reached the head too late */
+        U32 deadline_dropped; /**< Late calls dropped without running */
+        U32 args_pool_empty;  /**< Enqueues failed for lack of a pool block */
+    } stat;
+
+    T_SCHEDULER_ORDER order;
+    BOOL drop_missed;              /**< Drop calls past their deadline */
+    T_SCHEDULER_MISS_CB miss_cb;   /**< Deadline miss report, may be NULL */
+    U32 seq;                       /**< Next enqueue sequence number */
+
+    /* circular work queue (SCHEDULER_ORDER_FIFO) */
     volatile U16 queue_wr; /**< Writer location */
     volatile U16 queue_rd; /**< Reader location */
 
+    /* deadline heap over the queue slots (SCHEDULER_ORDER_EDF) */
+    volatile U16 heap_count;
+
     T_SCHEDULER_REMOTE_CALL queue[1];
 } T_SCHEDULER;
 
@@ -86,12 +180,32 @@ T_RESULT Scheduler_init(T_SCHEDULER *scheduler,
                                      T_THREAD *thread,
                                      U32 initial_grant);
 T_RESULT Scheduler_grant(T_SCHEDULER *scheduler, U32 grant);
+T_RESULT Scheduler_set_share(T_SCHEDULER *scheduler, U32 share);
+T_RESULT Scheduler_set_order(T_SCHEDULER *scheduler,
+                                     T_SCHEDULER_ORDER order,
+                                     BOOL drop_missed,
+                                     T_SCHEDULER_MISS_CB miss_cb);
+T_RESULT Scheduler_set_rate(T_SCHEDULER *scheduler,
+                                    U32 refill_amount,
+                                    U32 refill_period,
+                                    U32 burst);
 T_RESULT Scheduler_run_async(T_SCHEDULER *scheduler,
                                           T_SCHEDULER_CALLBACK func,
                                           void *func_arg);
+T_RESULT Scheduler_run_async_ex(T_SCHEDULER *scheduler,
+                                     T_SCHEDULER_CALLBACK func,
+                                     void *func_args,
+                                     const T_SCHEDULER_CALL_PARAMS *params);
+/* Block until the call ran, RESULT_TIMEOUT if it was cancelled after the
+ * OsSemObtain timeout. With DRV_STATIC_ALLOC the wait takes the caller's
+ * task notification (see OsSemCreate). */
 T_RESULT Scheduler_run(T_SCHEDULER *scheduler,
                                     T_SCHEDULER_CALLBACK func,
                                     void *func_args);
+T_RESULT Scheduler_run_ex(T_SCHEDULER *scheduler,
+                               T_SCHEDULER_CALLBACK func,
+                               void *func_args,
+                               const T_SCHEDULER_CALL_PARAMS *params);
 BOOL Scheduler_event_hdlr(T_THREAD_EVENT *event);
 void Scheduler_suspend(T_SCHEDULER *scheduler);
 
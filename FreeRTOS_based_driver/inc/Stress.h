@@ -0,0 +1,79 @@
+#if !defined(STRESS_H)
+#define STRESS_H
+
+/**
+ @addtogroup STRESS
+ @{
+ */
+
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include <Thread.h>
+#include <Scheduler.h>
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+#define STRESS_PRODUCERS_MAX 8
+
+/** \brief Producers share the CPU with the test task, below the driver */
+#define STRESS_PRODUCER_PRIORITY ( tskIDLE_PRIORITY + 1 )
+
+/** \brief Longest wait for the driver to work off what was posted */
+#define STRESS_DRAIN_TIMEOUT pdMS_TO_TICKS( 1000UL )
+
+/*****************************************************************************/
+/* TYPE DEFINITIONS                                                          */
+/*****************************************************************************/
+/**
+ * \brief Operations of the producers
+ */
+typedef enum
+{
+    STRESS_OP_EVENT = 0, /**< THREAD_EVENT_SET_CFG, current mode again */
+    STRESS_OP_RUN_ASYNC, /**< Scheduler_run_async_ex */
+    STRESS_OP_RUN,       /**< Scheduler_run_ex */
+    STRESS_OP_IRQ,       /**< Simulated timeout IRQ */
+    STRESS_OP_MAX
+} T_STRESS_OP;
+
+/**
+ * \brief Load generator settings
+ */
+typedef struct
+{
+    T_THREAD *thread;       /**< Driver thread handling the events */
+    T_SCHEDULER *scheduler; /**< FIFO scheduler linked to that thread */
+    U32 producers;          /**< 1 .. STRESS_PRODUCERS_MAX */
+    U32 duration;           /**< OsGetTimestamp() units */
+    U32 mix[STRESS_OP_MAX]; /**< Relative weight of each operation */
+    U32 seed;               /**< Producer n uses seed + n */
+} T_STRESS_CFG;
+
+/**
+ * \brief Load generator results. Tags are checked per producer and path
+ * (thread events, scheduler calls), FIFO order only holds within a path.
+ */
+typedef struct
+{
+    U32 posted;      /**< Tagged events and calls accepted by the driver */
+    U32 received;    /**< Tags seen by the checker */
+    U32 lost;        /**< Tags never seen */
+    U32 duplicated;  /**< Tags seen more than once */
+    U32 reordered;   /**< Tags seen after a later one of the same path */
+    U32 rejected;    /**< Posts refused (queue full), retried */
+    U32 irqs;        /**< Simulated IRQs, coalesced so not tagged */
+    U32 duration;    /**< Load time */
+    U32 throughput;  /**< Tags received per second */
+    U32 latency_max; /**< Post to handler, scheduler calls */
+    U32 latency_avg;
+} T_STRESS_REPORT;
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+T_RESULT Stress_run(const T_STRESS_CFG * P_CFG, T_STRESS_REPORT * p_report);
+
+/*@}*/
+
+#endif /* STRESS_H */
@@ -18,29 +18,65 @@
 
 #define Thread_send_event(thread, event, option )        \
   (Thread_send_event_ex(thread, event, NULL, 0,option))
+
+/** \brief Event group bit used to signal work in a priority lane */
+#define THREAD_EVENT_LANE_BIT(prio_) (1U << (prio_))
+#define THREAD_EVENT_LANE_MASK \
+  ((1U << THREAD_EVENT_PRIORITY_MAX) - 1U)
+
+#define THREAD_TIMER_SLOTS (1U << THREAD_TIMER_SLOT_BITS)
 /*******************************************************************
  *  TYPE DEFINITIONS
  ******************************************************************/
 
 typedef struct
 {
+    void *exporter; /**< T_EXPORT owning the buffer */
     U32 bufferId; /**< Buffer to operate on */
 } T_EVENT_BUFFER;
 
 typedef enum
 {
     CFG_SET_MODE=0,
-    CFG_MAX
+    CFG_SET_CLOCK,
+    CFG_SET_POWER_POLICY,
+    CFG_MAX,
+    CFG_TRANSACTION = CFG_MAX /**< T_EVENT_CFG only, carries a T_CFG_TRANSACTION */
 } T_CFG;
+
+/**
+ * \brief One configuration item of a transaction
+ */
+typedef struct
+{
+    union {
+        const t_base_cfg *P_MODE;
+        const void * P_CFG;
+    }cfg;
+    T_CFG cfg_type;
+} T_CFG_ITEM;
+
+/**
+ * \brief Configuration items applied together in one IRQ mask window.
+ * Must stay valid until the completion callback.
+ */
+typedef struct
+{
+    U32 count;
+    T_CFG_ITEM items[MAX_CFG_TRANSACTION_ITEMS];
+} T_CFG_TRANSACTION;
+
 typedef struct
 {
     union {
         const t_base_cfg *P_MODE;
         const void * P_CFG;
+        const T_CFG_TRANSACTION *P_TRANSACTION;
     }cfg;
     T_CFG cfg_type;
     void (*completion_callback)(void *);
     void * p_completion_callback_data;
+    void * device; /**< T_MAIN_DEVICE, NULL for the first device */
 } T_EVENT_CFG;
 
 typedef struct
@@ -55,6 +91,28 @@ typedef struct
     U32 tag;
 } T_SCHEDULER_EVENT;
 
+/**
+ * \brief Timer of the thread timer service. Owned by the caller, who sets
+ * callback and p_data; must stay valid while armed.
+ */
+typedef struct thread_timer_s
+{
+    struct thread_timer_s *next;   /**< Next timer of the same slot */
+    struct thread_timer_s **pprev; /**< Link pointing here, NULL if stopped */
+    U32 expiry;                    /**< Tick the timer is due at */
+    U32 period;                    /**< Re-arm interval, 0 for one shot */
+    void (*callback)(void *p_data);
+    void *p_data;
+} T_THREAD_TIMER;
+
+typedef struct
+{
+    T_THREAD_TIMER *timer;
+    void (*callback)(void *p_data);
+    void *p_data;
+    U32 lateness; /**< Ticks between expiry and delivery */
+} T_TIMER_EVENT;
+
 /**
  * \brief A list of all possible thread events
  */
@@ -66,6 +124,10 @@ typedef enum
     THREAD_EVENT_SCHED_GRANT,
     THREAD_CLOSE,
     THREAD_GET_STATE,
+    THREAD_EVENT_TIMER, /**< Thread timer expiry, never queued */
+    THREAD_EVENT_EXPORT_FLUSH, /**< Write an export buffer to the sink */
+    THREAD_EVENT_EXPORT_SYNC,  /**< Completion after the flushes queued before */
+    THREAD_EVENT_COMPLETION,   /**< Dispatch a completion queue, ptr */
     THREAD_EVENT_MAX
 } T_THREAD_EVENT_TYPE;
 
@@ -75,6 +137,7 @@ typedef enum
 typedef struct
 {
     void (*completion_callback)(U32);
+    void * device; /**< T_MAIN_DEVICE, NULL for the first device */
 }T_GET_STATE_EVENT;
 
 /**
@@ -86,6 +149,17 @@ typedef enum
     THREAD_EVENT_SEND_OPTION_OR,        /**< Send only if there is no event of same type queued already */
 }T_THREAD_EVENT_SEND_OPTION;
 
+/**
+ * \brief Priority lanes of the thread event queue. Lower values are
+ * drained first.
+ */
+typedef enum
+{
+    THREAD_EVENT_PRIORITY_URGENT = 0, /**< Overtakes all queued normal events */
+    THREAD_EVENT_PRIORITY_NORMAL,     /**< Default lane */
+    THREAD_EVENT_PRIORITY_MAX
+} T_THREAD_EVENT_PRIORITY;
+
 /**
  * \brief Thread event
  */
@@ -108,6 +182,8 @@ typedef struct
         T_EVENT_CFG cfg_event;
         /*  State info */
         T_GET_STATE_EVENT state;
+        /* Thread timer expiry */
+        T_TIMER_EVENT timer_event;
     } parameters;
 } T_THREAD_EVENT;
 
@@ -119,6 +195,11 @@ typedef struct
     T_THREAD_EVENT event; /**< event structure */
     BOOL processed;           /**< Indicates that the
                                  event has been processed. */
+    U32 post_time;            /**< OsGetTimestamp() when the event was sent */
+    U32 ttl;                  /**< Ticks after post_time the event goes
+                                 stale, 0 for never */
+    BOOL or_posted;           /**< Posted with THREAD_EVENT_SEND_OPTION_OR,
+                                 holds thread_event_already_queued */
 } T_THREAD_EVENT_ENTRY;
 
 /**
@@ -126,6 +207,157 @@ typedef struct
  */
 typedef BOOL (*T_THREAD_CB)(T_THREAD_EVENT *event);
 
+/**
+ * \brief Selects queued events for Thread_cancel_events. Runs with the
+ * event queue locked, must not block or post events.
+ */
+typedef BOOL (*T_THREAD_EVENT_PREDICATE)(const T_THREAD_EVENT *event,
+                                         void *p_data);
+
+struct thread_s;
+
+/**
+ * \brief Sees every event accepted by Thread_send_event_*, in the context
+ * of the sender once the event is queued. data is the sender's copy.
+ * Posts from an interrupt handler call it in ISR context too.
+ */
+typedef void (*T_THREAD_POST_CB)(struct thread_s *thread,
+                                 T_THREAD_EVENT_TYPE event,
+                                 const void *data, U32 size,
+                                 T_THREAD_EVENT_PRIORITY prio, U32 ttl);
+
+/**
+ * \brief Result of one step of an async handler
+ */
+typedef enum
+{
+    THREAD_ASYNC_DONE = 0, /**< Ran to its end */
+    THREAD_ASYNC_WAITING   /**< Suspended at an await */
+} T_THREAD_ASYNC_STATE;
+
+struct thread_async_s;
+
+/** \brief Body of an async handler, THREAD_ASYNC_BEGIN to THREAD_ASYNC_END */
+typedef T_THREAD_ASYNC_STATE (*T_THREAD_ASYNC_FUNC)(struct thread_async_s *async);
+
+/**
+ * \brief Stackless async handler (protothread). It runs on its thread
+ * between the events, returns at every await and resumes after it on a
+ * later step. Locals do not survive an await, keep the state in the
+ * structure embedding this one. func, done_cb and p_data are set by the
+ * owner, the memory stays valid until done.
+ */
+typedef struct thread_async_s
+{
+    T_THREAD_ASYNC_FUNC func;
+    void (*done_cb)(struct thread_async_s *async); /**< May be NULL */
+    void *p_data;
+
+    /** Runtime Information */
+    struct thread_s *thread;
+    BOOL running;                 /**< Started, not done */
+    U32 resume;                   /**< Line of the await, 0 at the start */
+    U32 since;                    /**< OsGetTimestamp() the await began */
+    BOOL timed_out;               /**< The last await ended by its timeout */
+    T_THREAD_EVENT_TYPE event;    /**< Awaited, THREAD_EVENT_MAX for none */
+    const T_THREAD_EVENT *P_EVENT; /**< Event which ended the last await,
+                                        valid until the next one */
+    struct thread_async_s *next;  /**< Next handler awaiting an event */
+    T_THREAD_TIMER timer;         /**< Sleep, poll and await timeout */
+} T_THREAD_ASYNC;
+
+/*
+ * Body of a T_THREAD_ASYNC_FUNC. Awaits are case labels of one switch:
+ * one await per line, none inside a switch of the body.
+ */
+#define THREAD_ASYNC_BEGIN(async_) switch ((async_)->resume) { case 0:
+
+/* The first pass of THREAD_ASYNC_AWAIT_UNTIL falls through into its own
+ * resume label */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define THREAD_ASYNC_FALLTHROUGH_ __attribute__((fallthrough))
+#else
+#define THREAD_ASYNC_FALLTHROUGH_
+#endif
+
+#define THREAD_ASYNC_END(async_)                                        \
+    }                                                                   \
+    (async_)->resume = 0;                                               \
+    return THREAD_ASYNC_DONE
+
+/** \brief Give the thread back for ticks */
+#define THREAD_ASYNC_SLEEP(async_, ticks_)                              \
+    do {                                                                \
+        Thread_async_sleep_((async_), (ticks_));                        \
+        (async_)->resume = __LINE__;                                    \
+        return THREAD_ASYNC_WAITING;                                    \
+        case __LINE__:;                                                 \
+    } while (0)
+
+/** \brief Wait for cond_, checked once per tick; timed_out is set if it
+ * did not hold within timeout_ ticks */
+#define THREAD_ASYNC_AWAIT_UNTIL(async_, cond_, timeout_)               \
+    do {                                                                \
+        (async_)->since = OsGetTimestamp();                             \
+        (async_)->timed_out = FALSE;                                    \
+        (async_)->resume = __LINE__;                                    \
+        THREAD_ASYNC_FALLTHROUGH_;                                      \
+        case __LINE__:                                                  \
+        if (!(cond_) && !Thread_async_expired_((async_), (timeout_)))   \
+        {                                                               \
+            Thread_async_sleep_((async_), 1);                           \
+            return THREAD_ASYNC_WAITING;                                \
+        }                                                               \
+    } while (0)
+
+/** \brief Wait until the thread has handled an event of type event_,
+ * THREAD_EVENT_TIMEOUT for the IRQ; P_EVENT is that event, timed_out is
+ * set instead after timeout_ ticks (0 for no timeout) */
+#define THREAD_ASYNC_AWAIT_EVENT(async_, event_, timeout_)              \
+    do {                                                                \
+        Thread_async_wait_event_((async_), (event_), (timeout_));       \
+        (async_)->resume = __LINE__;                                    \
+        return THREAD_ASYNC_WAITING;                                    \
+        case __LINE__:;                                                 \
+    } while (0)
+
+/** \brief Any callback run by the thread, for accounting only */
+typedef void (*T_THREAD_FUNC)(void);
+
+/**
+ * \brief Reports a callback which used more than the budget of the event
+ * type being handled (hung FALSE, cycles of the call), or which the
+ * watchdog found running for longer than its limit (hung TRUE, cycles so
+ * far, called from the watchdog context)
+ */
+typedef void (*T_THREAD_OVERRUN_CB)(T_THREAD_FUNC func,
+                                    T_THREAD_EVENT_TYPE event,
+                                    U32 cycles, BOOL hung);
+
+/**
+ * \brief CPU time of one callback, in OsGetCycles() units. Self time:
+ * watched callbacks it calls are charged to their own account.
+ */
+typedef struct
+{
+    T_THREAD_FUNC func;
+    U32 calls;
+    U32 cycles_total; /**< Wraps */
+    U32 cycles_max;
+    U32 overruns;     /**< Calls over the budget */
+} T_THREAD_ACCOUNT;
+
+/**
+ * \brief A watched callback in progress
+ */
+typedef struct
+{
+    T_THREAD_FUNC func;
+    U32 start;  /**< OsGetCycles() at entry */
+    U32 nested; /**< Cycles of watched callbacks called from this one */
+    BOOL hung;  /**< Reported by the watchdog already */
+} T_THREAD_WATCH;
+
 typedef T_THREAD_CB *T_THREAD_CB_LIST;
 
 typedef enum
@@ -135,12 +367,64 @@ typedef enum
     THREAD_STATE_SUSPEND   /**< Thread is suspended */
 } T_THREAD_STATE;
 
+/**
+ * \brief How the thread waits for new events once its queue is drained
+ */
+typedef enum
+{
+    THREAD_WAIT_MODE_BLOCK = 0, /**< Always block on the thread event */
+    THREAD_WAIT_MODE_ADAPTIVE   /**< Poll the queue for a self adjusting
+                                     window before blocking */
+} T_THREAD_WAIT_MODE;
+
 typedef U16 T_THREAD_EVENT_INDEX;
 
 /**
- * \brief Application Service Thread
+ * \brief One priority lane of the thread event queue
+ */
+typedef struct
+{
+    /* circular thread event queue */
+    T_THREAD_EVENT_INDEX thread_event_wr; /**< Writer location */
+    T_THREAD_EVENT_INDEX thread_event_rd; /**< Reader location */
+    T_THREAD_EVENT_ENTRY
+    thread_event[MAX_THREAD_EVENT_ENTRIES]; /**< thread event queue */
+
+    struct {
+        U32 events;        /**< Events dequeued from this lane */
+        U32 cancelled;     /**< Events cancelled while queued */
+        U32 expired;       /**< Events dequeued after their TTL */
+        U32 unhandled;     /**< Events no handler took */
+        U32 overruns;      /**< Posts rejected on a full lane */
+        U32 latency_max;   /**< Worst post to dequeue latency */
+        U32 latency_total; /**< Sum of post to dequeue latencies */
+    } stat;
+} T_THREAD_EVENT_LANE;
+
+/**
+ * \brief Hierarchical timing wheel. Level n slot s holds the timers filed
+ * while their expiry was less than 2^(BITS * (n + 1)) ticks ahead; a level
+ * n > 0 slot is refiled one level down when the levels below wrap.
  */
 typedef struct
+{
+    T_THREAD_TIMER *slot[THREAD_TIMER_LEVELS][THREAD_TIMER_SLOTS];
+    T_THREAD_TIMER *expired; /**< Batch of the tick being delivered */
+    U32 now;                 /**< Last tick processed */
+    U32 count;               /**< Armed timers */
+    U32 wake;                /**< Tick the thread waits for at most */
+
+    struct {
+        U32 expired;   /**< Expiries delivered */
+        U32 cascaded;  /**< Timers refiled to a lower level */
+        U32 late_max;  /**< Worst lateness of a delivery */
+    } stat;
+} T_THREAD_TIMER_WHEEL;
+
+/**
+ * \brief Application Service Thread
+ */
+typedef struct thread_s
 {
     /** Static information */
 
@@ -148,27 +432,86 @@ typedef struct
      * (NULL if not available) before the thread enters it's main loop */
     void (*thread_start)(void);
 
+    /** \brief thread_idle is executed in the thread context (if not NULL)
+     * before it blocks on an empty queue, with the time since the last
+     * event. Returns the time after which it wants to be called again
+     * if no event arrives, OS_INFINITE for never. */
+    U32 (*thread_idle)(U32 idle_time);
+
     /** \brief Event handler, NULL terminated array */
     T_THREAD_CB_LIST event_handlers;
 
+    /** \brief Runs instead of the event handlers for an event dequeued
+     * after its TTL (if not NULL), so completion callbacks can still be
+     * called with a timeout result. Stale events are dropped otherwise. */
+    T_THREAD_CB event_expired;
+
     const char *thread_name;
     const char *thread_event_name;
 
+    T_THREAD_WAIT_MODE wait_mode; /**< Wait strategy between event bursts */
+
     /** Runtime Information */
 
     T_THREAD_STATE state;    /**< Thread execution state */
+    U32 last_active;          /**< Time the last event was processed */
     OsEvent event_id;         /**< Event ID used for task     */
     OsThread event_thread_id; /**< Thread id for event task   */
+#if defined(DRV_STATIC_ALLOC)
+    OsEventMem event_mem;     /**< Storage of event_id */
+    OsThreadMem thread_mem;   /**< TCB and stack of event_thread_id */
+#endif
     /**< Flag used for checking T_THREAD_EVENT_TYPE already queued or not */
     BOOL thread_event_already_queued[THREAD_EVENT_MAX];
 
     spinlock_t event_lock; /**< Spinlock for event queue */
 
-    /* circular thread event queue */
-    T_THREAD_EVENT_INDEX thread_event_wr; /**< Writer location */
-    T_THREAD_EVENT_INDEX thread_event_rd; /**< Reader location */
-    T_THREAD_EVENT_ENTRY
-    thread_event[MAX_THREAD_EVENT_ENTRIES]; /**< thread event queue */
+    /** event queue, one lane per T_THREAD_EVENT_PRIORITY */
+    T_THREAD_EVENT_LANE lane[THREAD_EVENT_PRIORITY_MAX];
+    volatile U32 lanes_pending; /**< THREAD_EVENT_LANE_BIT of the lanes with
+                                     queued events, set by the posts */
+
+    void *schedulers; /**< T_SCHEDULER list served by this thread */
+
+    T_THREAD_TIMER_WHEEL timers; /**< Timer service, expiries run on this thread */
+    T_THREAD_ASYNC *async_waiting; /**< Async handlers awaiting an event */
+
+    U32 ttl[THREAD_EVENT_MAX]; /**< TTL of events posted without one, 0 none */
+    T_THREAD_POST_CB post_cb;  /**< Recorder of the posted events, may be NULL */
+
+    /* CPU accounting and budget watchdog */
+    U32 budget[THREAD_EVENT_MAX];    /**< Cycles a callback may use while
+                                          handling the event type, 0 for
+                                          no limit */
+    U32 watchdog_limit;              /**< Cycles after which a running
+                                          callback counts as hung, 0 off */
+    T_THREAD_OVERRUN_CB overrun_cb;  /**< Overrun report, may be NULL */
+    T_THREAD_EVENT_TYPE current_event; /**< Event being handled */
+    volatile U32 watch_depth;
+    T_THREAD_WATCH watch[THREAD_WATCH_DEPTH];
+    T_THREAD_ACCOUNT account[THREAD_ACCOUNT_ENTRIES];
+
+    /* priority inheritance from blocked Scheduler_run callers */
+    U32 base_priority;    /**< Priority the thread was created with */
+    U32 active_priority;  /**< Priority the thread currently runs at */
+    U16 waiters[OS_THREAD_PRIORITY_MAX]; /**< Blocked callers per priority */
+
+    /* adaptive wait */
+    volatile BOOL consumer_spinning; /**< TRUE while the thread polls the queue */
+    U32 spin_polls;                  /**< Current spin window in queue polls */
+    U32 spin_start;                  /**< OsGetCycles() at the last spin start */
+    U32 spin_cost;                   /**< Cycles per poll of the last miss */
+    U32 spin_cycles;                 /**< Spent spinning since the last block */
+
+    struct {
+        U32 spin_hits;               /**< Events picked up while spinning */
+        U32 spin_misses;             /**< Spin windows that ended in a block */
+        U32 spin_yields;             /**< Blocks forced by THREAD_SPIN_BUDGET */
+        volatile U32 wakeups_skipped; /**< OsEventSet calls saved by producers */
+        U32 overruns;     /**< Callbacks over their budget */
+        U32 hangs;        /**< Callbacks flagged by the watchdog */
+        U32 account_full; /**< Calls of callbacks without an account */
+    } stat;
 } T_THREAD;
 
 /*******************************************************************
@@ -180,6 +523,40 @@ T_RESULT Thread_close(T_THREAD *thread);
 T_RESULT Thread_send_event_ex(T_THREAD *thread,
                               T_THREAD_EVENT_TYPE event, void *data,
                               U32 size, T_THREAD_EVENT_SEND_OPTION option);
+U32 Thread_queue_depth(const T_THREAD *thread);
+void Thread_priority_inherit(T_THREAD *thread, U32 priority);
+void Thread_priority_release(T_THREAD *thread, U32 priority);
+T_RESULT Thread_send_event_prio(T_THREAD *thread,
+                                T_THREAD_EVENT_TYPE event, void *data,
+                                U32 size, T_THREAD_EVENT_SEND_OPTION option,
+                                T_THREAD_EVENT_PRIORITY prio);
+T_RESULT Thread_send_event_ttl(T_THREAD *thread,
+                               T_THREAD_EVENT_TYPE event, void *data,
+                               U32 size, T_THREAD_EVENT_SEND_OPTION option,
+                               T_THREAD_EVENT_PRIORITY prio, U32 ttl);
+T_RESULT Thread_set_ttl(T_THREAD *thread, T_THREAD_EVENT_TYPE event, U32 ttl);
+T_RESULT Thread_set_post_cb(T_THREAD *thread, T_THREAD_POST_CB post_cb);
+U32 Thread_cancel_events(T_THREAD *thread,
+                         T_THREAD_EVENT_PREDICATE predicate, void *p_data);
+T_RESULT Thread_timer_start(T_THREAD *thread, T_THREAD_TIMER *timer,
+                            U32 delay, U32 period);
+T_RESULT Thread_timer_stop(T_THREAD *thread, T_THREAD_TIMER *timer);
+void Thread_watch_begin(T_THREAD *thread, T_THREAD_FUNC func);
+void Thread_watch_end(T_THREAD *thread);
+T_RESULT Thread_set_budget(T_THREAD *thread, T_THREAD_EVENT_TYPE event,
+                           U32 cycles);
+T_RESULT Thread_set_watchdog(T_THREAD *thread, U32 limit,
+                             T_THREAD_OVERRUN_CB overrun_cb);
+BOOL Thread_watchdog_check(T_THREAD *thread);
+T_RESULT Thread_get_account(T_THREAD *thread, T_THREAD_FUNC func,
+                            T_THREAD_ACCOUNT *account);
+T_RESULT Thread_async_start(T_THREAD *thread, T_THREAD_ASYNC *async);
+T_RESULT Thread_async_cancel(T_THREAD_ASYNC *async);
+/* used by the THREAD_ASYNC_ macros */
+void Thread_async_sleep_(T_THREAD_ASYNC *async, U32 ticks);
+BOOL Thread_async_expired_(T_THREAD_ASYNC *async, U32 timeout);
+void Thread_async_wait_event_(T_THREAD_ASYNC *async,
+                              T_THREAD_EVENT_TYPE event, U32 timeout);
 
 #endif /* THREAD_H */
 /** @} */
@@ -6,13 +6,18 @@
 /* External Dependency */
 /* Adapt all of this API and data strucure as per your RTOS & HW Platform */
 
-/* FreeRTOS Kernel includes. */
-#include "FreeRTOS.h"
-#include "task.h"
-#include "timers.h"
+#if defined(OS_SIM)
+/* Host build: virtual time, deterministic scheduling (OsSim.c) */
+#include "OsSim.h"
+#else
+/* FreeRTOS Kernel includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
 #include "semphr.h"
 #include "event_groups.h"
 #include "semphr.h"
+#endif
 
 #ifndef FALSE
 #define TRUE 1U
@@ -24,6 +29,19 @@
 #define OFF 0U
 
 #define T_INTERRUPT_LINE_TIMEOUT 10
+/* Build options, given with -D (the host Makefile sets both):
+ * DRV_HW_SIM - no register block, run against the simulated HW device
+ *   model (HwSim.c). Without it set HW_REG_BASE for the real HW.
+ * DRV_STATIC_ALLOC - zero heap mode: the driver reserves its kernel
+ *   objects in T_THREAD and T_SCHEDULER and creates them with the
+ *   *CreateStatic API. Needs configSUPPORT_STATIC_ALLOCATION 1 on FreeRTOS. */
+#if !defined(HW_REG_BASE)
+#if defined(DRV_HW_SIM)
+#define HW_REG_BASE 0 /* device 0 of the model */
+#else
+#error "define HW_REG_BASE or DRV_HW_SIM"
+#endif
+#endif
 #define FAST_MEM_DATA_SECTION
 #define OS_SUCCESS 1
 #define OS_FALSE 0
@@ -33,34 +51,139 @@
 
 #define OsEventCreate(a,b,c) *a = xEventGroupCreate(),OS_SUCCESS //OS_SUCCESS
 #define OsEventWait(a,b,c) 		xEventGroupWaitBits( *a,	/* The event group that contains the event bits being queried. */ \
-								0x1,		/* The bit to wait for. */ \
+								b,		/* The bits to wait for. */ \
 								pdTRUE,		/* Clear the bit on exit. */ \
-								pdFALSE,		/* Wait for all the bits (only one in this case anyway). */ \
+								pdFALSE,		/* Wait for any of the bits. */ \
 								c) /* Block indefinitely to wait for the condition to be met. */ //OS_SUCCESS
 
-#define OsEventSet(a) OS_SUCCESS;xEventGroupSetBits(*a,0x1)
+#define OsEventSet(a,b) OS_SUCCESS;xEventGroupSetBits(*a,b)
 
+#if defined(DRV_HW_SIM)
+/* Interrupt lines of the simulated HW device model */
+#define OsIrqCreate(a,b,c,d,e) HwSim_irqCreate(a,c,d,e)
+#define OsIrqUnmask(a) HwSim_irqMask(a,FALSE)
+#define OsIrqMask(a) HwSim_irqMask(a,TRUE)
+#else
 #define OsIrqCreate(...) OS_SUCCESS
 #define OsIrqUnmask(...) OS_SUCCESS
 #define OsIrqMask(...) OS_SUCCESS
+#endif
 
 #define main_TASK_PRIORITY ( tskIDLE_PRIORITY + 2 )
 #define OsThreadCreate(a,b,c,d) xTaskCreate(c,b,configMINIMAL_STACK_SIZE,d,main_TASK_PRIORITY,a) //OS_SUCCESS
 #define OsThreadStart(...) OS_SUCCESS //vTaskStartScheduler(),OS_SUCCESS //OS_SUCCESS
 #define OsThreadGetCurrent(a) OS_SUCCESS;*a = xTaskGetCurrentTaskHandle()//OS_SUCCESS
+#define OS_THREAD_PRIORITY_MAX configMAX_PRIORITIES
+#define OsThreadGetPriority(a) ((U32)uxTaskPriorityGet(*a))
+#define OsThreadSetPriority(a,b) vTaskPrioritySet(*a,b)
 
+#if defined(DRV_STATIC_ALLOC)
+#if !defined(OS_SIM) && (!defined(configSUPPORT_STATIC_ALLOCATION) || configSUPPORT_STATIC_ALLOCATION != 1)
+#error "DRV_STATIC_ALLOC needs configSUPPORT_STATIC_ALLOCATION 1"
+#endif
+#define OS_THREAD_STACK_DEPTH configMINIMAL_STACK_SIZE
+/* Storage of a kernel object, reserved by its owner */
+#define OsEventMem StaticEventGroup_t
+typedef struct {
+    StaticTask_t tcb;
+    StackType_t stack[OS_THREAD_STACK_DEPTH];
+} OsThreadMem;
+#define OsTimerMem StaticTimer_t
+#define OsEventCreateStatic(a,b,c,m) *a = xEventGroupCreateStatic(m),OS_SUCCESS
+#define OsThreadCreateStatic(a,b,c,d,m) \
+    ((*a = xTaskCreateStatic(c,b,OS_THREAD_STACK_DEPTH,d,main_TASK_PRIORITY,(m)->stack,&(m)->tcb)) ? OS_SUCCESS : OS_FALSE)
+#define OsTimerCreateStatic(a,b,c,d,m) OS_SUCCESS; *a = xTimerCreateStatic(b,1,pdFALSE,d,c,m)
+
+/* A blocking call completes through the caller's task notification instead
+ * of a semaphore per call. This takes over notification slot 0 of the
+ * calling task: a task blocking in Scheduler_run must not use
+ * xTaskNotify/ulTaskNotifyTake on it for anything else. A timed out call
+ * is cancelled or waited for, Create still drops a stray notification. */
+#define OsSemCreate(a,b,c,d) OS_SUCCESS; *a = xTaskGetCurrentTaskHandle(); ulTaskNotifyTake(pdTRUE,0)
+#define OsSemRelease(a) xTaskNotifyGive(*a);
+#define OsSemObtain(a,b,c) (ulTaskNotifyTake(pdTRUE,1000) ? OS_SUCCESS : OS_FALSE)
+#define OsSemDelete(a)
+#else
 #define OsSemCreate(a,b,c,d) OS_SUCCESS; *a = xSemaphoreCreateBinary() //OS_SUCCESS
 #define OsSemRelease(a) xSemaphoreGive(*a);
-#define OsSemObtain(a,b,c) xSemaphoreTake(*a,1000)
+#define OsSemObtain(a,b,c) (xSemaphoreTake(*a,1000) == pdTRUE ? OS_SUCCESS : OS_FALSE)
 #define OsSemDelete(a) vSemaphoreDelete(*a)
+#endif
+
+/* One shot timer, the callback receives the OsTimer and reads its argument
+ * back with OsTimerGetArg */
+#define OsTimerCreate(a,b,c,d) OS_SUCCESS; *a = xTimerCreate(b,1,pdFALSE,d,c)
+#define OsTimerStart(a,b) xTimerChangePeriod(*a,b,0)
+#define OsTimerGetArg(a) pvTimerGetTimerID(a)
 
 /* For Multi Core */
-#define os_atomic_add_U32(a,b) *a+=b
-#define os_atomic_sub_U32(a,b) *a-=b
-#define os_data_sync_barrier(...)
-#define os_spinlock_obtain(...)
-#define os_spinlock_release(...)
+/* Single core port: a critical section keeps tasks of the same priority
+ * from interleaving in the event and call queues */
+#define os_atomic_add_U32(a,b) do { taskENTER_CRITICAL(); *a+=b; taskEXIT_CRITICAL(); } while (0)
+#define os_atomic_sub_U32(a,b) do { taskENTER_CRITICAL(); *a-=b; taskEXIT_CRITICAL(); } while (0)
+/* Orders the index and flag updates against the data they publish, keeps
+ * the compiler from caching or moving memory accesses across it too */
+#if defined(_MSC_VER)
+#define os_data_sync_barrier(...) MemoryBarrier()
+#elif defined(__GNUC__)
+#define os_data_sync_barrier(...) __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(portMEMORY_BARRIER)
+#define os_data_sync_barrier(...) portMEMORY_BARRIER()
+#else
+#error "no memory barrier for this compiler, define os_data_sync_barrier"
+#endif
+#define os_spinlock_obtain(a) taskENTER_CRITICAL()
+#define os_spinlock_release(a) taskEXIT_CRITICAL()
+/* Same locks taken from an interrupt handler, the saved mask goes back to
+ * the release */
+#define os_spinlock_obtain_isr(a) ((U32)taskENTER_CRITICAL_FROM_ISR())
+#define os_spinlock_release_isr(a,m) taskEXIT_CRITICAL_FROM_ISR(m)
+/* Interrupt context check. xPortIsInsideInterrupt is provided by the
+ * Cortex-M ports and OsSim, on other ports the driver counts its own
+ * handlers between OsIsrEnter and OsIsrExit (Isr.c) */
+#if defined(OS_SIM) || defined(__ARM_ARCH_6M__) || defined(__ARM_ARCH_7M__) || \
+    defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_BASE__) || \
+    defined(__ARM_ARCH_8M_MAIN__) || defined(__ARM_ARCH_8_1M_MAIN__)
+#define OsIsInIsr() (pdFALSE != xPortIsInsideInterrupt())
+#define OsIsrEnter()
+#define OsIsrExit()
+#else
+#define OS_ISR_NESTING_COUNT
+extern volatile uint32_t os_isr_nesting;
+#define OsIsInIsr() (0 != os_isr_nesting)
+#define OsIsrEnter() (os_isr_nesting++)
+#define OsIsrExit() (os_isr_nesting--)
+#endif
+#define OsEventSetFromIsr(a,b) do { BaseType_t woken_ = pdFALSE; \
+    xEventGroupSetBitsFromISR(*a,b,&woken_); portYIELD_FROM_ISR(woken_); } while (0)
 #define os_spinlock_init(...)
+/* Pause between polls of a spinning consumer. A CPU hint that keeps the
+ * core: the consumer sees posts from interrupts, other cores and tasks
+ * preempting it, giving way to equal priority producers is taskYIELD */
+#if defined(OS_SIM)
+#define OsCpuRelax() OsSim_relax()
+#elif defined(_MSC_VER)
+#define OsCpuRelax() YieldProcessor()
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define OsCpuRelax() _mm_pause()
+#elif defined(__arm__) || defined(__aarch64__)
+#define OsCpuRelax() __asm__ volatile("yield" ::: "memory")
+#else
+#define OsCpuRelax() portNOP()
+#endif
+/* Monotonic timestamp used for latency statistics */
+#define OsGetTimestamp() ((U32)xTaskGetTickCount())
+/* High resolution time for CPU accounting, OS_CYCLES_PER_TICK per tick */
+#if defined(OS_SIM)
+#define OsGetCycles() OsSim_cycles()
+#define OS_CYCLES_PER_TICK OS_SIM_CYCLES_PER_TICK
+#else
+/* run time stats counter (configGENERATE_RUN_TIME_STATS), adapt the rate
+ * to the counter clock of your port */
+#define OsGetCycles() ((U32)portGET_RUN_TIME_COUNTER_VALUE())
+#define OS_CYCLES_PER_TICK (configCPU_CLOCK_HZ / configTICK_RATE_HZ)
+#endif
 
 #define memcpy_s(a,b,c,d) memcpy(a,c,d)
 
@@ -74,9 +197,17 @@ typedef int32_t S32;
 
 #define OsEvent EventGroupHandle_t 
 
+#define OsEventBits EventBits_t
+
 #define OsThread TaskHandle_t
 
+#if defined(DRV_STATIC_ALLOC)
+#define  OsSem TaskHandle_t
+#else
 #define  OsSem SemaphoreHandle_t
+#endif
+
+#define OsTimer TimerHandle_t
 
 typedef struct {
     U32 data;
@@ -88,6 +219,11 @@ typedef struct {
 
 typedef struct {
     BOOL mode;
+    U32 clock;
 }t_base_cfg;
 
-extern void Test_simulate_SW_TIMER_interrupt_generation(void);
\ No newline at end of file
+extern void Test_simulate_SW_TIMER_interrupt_generation(void);
+#if defined(DRV_HW_SIM)
+extern U32 HwSim_irqCreate(OsIrqIsr *irq, U32 line, void (*isr)(U32 vector_number, void *p_param), void *p_param);
+extern U32 HwSim_irqMask(OsIrqIsr *irq, BOOL mask);
+#endif
\ No newline at end of file
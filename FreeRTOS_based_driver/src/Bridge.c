@@ -0,0 +1,494 @@
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include "Bridge.h"
+
+#if defined(OS_SIM)
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+#define BRIDGE_RING_MASK (BRIDGE_RING_ENTRIES - 1U)
+
+/** \brief Longest wait of Bridge_close for calls still in the driver */
+#define BRIDGE_CLOSE_TIMEOUT pdMS_TO_TICKS( 1000UL )
+
+/*
+ * The other side of a ring is another process: positions are published
+ * after the entries and read before them
+ */
+#define BRIDGE_LOAD(p_) __atomic_load_n(p_, __ATOMIC_ACQUIRE)
+#define BRIDGE_STORE(p_, v_) __atomic_store_n(p_, v_, __ATOMIC_RELEASE)
+
+/*****************************************************************************/
+/* TYPE DEFINES                                                              */
+/*****************************************************************************/
+/**
+ * \brief Request handed to the driver thread, waiting for its completion
+ */
+typedef struct
+{
+    BOOL busy;
+    U32 client;
+    U32 seq;
+    U32 type;
+    t_base_cfg cfg; /**< Valid until the completion */
+} T_BRIDGE_CALL;
+
+/*****************************************************************************/
+/* LOCAL DATA                                                                */
+/*****************************************************************************/
+static struct
+{
+    T_BRIDGE_SHM *p_shm;
+    char name[NAME_MAX];
+    volatile BOOL running;      /**< Cleared by Bridge_close */
+    volatile BOOL task_running; /**< Bridge task not yet deleted */
+    volatile U32 inflight;      /**< Calls waiting for the driver thread */
+    T_BRIDGE_CALL call[BRIDGE_RING_ENTRIES];
+
+    /* Main_getState completions carry no data, the lane keeps them in order */
+    U32 state_rd;
+    U32 state_wr;
+    U32 state_call[BRIDGE_RING_ENTRIES];
+
+    T_BRIDGE_STAT stat;
+} bridge;
+
+/*****************************************************************************/
+/* LOCAL FUNCTIONS                                                           */
+/*****************************************************************************/
+static long Bridge_futex(volatile U32 * p_word, int op, U32 value,
+                         const struct timespec * P_TIMEOUT)
+{
+    return syscall(SYS_futex, p_word, op, value, P_TIMEOUT, NULL, 0);
+}
+
+/* Append a response to the ring of the client, any driver process task */
+static void Bridge_respond(U32 client, U32 seq, U32 type, T_RESULT result,
+                           U32 value, const T_MAIN_STATE_SNAPSHOT * P_STATE)
+{
+    T_BRIDGE_RSP_RING *p_ring = &bridge.p_shm->rsp[client];
+    T_BRIDGE_RESPONSE *p_rsp;
+    BOOL wake = FALSE;
+    U32 head;
+
+    taskENTER_CRITICAL();
+    head = p_ring->head;
+    if (head - BRIDGE_LOAD(&p_ring->tail) >= BRIDGE_RING_ENTRIES)
+    {
+        bridge.stat.rsp_dropped++;
+    }
+    else
+    {
+        p_rsp = &p_ring->entry[head & BRIDGE_RING_MASK];
+        p_rsp->seq = seq;
+        p_rsp->type = type;
+        p_rsp->result = result;
+        p_rsp->value = value;
+        if (P_STATE)
+            p_rsp->state = *P_STATE;
+        else
+            memset(&p_rsp->state, 0, sizeof(p_rsp->state));
+        BRIDGE_STORE(&p_ring->head, head + 1);
+        bridge.stat.responses++;
+
+        /* pairs with the fence of Bridge_clientWait */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        wake = 0 != BRIDGE_LOAD(&p_ring->waiting);
+        if (wake)
+            bridge.stat.wakeups++;
+    }
+    taskEXIT_CRITICAL();
+
+    if (wake)
+        Bridge_futex(&p_ring->head, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+/* Completion of a call, driver thread */
+static void Bridge_callDone(T_BRIDGE_CALL * p_call, T_RESULT result, U32 value)
+{
+    Bridge_respond(p_call->client, p_call->seq, p_call->type, result, value,
+                   NULL);
+
+    taskENTER_CRITICAL();
+    p_call->busy = FALSE;
+    bridge.inflight--;
+    taskEXIT_CRITICAL();
+}
+
+static void Bridge_onMode(void * p_data)
+{
+    T_BRIDGE_CALL *p_call = (T_BRIDGE_CALL *)p_data;
+
+    Bridge_callDone(p_call, RESULT_OK, p_call->cfg.mode);
+}
+
+static void Bridge_onState(U32 state)
+{
+    T_BRIDGE_CALL *p_call;
+
+    taskENTER_CRITICAL();
+    p_call = &bridge.call[bridge.state_call[bridge.state_rd++ & BRIDGE_RING_MASK]];
+    taskEXIT_CRITICAL();
+
+    Bridge_callDone(p_call, MAIN_STATE_EXPIRED == state ? RESULT_TIMEOUT : RESULT_OK,
+                    state);
+}
+
+/* Take one request off the ring, FALSE if there is none or no free call */
+static BOOL Bridge_serve(void)
+{
+    T_BRIDGE_SHM *p_shm = bridge.p_shm;
+    U32 tail = p_shm->req_tail;
+    T_BRIDGE_REQUEST *p_req = &p_shm->req[tail & BRIDGE_RING_MASK];
+    T_BRIDGE_REQUEST req;
+    T_BRIDGE_CALL *p_call;
+    T_MAIN_STATE_SNAPSHOT state;
+    U32 i;
+
+    if (BRIDGE_LOAD(&p_req->ready) != tail + 1 ||
+        bridge.inflight >= BRIDGE_RING_ENTRIES)
+        return FALSE;
+
+    /* copy out and give the entry back to the clients */
+    req.client = p_req->client;
+    req.seq = p_req->seq;
+    req.type = p_req->type;
+    req.arg = p_req->arg;
+    BRIDGE_STORE(&p_shm->req_tail, tail + 1);
+    bridge.stat.requests++;
+
+    if (req.client >= BRIDGE_CLIENTS_MAX || req.type >= BRIDGE_REQ_MAX)
+    {
+        bridge.stat.bad_requests++;
+        if (req.client < BRIDGE_CLIENTS_MAX)
+            Bridge_respond(req.client, req.seq, req.type, RESULT_NOT_SUPPORTED,
+                           0, NULL);
+        return TRUE;
+    }
+
+    if (BRIDGE_REQ_READ_STATE == req.type)
+    {
+        Main_readState(&state);
+        Bridge_respond(req.client, req.seq, req.type, RESULT_OK, state.mode,
+                       &state);
+        return TRUE;
+    }
+
+    /* inflight is below the pool size, one is free */
+    for (i = 0; bridge.call[i].busy; i++)
+        ;
+    p_call = &bridge.call[i];
+    p_call->client = req.client;
+    p_call->seq = req.seq;
+    p_call->type = req.type;
+    memset(&p_call->cfg, 0, sizeof(p_call->cfg));
+    p_call->cfg.mode = req.arg ? ON : OFF;
+
+    taskENTER_CRITICAL();
+    p_call->busy = TRUE;
+    bridge.inflight++;
+    if (BRIDGE_REQ_GET_STATE == req.type)
+        bridge.state_call[bridge.state_wr++ & BRIDGE_RING_MASK] = i;
+    taskEXIT_CRITICAL();
+
+    switch (req.type)
+    {
+        case BRIDGE_REQ_SET_MODE:
+            Main_reqSetMode(&p_call->cfg, Bridge_onMode, p_call);
+            break;
+        case BRIDGE_REQ_SET_MODE_URGENT:
+            Main_reqSetModeUrgent(&p_call->cfg, Bridge_onMode, p_call);
+            break;
+        default:
+            Main_getState(Bridge_onState);
+            break;
+    }
+    return TRUE;
+}
+
+static void Bridge_task(void * p_param)
+{
+    (void)p_param;
+
+    while (bridge.running)
+    {
+        if (!Bridge_serve())
+            vTaskDelay(BRIDGE_POLL_PERIOD);
+    }
+
+    bridge.task_running = FALSE;
+    vTaskDelete(NULL);
+}
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+/**
+ * \brief Create the shared memory object P_NAME (shm_open naming, e.g.
+ * "/drv") and start the bridge task. One bridge per driver process.
+ */
+T_RESULT Bridge_open(const char * P_NAME)
+{
+    T_BRIDGE_SHM *p_shm;
+    int fd;
+
+    if (!P_NAME || strlen(P_NAME) >= sizeof(bridge.name))
+        return RESULT_PARAMETER_ERROR;
+
+    if (bridge.p_shm || bridge.task_running)
+        return RESULT_WRONG_STATE;
+
+    fd = shm_open(P_NAME, O_CREAT | O_TRUNC | O_RDWR, 0600);
+    if (fd < 0)
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    if (ftruncate(fd, sizeof(T_BRIDGE_SHM)))
+    {
+        close(fd);
+        shm_unlink(P_NAME);
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    }
+    p_shm = (T_BRIDGE_SHM *)mmap(NULL, sizeof(T_BRIDGE_SHM),
+                                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p_shm)
+    {
+        shm_unlink(P_NAME);
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    }
+
+    memset(&bridge, 0, sizeof(bridge));
+    strcpy(bridge.name, P_NAME);
+    memset(p_shm, 0, sizeof(*p_shm));
+    p_shm->version = BRIDGE_VERSION;
+    /* clients check the magic last */
+    BRIDGE_STORE(&p_shm->magic, BRIDGE_MAGIC);
+    bridge.p_shm = p_shm;
+
+    bridge.running = TRUE;
+    bridge.task_running = TRUE;
+    if (pdPASS != xTaskCreate(Bridge_task, "Bridge", configMINIMAL_STACK_SIZE,
+                              NULL, BRIDGE_TASK_PRIORITY, NULL))
+    {
+        bridge.running = FALSE;
+        bridge.task_running = FALSE;
+        bridge.p_shm = NULL;
+        munmap(p_shm, sizeof(*p_shm));
+        shm_unlink(P_NAME);
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    }
+    return RESULT_OK;
+}
+
+/**
+ * \brief Stop the bridge task and remove the object. Blocks until the
+ * driver thread completed the calls in flight; the mapping is kept if it
+ * does not in time.
+ */
+void Bridge_close(void)
+{
+    U32 start;
+
+    if (!bridge.p_shm)
+        return;
+
+    bridge.running = FALSE;
+    start = OsGetTimestamp();
+    while ((bridge.task_running || bridge.inflight) &&
+           OsGetTimestamp() - start < BRIDGE_CLOSE_TIMEOUT)
+        vTaskDelay(1);
+
+    shm_unlink(bridge.name);
+    if (!bridge.task_running && !bridge.inflight)
+    {
+        munmap(bridge.p_shm, sizeof(T_BRIDGE_SHM));
+        bridge.p_shm = NULL;
+    }
+}
+
+void Bridge_getStat(T_BRIDGE_STAT * P_STAT)
+{
+    taskENTER_CRITICAL();
+    *P_STAT = bridge.stat;
+    taskEXIT_CRITICAL();
+}
+
+/**
+ * \brief Map the object of a running bridge and take a free client index
+ *
+ * @return NULL if there is no bridge or every client index is taken
+ */
+T_BRIDGE_SHM *Bridge_clientAttach(const char * P_NAME, U32 * p_client)
+{
+    T_BRIDGE_SHM *p_shm;
+    T_BRIDGE_RSP_RING *p_ring;
+    struct stat info;
+    U32 clients, client;
+    int fd;
+
+    if (!P_NAME || !p_client)
+        return NULL;
+
+    fd = shm_open(P_NAME, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &info) || info.st_size < (off_t)sizeof(T_BRIDGE_SHM))
+    {
+        close(fd);
+        return NULL;
+    }
+    p_shm = (T_BRIDGE_SHM *)mmap(NULL, sizeof(T_BRIDGE_SHM),
+                                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p_shm)
+        return NULL;
+
+    if (BRIDGE_MAGIC != BRIDGE_LOAD(&p_shm->magic) ||
+        BRIDGE_VERSION != p_shm->version)
+        goto fail;
+
+    clients = BRIDGE_LOAD(&p_shm->clients);
+    do
+    {
+        for (client = 0; client < BRIDGE_CLIENTS_MAX; client++)
+        {
+            if (!(clients & (1U << client)))
+                break;
+        }
+        if (BRIDGE_CLIENTS_MAX == client)
+            goto fail;
+    } while (!__atomic_compare_exchange_n(&p_shm->clients, &clients,
+                                          clients | (1U << client), FALSE,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    /* skip what the previous client of this index left unread */
+    p_ring = &p_shm->rsp[client];
+    p_ring->waiting = 0;
+    BRIDGE_STORE(&p_ring->tail, BRIDGE_LOAD(&p_ring->head));
+
+    *p_client = client;
+    return p_shm;
+
+fail:
+    munmap(p_shm, sizeof(T_BRIDGE_SHM));
+    return NULL;
+}
+
+void Bridge_clientDetach(T_BRIDGE_SHM * p_shm, U32 client)
+{
+    if (!p_shm || client >= BRIDGE_CLIENTS_MAX)
+        return;
+
+    __atomic_fetch_and(&p_shm->clients, ~(1U << client), __ATOMIC_ACQ_REL);
+    munmap(p_shm, sizeof(T_BRIDGE_SHM));
+}
+
+/**
+ * \brief Post a request, lock free, from any number of clients
+ *
+ * @return RESULT_NO_RESOURCES_AVAILABLE if the request ring is full
+ */
+T_RESULT Bridge_clientPost(T_BRIDGE_SHM * p_shm, U32 client, U32 seq,
+                           T_BRIDGE_REQ type, U32 arg)
+{
+    T_BRIDGE_REQUEST *p_req;
+    U32 head;
+
+    if (!p_shm || client >= BRIDGE_CLIENTS_MAX)
+        return RESULT_PARAMETER_ERROR;
+
+    /* reserve a position, the entry is ours once head moved past it */
+    head = BRIDGE_LOAD(&p_shm->req_head);
+    do
+    {
+        if (head - BRIDGE_LOAD(&p_shm->req_tail) >= BRIDGE_RING_ENTRIES)
+            return RESULT_NO_RESOURCES_AVAILABLE;
+    } while (!__atomic_compare_exchange_n(&p_shm->req_head, &head, head + 1,
+                                          FALSE, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_ACQUIRE));
+
+    p_req = &p_shm->req[head & BRIDGE_RING_MASK];
+    p_req->client = client;
+    p_req->seq = seq;
+    p_req->type = type;
+    p_req->arg = arg;
+    BRIDGE_STORE(&p_req->ready, head + 1);
+    return RESULT_OK;
+}
+
+/**
+ * \brief Take the oldest response of the client
+ *
+ * @return RESULT_NOT_HANDLED if there is none
+ */
+T_RESULT Bridge_clientPoll(T_BRIDGE_SHM * p_shm, U32 client,
+                           T_BRIDGE_RESPONSE * p_rsp)
+{
+    T_BRIDGE_RSP_RING *p_ring;
+    U32 tail;
+
+    if (!p_shm || client >= BRIDGE_CLIENTS_MAX || !p_rsp)
+        return RESULT_PARAMETER_ERROR;
+    p_ring = &p_shm->rsp[client];
+
+    tail = p_ring->tail;
+    if (BRIDGE_LOAD(&p_ring->head) == tail)
+        return RESULT_NOT_HANDLED;
+
+    *p_rsp = p_ring->entry[tail & BRIDGE_RING_MASK];
+    BRIDGE_STORE(&p_ring->tail, tail + 1);
+    return RESULT_OK;
+}
+
+/**
+ * \brief Take the oldest response, sleeping on the futex of the ring for
+ * up to timeout_us between wake ups. Blocks the calling thread, not for
+ * tasks of the simulated OS.
+ *
+ * @return RESULT_TIMEOUT if no response came
+ */
+T_RESULT Bridge_clientWait(T_BRIDGE_SHM * p_shm, U32 client,
+                           T_BRIDGE_RESPONSE * p_rsp, U32 timeout_us)
+{
+    struct timespec timeout;
+    T_BRIDGE_RSP_RING *p_ring;
+    T_RESULT result;
+    U32 head;
+
+    timeout.tv_sec = timeout_us / 1000000U;
+    timeout.tv_nsec = (long)(timeout_us % 1000000U) * 1000L;
+
+    for (;;)
+    {
+        result = Bridge_clientPoll(p_shm, client, p_rsp);
+        if (RESULT_NOT_HANDLED != result)
+            return result;
+
+        p_ring = &p_shm->rsp[client];
+        head = p_ring->tail;
+        BRIDGE_STORE(&p_ring->waiting, 1);
+        /* pairs with the fence of Bridge_respond */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (BRIDGE_LOAD(&p_ring->head) == head &&
+            Bridge_futex(&p_ring->head, FUTEX_WAIT, head, &timeout) &&
+            ETIMEDOUT == errno)
+        {
+            BRIDGE_STORE(&p_ring->waiting, 0);
+            return RESULT_TIMEOUT;
+        }
+        BRIDGE_STORE(&p_ring->waiting, 0);
+    }
+}
+
+#endif /* OS_SIM */
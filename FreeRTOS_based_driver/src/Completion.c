@@ -0,0 +1,235 @@
+/**
+ * \file Completion.c
+ * \brief Completion queues
+ */
+
+/**
+ * @addtogroup Module Name
+ * @{
+ */
+#include <string.h>
+#include "Completion.h"
+
+/*****************************************************************************/
+/* LOCAL FUNCTIONS                                                           */
+/*****************************************************************************/
+static void completion_run_(const T_COMPLETION *P_COMPLETION)
+{
+    switch (P_COMPLETION->type)
+    {
+        case COMPLETION_CFG:
+            P_COMPLETION->cb.cfg(P_COMPLETION->arg.p_data);
+            break;
+        case COMPLETION_STATE:
+            P_COMPLETION->cb.state(P_COMPLETION->arg.state);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Claim the queue for one consumer, FALSE while another one runs */
+static BOOL completion_claim_(T_COMPLETION_QUEUE *queue)
+{
+    BOOL claimed;
+
+    os_spinlock_obtain(&queue->lock);
+    claimed = !queue->dispatching;
+    queue->dispatching = TRUE;
+    os_spinlock_release(&queue->lock);
+    return claimed;
+}
+
+/* Run up to max queued callbacks (0 for all) in their order on a claimed
+ * queue, accounted to thread if not NULL, then give up the claim */
+static U32 completion_drain_(T_COMPLETION_QUEUE *queue, U32 max,
+                             T_THREAD *thread)
+{
+    T_COMPLETION completion;
+    U32 count = 0;
+
+    while (!max || count < max)
+    {
+        os_spinlock_obtain(&queue->lock);
+        if (queue->rd == queue->wr)
+        {
+            os_spinlock_release(&queue->lock);
+            break;
+        }
+        completion = queue->entry[queue->rd % COMPLETION_QUEUE_ENTRIES];
+        queue->rd++;
+        os_spinlock_release(&queue->lock);
+
+        if (thread)
+            Thread_watch_begin(thread, (T_THREAD_FUNC)completion.cb.cfg);
+        completion_run_(&completion);
+        if (thread)
+            Thread_watch_end(thread);
+        count++;
+    }
+
+    if (count)
+    {
+        queue->stat.dispatched += count;
+        queue->stat.batches++;
+        if (count > queue->stat.batch_max)
+            queue->stat.batch_max = count;
+    }
+    os_spinlock_obtain(&queue->lock);
+    queue->dispatching = FALSE;
+    os_spinlock_release(&queue->lock);
+    return count;
+}
+
+/* Run up to max queued callbacks (0 for all), one consumer at a time */
+static U32 completion_dispatch_(T_COMPLETION_QUEUE *queue, U32 max,
+                                T_THREAD *thread)
+{
+    /* a callback in progress elsewhere is older than the ones left */
+    while (!completion_claim_(queue))
+        vTaskDelay(1);
+
+    return completion_drain_(queue, max, thread);
+}
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+/**
+ *  Set up a queue, queue_name, use_thread and notify are set by the owner
+ *  beforehand. Starts the completion thread of a use_thread queue.
+ */
+T_RESULT Completion_init(T_COMPLETION_QUEUE *queue)
+{
+    T_RESULT result;
+
+    if (!queue || !queue->queue_name)
+        return RESULT_PARAMETER_ERROR;
+
+    if (queue->initialized)
+        return RESULT_WRONG_STATE;
+
+    os_spinlock_init(&queue->lock);
+    queue->dispatching = FALSE;
+    queue->wr = 0;
+    queue->rd = 0;
+    memset(&queue->stat, 0x00, sizeof(queue->stat));
+
+    if (queue->use_thread)
+    {
+        queue->handlers[0] = Completion_event_hdlr;
+        queue->handlers[1] = NULL;
+        queue->thread.thread_name = queue->queue_name;
+        queue->thread.thread_event_name = queue->queue_name;
+        queue->thread.event_handlers = queue->handlers;
+
+        result = Thread_create(&queue->thread);
+        if (FAILED(result))
+            return result;
+    }
+
+    queue->initialized = TRUE;
+    return RESULT_OK;
+}
+
+/**
+ *  Queue a completion, any context. Posts that find the queue empty wake
+ *  the completion thread or notify the owner, the following ones join
+ *  the same batch.
+ *
+ *  @return RESULT_NO_RESOURCES_AVAILABLE if the queue is full
+ */
+T_RESULT Completion_post(T_COMPLETION_QUEUE *queue,
+                         const T_COMPLETION *P_COMPLETION)
+{
+    BOOL was_empty;
+
+    if (!queue || !P_COMPLETION || !P_COMPLETION->cb.cfg)
+        return RESULT_PARAMETER_ERROR;
+
+    if (!queue->initialized)
+        return RESULT_WRONG_STATE;
+
+    os_spinlock_obtain(&queue->lock);
+    if (queue->wr - queue->rd >= COMPLETION_QUEUE_ENTRIES)
+    {
+        queue->stat.overflows++;
+        os_spinlock_release(&queue->lock);
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    }
+    was_empty = queue->wr == queue->rd;
+    queue->entry[queue->wr % COMPLETION_QUEUE_ENTRIES] = *P_COMPLETION;
+    queue->wr++;
+    queue->stat.posted++;
+    os_spinlock_release(&queue->lock);
+
+    if (queue->use_thread)
+    {
+        /* one dispatch event queued at a time, it drains the batch */
+        return Thread_send_event_ex(&queue->thread, THREAD_EVENT_COMPLETION,
+                                    &queue, sizeof(queue),
+                                    THREAD_EVENT_SEND_OPTION_OR);
+    }
+
+    if (was_empty && queue->notify)
+        queue->notify(queue->p_notify_data);
+    return RESULT_OK;
+}
+
+/**
+ *  Queue a completion from a task without blocking it. A full queue
+ *  pushes back: the poster runs the oldest callbacks itself, accounted to
+ *  thread, until there is room, keeping the order of the posts. While
+ *  another consumer dispatches it does not wait for it.
+ *
+ *  @return RESULT_NO_RESOURCES_AVAILABLE if the queue stays full
+ */
+T_RESULT Completion_post_drain(T_COMPLETION_QUEUE *queue,
+                               const T_COMPLETION *P_COMPLETION,
+                               T_THREAD *thread)
+{
+    T_RESULT result;
+
+    while (RESULT_NO_RESOURCES_AVAILABLE ==
+           (result = Completion_post(queue, P_COMPLETION)))
+    {
+        if (!completion_claim_(queue))
+            break;
+        queue->stat.drained += completion_drain_(queue, 1, thread);
+    }
+
+    return result;
+}
+
+/**
+ *  Run up to max (0 for all) queued callbacks of a polled queue in the
+ *  calling task. Returns the number run.
+ */
+U32 Completion_poll(T_COMPLETION_QUEUE *queue, U32 max)
+{
+    if (!queue || !queue->initialized || queue->use_thread)
+        return 0;
+
+    return completion_dispatch_(queue, max, NULL);
+}
+
+/**
+ *  Event handler of the completion thread
+ */
+BOOL Completion_event_hdlr(T_THREAD_EVENT *event)
+{
+    T_COMPLETION_QUEUE *queue;
+
+    switch (event->event)
+    {
+        case THREAD_EVENT_COMPLETION:
+            queue = (T_COMPLETION_QUEUE *)event->parameters.ptr;
+            completion_dispatch_(queue, 0, &queue->thread);
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/** @} */
@@ -9,54 +9,126 @@
 #include "Isr.h"
 #include "Internal.h"
 
-/*****************************************************************************/
-/* DEFINES                                                                   */
-/*****************************************************************************/
 /*****************************************************************************/
 /* LOCAL DATA                                                                */
 /*****************************************************************************/
-volatile t_HW hw;
+
 /*****************************************************************************/
 /* LOCAL FUNCTIONS                                                           */
 /*****************************************************************************/
-static BOOL Drv_isHWStatusActive(void)
+static BOOL Drv_isHWStatusActive(volatile t_HW * p_hw)
+{
+  return (HW_REG_READ(p_hw->reg_base, HW_REG_STATUS) & HW_STATUS_BUSY) != 0;
+}
+
+/* Wait for the HW to complete its power up or wake sequence */
+BOOL Drv_waitReady(volatile t_HW * p_hw)
 {
-  return FALSE;
+  U32 start = OsGetTimestamp();
+
+  while (!Drv_isReady(p_hw))
+  {
+      if (OsGetTimestamp() - start > DRV_POWER_UP_TIMEOUT)
+          return FALSE;
+      OsCpuRelax();
+  }
+  return TRUE;
 }
 
 /*****************************************************************************/
 /* EXPORTED FUNCTIONS                                                           */
 /*****************************************************************************/
 
+/* Set up the driver state of the device with registers at reg_base, OFF */
+void Drv_init(volatile t_HW * p_hw, uintptr_t reg_base)
+{
+    memset((void *)p_hw, 0x00, sizeof(*p_hw));
+    memcpy((void *)p_hw->tag_name, TAG_NAME, sizeof(TAG_NAME));
+    p_hw->reg_base = reg_base;
+    p_hw->initialized = TRUE;
+}
+
+/* Power the HW ahead of Drv_setMode ON, Drv_isReady tells when it is done */
+void Drv_powerUp(volatile t_HW * p_hw)
+{
+    if (!p_hw->config.mode)
+        Pow_setPowCfg(p_hw,ON,p_hw->config.clock);
+}
+
+/* Undo Drv_powerUp of a HW that did not get ready, it stays OFF */
+void Drv_powerDown(volatile t_HW * p_hw)
+{
+    if (!p_hw->config.mode)
+        Pow_setPowCfg(p_hw,OFF,p_hw->config.clock);
+}
+
+/* HW powered and through its power up sequence */
+BOOL Drv_isReady(volatile t_HW * p_hw)
+{
+    return (HW_REG_READ(p_hw->reg_base, HW_REG_STATUS) & HW_STATUS_READY) != 0;
+}
+
 /* Configure the HW */
-void Drv_setMode( const t_base_cfg * P_CFG )
+void Drv_setMode( volatile t_HW * p_hw, const t_base_cfg * P_CFG )
 {
     //if new mode is OFF
     if(!P_CFG->mode)
     {
         //if current HW is not OFF
-        if(hw.config.mode) // switching on --> off
+        if(p_hw->config.mode) // switching on --> off
         {
             BOOL result;
 
-            result = Drv_isHWStatusActive();
+            result = Drv_isHWStatusActive(p_hw);
             ASSERT(OS_FALSE,result,POWER_OFF_REQUEST_ACTIVE);
+
+            //disable module, remove power and clock
+            HW_REG_WRITE(p_hw->reg_base, HW_REG_CTRL, 0);
+            Pow_setPowCfg(p_hw,OFF,p_hw->config.clock);
         }
     }
     else
     {
         //If current mode is OFF
-        if(!hw.config.mode)
+        if(!p_hw->config.mode)
         {
+            BOOL ready;
+
             //enable power and clock for HW
-            Pow_setPowCfg(hw.config.mode,1);
+            Pow_setPowCfg(p_hw,ON,p_hw->config.clock);
+            ready = Drv_waitReady(p_hw);
+            ASSERT(TRUE,ready,POWER_UP_TIMEOUT);
             //enable module
+            HW_REG_WRITE(p_hw->reg_base, HW_REG_CTRL, HW_CTRL_ENABLE);
         }
     }
-    hw.config.mode = P_CFG->mode;
+    p_hw->config.mode = P_CFG->mode;
+}
+
+/* Change the HW clock, applied right away if the HW is powered */
+void Drv_setClock( volatile t_HW * p_hw, const t_base_cfg * P_CFG )
+{
+    if(p_hw->config.mode)
+        Pow_setPowCfg(p_hw,p_hw->config.mode,P_CFG->clock);
+
+    p_hw->config.clock = P_CFG->clock;
+}
+
+/* Acknowledge the HW interrupts, returns the HW_IRQ_* that were pending */
+U32 Drv_ackIrq(volatile t_HW * p_hw)
+{
+    U32 pending = 0;
+
+    if (p_hw->config.mode)
+    {
+        pending = HW_REG_READ(p_hw->reg_base, HW_REG_IRQ_STATUS);
+        if (pending)
+            HW_REG_WRITE(p_hw->reg_base, HW_REG_IRQ_STATUS, pending);
+    }
+    return pending;
 }
 
-BOOL Drv_isActive(void)
+BOOL Drv_isActive(volatile t_HW * p_hw)
 {
-    return hw.config.mode;
+    return p_hw->config.mode;
 }
@@ -0,0 +1,380 @@
+/**
+ * \file Export.c
+ * \brief Batched export pipeline
+ */
+
+/**
+ * @addtogroup Module Name
+ * @{
+ */
+#include <string.h>
+#if defined(OS_SIM)
+#include <errno.h>
+#include <unistd.h>
+#endif
+#include "Export.h"
+
+/*****************************************************************************/
+/* LOCAL FUNCTIONS                                                           */
+/*****************************************************************************/
+/*
+ * Stop filling the current buffer and go on with the next one, export
+ * lock held. Returns the buffer to flush, EXPORT_BUFFERS if there is none.
+ */
+static U32 export_hand_over_(T_EXPORT *export)
+{
+    U32 id = export->fill;
+    T_EXPORT_BUFFER *buffer = &export->buffer[id];
+
+    if (buffer->pending || !buffer->records)
+        return EXPORT_BUFFERS;
+
+    buffer->pending = TRUE;
+    export->fill = (id + 1) % EXPORT_BUFFERS;
+    return id;
+}
+
+/* Queue a handed over buffer to the export thread */
+static void export_post_(T_EXPORT *export, U32 id)
+{
+    T_EVENT_BUFFER event;
+    T_RESULT result;
+
+    if (id >= EXPORT_BUFFERS)
+        return;
+
+    event.exporter = export;
+    event.bufferId = id;
+    result = Thread_send_event_ex(&export->thread, THREAD_EVENT_EXPORT_FLUSH,
+                                  &event, sizeof(event),
+                                  THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
+    ASSERT(RESULT_OK, result, EXPORT_FLUSH_NOT_POSTED);
+}
+
+/* Write a buffer to the sink and give it back to the producers, export
+ * thread only */
+static void export_flush_(T_EXPORT *export, U32 id)
+{
+    T_EXPORT_BUFFER *buffer = &export->buffer[id];
+    T_EXPORT_SINK sink;
+    T_EXPORT_BATCH batch;
+
+    os_spinlock_obtain(&export->lock);
+    sink = export->sink;
+    os_spinlock_release(&export->lock);
+
+    batch.seq = export->stat.batches++;
+    batch.records = buffer->records;
+    batch.bytes = buffer->used;
+    batch.result = RESULT_WRONG_STATE;
+    if (sink.write)
+    {
+        Thread_watch_begin(&export->thread, (T_THREAD_FUNC)sink.write);
+        batch.result = sink.write(sink.p_sink, buffer->data, buffer->used);
+        Thread_watch_end(&export->thread);
+    }
+
+    if (FAILED(batch.result))
+        export->stat.sink_errors++;
+    else
+        export->stat.bytes += batch.bytes;
+
+    os_spinlock_obtain(&export->lock);
+    buffer->used = 0;
+    buffer->records = 0;
+    buffer->pending = FALSE;
+    os_spinlock_release(&export->lock);
+
+    LOG_EVENT(EXPORT_FLUSHED, batch.records);
+    if (export->flush_cb)
+    {
+        Thread_watch_begin(&export->thread, (T_THREAD_FUNC)export->flush_cb);
+        export->flush_cb(&batch, export->p_flush_data);
+        Thread_watch_end(&export->thread);
+    }
+}
+
+/*
+ * Age timer, runs on the export thread. The flush still goes through the
+ * queue so batches leave in the order they were handed over.
+ */
+static void export_age_cb_(void *p_data)
+{
+    T_EXPORT *export = (T_EXPORT *)p_data;
+    T_EXPORT_BUFFER *buffer;
+    U32 age, id = EXPORT_BUFFERS, remaining = 0;
+
+    os_spinlock_obtain(&export->lock);
+    buffer = &export->buffer[export->fill];
+    if (buffer->records && !buffer->pending)
+    {
+        age = OsGetTimestamp() - buffer->first_time;
+        if (age >= export->flush_age)
+        {
+            id = export_hand_over_(export);
+            export->stat.by_age++;
+        }
+        else
+        {
+            remaining = export->flush_age - age;
+        }
+    }
+    os_spinlock_release(&export->lock);
+
+    export_post_(export, id);
+    if (remaining)
+        Thread_timer_start(&export->thread, &export->age_timer, remaining, 0);
+}
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+/**
+ *  Start the export thread. export_name, the flush thresholds and
+ *  flush_cb are set by the owner beforehand. Records are refused until a
+ *  sink is set.
+ */
+T_RESULT Export_init(T_EXPORT *export)
+{
+    T_RESULT result;
+
+    if (!export || !export->export_name ||
+        export->flush_size > EXPORT_BUFFER_SIZE)
+        return RESULT_PARAMETER_ERROR;
+
+    if (export->initialized)
+        return RESULT_WRONG_STATE;
+
+    os_spinlock_init(&export->lock);
+    memset(&export->sink, 0x00, sizeof(export->sink));
+    export->fill = 0;
+    memset(export->buffer, 0x00, sizeof(export->buffer));
+    memset(&export->stat, 0x00, sizeof(export->stat));
+
+    memset(&export->age_timer, 0x00, sizeof(export->age_timer));
+    export->age_timer.callback = export_age_cb_;
+    export->age_timer.p_data = export;
+
+    export->handlers[0] = Export_event_hdlr;
+    export->handlers[1] = NULL;
+    export->thread.thread_name = export->export_name;
+    export->thread.thread_event_name = export->export_name;
+    export->thread.event_handlers = export->handlers;
+
+    result = Thread_create(&export->thread);
+    if (FAILED(result))
+        return result;
+
+    export->initialized = TRUE;
+    return RESULT_OK;
+}
+
+/**
+ *  Replace the sink, P_SINK NULL to stop exporting. Buffers handed over
+ *  already go to the new sink.
+ */
+T_RESULT Export_set_sink(T_EXPORT *export, const T_EXPORT_SINK *P_SINK)
+{
+    if (!export || (P_SINK && !P_SINK->write))
+        return RESULT_PARAMETER_ERROR;
+
+    os_spinlock_obtain(&export->lock);
+    if (P_SINK)
+        export->sink = *P_SINK;
+    else
+        memset(&export->sink, 0x00, sizeof(export->sink));
+    os_spinlock_release(&export->lock);
+
+    return RESULT_OK;
+}
+
+/**
+ *  Copy a record into the buffer being filled, from any task. A buffer is
+ *  handed to the export thread once it holds flush_size bytes, once the
+ *  next record does not fit or flush_age ticks after its first record.
+ *
+ *  @return RESULT_NO_RESOURCES_AVAILABLE if the record was dropped because
+ *  every buffer is waiting for the sink, RESULT_WRONG_STATE without sink
+ */
+T_RESULT Export_append(T_EXPORT *export, U16 type, const void *data,
+                       U32 size)
+{
+    T_EXPORT_BUFFER *buffer;
+    T_EXPORT_RECORD *record;
+    U32 need = sizeof(T_EXPORT_RECORD) + EXPORT_ALIGN(size);
+    U32 flush_size, post[EXPORT_BUFFERS], posts = 0, i;
+    BOOL arm = FALSE;
+    T_RESULT result = RESULT_OK;
+
+    if (!export || (!data && size) || size > EXPORT_RECORD_MAX)
+        return RESULT_PARAMETER_ERROR;
+
+    if (!export->initialized || !export->sink.write)
+        return RESULT_WRONG_STATE;
+
+    flush_size = export->flush_size ? export->flush_size : EXPORT_BUFFER_SIZE;
+
+    os_spinlock_obtain(&export->lock);
+    buffer = &export->buffer[export->fill];
+    if (!buffer->pending && buffer->used + need > EXPORT_BUFFER_SIZE)
+    {
+        /* no room left, go on with the other buffer */
+        post[posts++] = export_hand_over_(export);
+        export->stat.by_size++;
+        buffer = &export->buffer[export->fill];
+    }
+
+    if (buffer->pending)
+    {
+        export->stat.dropped++;
+        result = RESULT_NO_RESOURCES_AVAILABLE;
+    }
+    else
+    {
+        record = (T_EXPORT_RECORD *)((U8 *)buffer->data + buffer->used);
+        record->size = (U16)size;
+        record->type = type;
+        record->time = OsGetTimestamp();
+        if (size)
+            memcpy_s(record + 1, size, data, size);
+
+        if (!buffer->records++)
+        {
+            buffer->first_time = record->time;
+            arm = 0 != export->flush_age;
+        }
+        buffer->used += need;
+        export->stat.records++;
+
+        if (buffer->used >= flush_size)
+        {
+            post[posts++] = export_hand_over_(export);
+            export->stat.by_size++;
+        }
+    }
+    os_spinlock_release(&export->lock);
+
+    for (i = 0; i < posts; i++)
+        export_post_(export, post[i]);
+    if (arm)
+        Thread_timer_start(&export->thread, &export->age_timer,
+                           export->flush_age, 0);
+
+    return result;
+}
+
+/**
+ *  Bytes producers can append before records get dropped: the room left
+ *  in the buffer being filled and in the free buffers after it. Header
+ *  and padding of every record count too.
+ */
+U32 Export_free(T_EXPORT *export)
+{
+    U32 i, room = 0;
+
+    if (!export)
+        return 0;
+
+    os_spinlock_obtain(&export->lock);
+    for (i = 0; i < EXPORT_BUFFERS; i++)
+    {
+        const T_EXPORT_BUFFER *P_BUFFER =
+            &export->buffer[(export->fill + i) % EXPORT_BUFFERS];
+
+        if (P_BUFFER->pending)
+            break;
+        room += EXPORT_BUFFER_SIZE - P_BUFFER->used;
+    }
+    os_spinlock_release(&export->lock);
+
+    return room;
+}
+
+/**
+ *  Hand over the buffer being filled whatever its size. cb (if not NULL)
+ *  is called on the export thread once every record appended before is
+ *  written.
+ */
+T_RESULT Export_flush(T_EXPORT *export, void (*cb)(void *p_data),
+                      void *p_data)
+{
+    T_EVENT_COMPLETION event;
+    U32 id;
+
+    if (!export)
+        return RESULT_PARAMETER_ERROR;
+
+    if (!export->initialized)
+        return RESULT_WRONG_STATE;
+
+    os_spinlock_obtain(&export->lock);
+    id = export_hand_over_(export);
+    os_spinlock_release(&export->lock);
+    export_post_(export, id);
+
+    if (!cb)
+        return RESULT_OK;
+
+    event.completion_callback = cb;
+    event.p_data = p_data;
+    return Thread_send_event_ex(&export->thread, THREAD_EVENT_EXPORT_SYNC,
+                                &event, sizeof(event),
+                                THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
+}
+
+/**
+ *  Event handler of the export thread
+ */
+BOOL Export_event_hdlr(T_THREAD_EVENT *event)
+{
+    switch (event->event)
+    {
+        case THREAD_EVENT_EXPORT_FLUSH:
+            export_flush_((T_EXPORT *)event->parameters.buffer_event.exporter,
+                          event->parameters.buffer_event.bufferId);
+            return TRUE;
+
+        case THREAD_EVENT_EXPORT_SYNC:
+            event->parameters.export_event.completion_callback(
+                event->parameters.export_event.p_data);
+            return TRUE;
+
+        case THREAD_EVENT_TIMER:
+            event->parameters.timer_event.callback(
+                event->parameters.timer_event.p_data);
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+#if defined(OS_SIM)
+/**
+ *  Sink writing batches to a file descriptor of the Linux host, a file or
+ *  a pipe; p_sink is the descriptor cast to a pointer. Blocks while a pipe
+ *  is full.
+ */
+T_RESULT Export_fd_write(void *p_sink, const void *data, U32 size)
+{
+    int fd = (int)(intptr_t)p_sink;
+    const U8 *P_DATA = (const U8 *)data;
+    ssize_t written;
+
+    while (size)
+    {
+        written = write(fd, P_DATA, size);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return RESULT_FAILURE;
+        }
+        P_DATA += written;
+        size -= (U32)written;
+    }
+    return RESULT_OK;
+}
+#endif
+
+/** @} */
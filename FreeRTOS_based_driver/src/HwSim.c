@@ -0,0 +1,370 @@
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include "HwSim.h"
+
+#if defined(DRV_HW_SIM)
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+/** \brief Generator time is kept in 1/65536 tick units */
+#define HWSIM_GAP_SHIFT 16
+/** \brief Generator catch up limit, in ticks. Past the saturation rate the
+ *  raised IRQs cost more than the time they cover, a longer catch up would
+ *  starve every other task */
+#define HWSIM_CATCH_UP_MAX 10
+
+/*****************************************************************************/
+/* TYPE DEFINES                                                              */
+/*****************************************************************************/
+/**
+ * \brief Interrupt controller line
+ */
+typedef struct
+{
+    void (*isr)(U32 vector_number, void *p_param);
+    void *p_param;
+    BOOL masked;
+    BOOL pending; /**< Raised while masked, delivered on unmask */
+} T_HWSIM_LINE;
+
+/**
+ * \brief Simulated device: register file and power up timing
+ */
+typedef struct
+{
+    U32 reg[HW_REG_MAX];
+    U32 power_on_time;  /**< Time HW_POWER_ON was set */
+    U32 wake_time;      /**< Time a lower HW_POWER_LEVEL was left */
+    U32 wake_delay;     /**< Exit latency of that level */
+    T_HWSIM_STAT stat;
+} T_HWSIM_DEVICE;
+
+/*****************************************************************************/
+/* LOCAL DATA                                                                */
+/*****************************************************************************/
+/**
+ * \brief Simulated devices, interrupt controller and interrupt generator
+ */
+static struct
+{
+    T_HWSIM_DEVICE device[HWSIM_DEVICES];
+    U32 power_up_delay; /**< Of all devices */
+    BOOL delay_set;
+
+    T_HWSIM_LINE line[HWSIM_IRQ_LINES];
+
+    T_HWSIM_IRQ_CFG irq_cfg;
+    volatile BOOL generating;   /**< Cleared by HwSim_stopIrq */
+    volatile BOOL task_running; /**< Generator task not yet deleted */
+    U32 rand;
+} hwsim;
+
+/** \brief Exit latency by HW_POWER_LEVEL */
+static const U32 hwsim_exit_latency[] = {
+    0, HWSIM_EXIT_LATENCY_GATED, HWSIM_EXIT_LATENCY_RETENTION, HWSIM_EXIT_LATENCY_OFF
+};
+
+/*****************************************************************************/
+/* FUNCTION PROTOTYPES                                                       */
+/*****************************************************************************/
+
+/*****************************************************************************/
+/* LOCAL FUNCTIONS                                                           */
+/*****************************************************************************/
+/* Through the power up sequence, IRQs are latched from here on */
+static BOOL HwSim_isPowered(const T_HWSIM_DEVICE * P_DEV)
+{
+    U32 delay = hwsim.delay_set ? hwsim.power_up_delay : HWSIM_POWER_UP_DELAY;
+
+    return (P_DEV->reg[HW_REG_POWER] & HW_POWER_ON) &&
+           OsGetTimestamp() - P_DEV->power_on_time >= delay;
+}
+
+/* Powered, at full power and through the exit latency of the last wake */
+static BOOL HwSim_isReady(const T_HWSIM_DEVICE * P_DEV)
+{
+    return HwSim_isPowered(P_DEV) &&
+           !(P_DEV->reg[HW_REG_POWER] & HW_POWER_LEVEL_MASK) &&
+           OsGetTimestamp() - P_DEV->wake_time >= P_DEV->wake_delay;
+}
+
+/* Hand a raised line to its ISR unless masked */
+static void HwSim_deliver(U32 line)
+{
+    T_HWSIM_LINE *p_line = &hwsim.line[line];
+
+    if (!p_line->isr)
+        return;
+
+    if (p_line->masked)
+    {
+        p_line->pending = TRUE;
+        return;
+    }
+    p_line->pending = FALSE;
+#if defined(OS_SIM)
+    OsSim_isrEnter();
+    p_line->isr(line, p_line->p_param);
+    OsSim_isrExit();
+#else
+    p_line->isr(line, p_line->p_param);
+#endif
+}
+
+/* Gap to the next burst, in 1/65536 ticks */
+static U32 HwSim_nextGap(void)
+{
+    U32 gap = ((U32)(configTICK_RATE_HZ << HWSIM_GAP_SHIFT) / hwsim.irq_cfg.rate) *
+              hwsim.irq_cfg.burst;
+    U32 spread = gap / 100 * hwsim.irq_cfg.jitter;
+
+    if (spread)
+    {
+        hwsim.rand = hwsim.rand * 1664525U + 1013904223U;
+        gap = gap - spread + hwsim.rand % (2 * spread + 1);
+    }
+    return gap ? gap : 1;
+}
+
+/**
+ *  Interrupt generator. Bursts are due every HwSim_nextGap(), those that
+ *  fell due while the task slept are raised back to back on wake up, so
+ *  rates above the tick rate still average out.
+ */
+static void HwSim_irqTask(void * p_param)
+{
+    U32 last = OsGetTimestamp();
+    U32 budget = 0;
+    U32 gap = HwSim_nextGap();
+    U32 now, elapsed, i;
+
+    (void)p_param;
+
+    while (hwsim.generating)
+    {
+        now = OsGetTimestamp();
+        elapsed = now - last;
+        last = now;
+        if (elapsed > HWSIM_CATCH_UP_MAX)
+            elapsed = HWSIM_CATCH_UP_MAX;
+        budget += elapsed << HWSIM_GAP_SHIFT;
+
+        while (budget >= gap)
+        {
+            budget -= gap;
+            hwsim.device[hwsim.irq_cfg.device].stat.bursts++;
+            for (i = 0; i < hwsim.irq_cfg.burst; i++)
+                HwSim_raiseIrq(hwsim.irq_cfg.device, HW_IRQ_TIMEOUT);
+            gap = HwSim_nextGap();
+        }
+
+        vTaskDelay(((gap - budget - 1) >> HWSIM_GAP_SHIFT) + 1);
+    }
+
+    hwsim.task_running = FALSE;
+    vTaskDelete(NULL);
+}
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+U32 HwSim_read(uintptr_t base, T_HW_REG reg)
+{
+    T_HWSIM_DEVICE *p_dev;
+
+    if (base >= HWSIM_DEVICES || reg >= HW_REG_MAX)
+        return 0;
+    p_dev = &hwsim.device[base];
+
+    if (HW_REG_STATUS == reg)
+    {
+        U32 status = 0;
+
+        if (p_dev->reg[HW_REG_POWER] & HW_POWER_ON)
+            status |= HW_STATUS_POWERED;
+        if (HwSim_isReady(p_dev))
+            status |= HW_STATUS_READY;
+        if (p_dev->reg[HW_REG_IRQ_STATUS])
+            status |= HW_STATUS_BUSY;
+        return status;
+    }
+
+    if (HW_REG_POWER != reg && !HwSim_isReady(p_dev))
+    {
+        p_dev->stat.not_ready++;
+        return 0;
+    }
+    return p_dev->reg[reg];
+}
+
+void HwSim_write(uintptr_t base, T_HW_REG reg, U32 value)
+{
+    T_HWSIM_DEVICE *p_dev;
+    U32 cleared;
+
+    if (base >= HWSIM_DEVICES)
+        return;
+    p_dev = &hwsim.device[base];
+
+    switch (reg)
+    {
+        case HW_REG_POWER:
+            if ((value & HW_POWER_ON) && !(p_dev->reg[HW_REG_POWER] & HW_POWER_ON))
+                p_dev->power_on_time = OsGetTimestamp();
+            if ((value & HW_POWER_LEVEL_MASK) <
+                (p_dev->reg[HW_REG_POWER] & HW_POWER_LEVEL_MASK))
+            {
+                p_dev->wake_time = OsGetTimestamp();
+                p_dev->wake_delay = hwsim_exit_latency[
+                    (p_dev->reg[HW_REG_POWER] & HW_POWER_LEVEL_MASK) >>
+                    HW_POWER_LEVEL_SHIFT];
+            }
+            if (!(value & HW_POWER_ON))
+            {
+                /* power loss resets the device */
+                p_dev->reg[HW_REG_CTRL] = 0;
+                p_dev->reg[HW_REG_IRQ_STATUS] = 0;
+            }
+            p_dev->reg[HW_REG_POWER] = value;
+            break;
+
+        case HW_REG_CTRL:
+        case HW_REG_IRQ_STATUS:
+            if (!HwSim_isReady(p_dev))
+            {
+                p_dev->stat.not_ready++;
+                break;
+            }
+            if (HW_REG_CTRL == reg)
+            {
+                p_dev->reg[HW_REG_CTRL] = value;
+                break;
+            }
+            taskENTER_CRITICAL();
+            cleared = p_dev->reg[HW_REG_IRQ_STATUS] & value;
+            p_dev->reg[HW_REG_IRQ_STATUS] &= ~value;
+            for (; cleared; cleared &= cleared - 1)
+                p_dev->stat.irq_serviced++;
+            taskEXIT_CRITICAL();
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ *  Device side of an interrupt: latch the status bit, then signal the
+ *  line of the device. The generator raises its IRQs here, tests may too.
+ */
+void HwSim_raiseIrq(uintptr_t base, U32 irq)
+{
+    T_HWSIM_DEVICE *p_dev;
+
+    if (base >= HWSIM_DEVICES)
+        return;
+    p_dev = &hwsim.device[base];
+
+    taskENTER_CRITICAL();
+    /* a device in a low power level still raises, the IRQ wakes it */
+    if (!(p_dev->reg[HW_REG_CTRL] & HW_CTRL_ENABLE) || !HwSim_isPowered(p_dev))
+    {
+        p_dev->stat.irq_dropped++;
+        taskEXIT_CRITICAL();
+        return;
+    }
+    p_dev->stat.irq_raised++;
+    if (p_dev->reg[HW_REG_IRQ_STATUS] & irq)
+        p_dev->stat.irq_coalesced++;
+    p_dev->reg[HW_REG_IRQ_STATUS] |= irq;
+    taskEXIT_CRITICAL();
+
+    HwSim_deliver(HWSIM_IRQ_LINE(base));
+}
+
+/* OsIrqCreate - lines start unmasked, p_param is handed to the isr */
+U32 HwSim_irqCreate(OsIrqIsr *irq, U32 line,
+                    void (*isr)(U32 vector_number, void *p_param), void *p_param)
+{
+    if (line >= HWSIM_IRQ_LINES || !isr)
+        return OS_FALSE;
+
+    irq->data = line;
+    hwsim.line[line].isr = isr;
+    hwsim.line[line].p_param = p_param;
+    hwsim.line[line].masked = FALSE;
+    hwsim.line[line].pending = FALSE;
+    return OS_SUCCESS;
+}
+
+/* OsIrqMask / OsIrqUnmask, an IRQ raised while masked fires on unmask */
+U32 HwSim_irqMask(OsIrqIsr *irq, BOOL mask)
+{
+    T_HWSIM_LINE *p_line;
+
+    if (irq->data >= HWSIM_IRQ_LINES)
+        return OS_FALSE;
+    p_line = &hwsim.line[irq->data];
+
+    p_line->masked = mask;
+    if (!mask && p_line->pending)
+        HwSim_deliver(irq->data);
+    return OS_SUCCESS;
+}
+
+/* Power up delay of every device */
+void HwSim_setPowerUpDelay(U32 ticks)
+{
+    hwsim.power_up_delay = ticks;
+    hwsim.delay_set = TRUE;
+}
+
+/**
+ * \brief Start the interrupt generator
+ *
+ * @return RESULT_WRONG_STATE if the generator still runs
+ */
+T_RESULT HwSim_startIrq(const T_HWSIM_IRQ_CFG * P_CFG)
+{
+    if (!P_CFG || !P_CFG->rate ||
+        P_CFG->rate > ((U32)configTICK_RATE_HZ << HWSIM_GAP_SHIFT) ||
+        !P_CFG->burst || P_CFG->burst > HWSIM_BURST_MAX ||
+        P_CFG->jitter > 100 || P_CFG->device >= HWSIM_DEVICES)
+        return RESULT_PARAMETER_ERROR;
+
+    if (hwsim.task_running)
+        return RESULT_WRONG_STATE;
+
+    hwsim.irq_cfg = *P_CFG;
+    hwsim.rand = P_CFG->seed;
+    hwsim.generating = TRUE;
+    hwsim.task_running = TRUE;
+    if (pdPASS != xTaskCreate(HwSim_irqTask, "HwSimIrq", configMINIMAL_STACK_SIZE,
+                              NULL, HWSIM_IRQ_TASK_PRIORITY, NULL))
+    {
+        hwsim.generating = FALSE;
+        hwsim.task_running = FALSE;
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    }
+    return RESULT_OK;
+}
+
+/* No IRQ is raised once this returns, the task exits on its next wake up */
+void HwSim_stopIrq(void)
+{
+    hwsim.generating = FALSE;
+}
+
+void HwSim_getStat(uintptr_t base, T_HWSIM_STAT * P_STAT)
+{
+    if (base >= HWSIM_DEVICES)
+        return;
+
+    taskENTER_CRITICAL();
+    *P_STAT = hwsim.device[base].stat;
+    P_STAT->irq_pending = hwsim.device[base].reg[HW_REG_IRQ_STATUS];
+    taskEXIT_CRITICAL();
+}
+
+#endif /* DRV_HW_SIM */
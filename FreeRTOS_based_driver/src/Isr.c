@@ -24,15 +24,18 @@
  */
 struct
 {
-    OsIrqIsr isr_timeout;
+    T_ISR_HOOK hook; /**< Interrupt recorder, may be NULL */
 
-
-    T_THREAD *worker_thread;
-
-    /* ISR module initialized */
-    BOOL initialized;
+    /* Line raised by Test_simulate_SW_TIMER_interrupt_generation, the
+     * first one installed */
+    T_ISR *first;
 } isr;
 
+#if defined(OS_ISR_NESTING_COUNT)
+/* Driver handlers running, OsIsInIsr of ports without an ISR check */
+volatile uint32_t os_isr_nesting;
+#endif
+
 /*****************************************************************************/
 /* FUNCTION PROTOTYPES                                                       */
 /*****************************************************************************/
@@ -42,60 +45,94 @@ struct
 /*****************************************************************************/
 ISR_DEFINE(isr_timeout)
 {
-    hw.stat.irq_timeout++;
+    T_ISR *p_isr = (T_ISR *)p_param;
 
+    OsIsrEnter();
+    p_isr->p_hw->stat.irq_timeout++;
+
+    /* one queued event covers the lines of all devices of the thread */
+    p_isr->pending = TRUE;
     /* thread_send_event traps on fatal errors */
-    Thread_send_event(isr.worker_thread,
+    Thread_send_event(p_isr->worker_thread,
                          THREAD_EVENT_TIMEOUT,
                          THREAD_EVENT_SEND_OPTION_OR);
+    OsIsrExit();
 }
 
 /*****************************************************************************/
 /* EXPORTED FUNCTIONS                                                        */
 /*****************************************************************************/
 /**
- * \brief Install interrupt service routines and callbacks
+ * \brief Install the interrupt service routine of a device line
  *
  * @return  None
  */
-void Isr_init(T_THREAD *p_worker_thread)
+void Isr_init(T_ISR *p_isr, U32 line, T_THREAD *p_worker_thread,
+              volatile t_HW *p_hw)
 {
     U32 rc;
 
     PTR_ASSERT(p_worker_thread, ISR_NO_THREAD_ERR);
-    isr.worker_thread = p_worker_thread;
+    p_isr->line = line;
+    p_isr->worker_thread = p_worker_thread;
+    p_isr->p_hw = p_hw;
+    p_isr->pending = FALSE;
 
     /* Register IRQ handler*/
     rc = OsIrqCreate(
-        &isr.isr_timeout,
-        "TmoLisr", T_INTERRUPT_LINE_TIMEOUT,
-        isr_timeout);
+        &p_isr->irq,
+        "TmoLisr", line,
+        isr_timeout, p_isr);
     if (rc != OS_SUCCESS)
         TRAP(ISR_TMO_ERR, rc);
 
-    isr.initialized = TRUE;
+    p_isr->initialized = TRUE;
+    if (!isr.first)
+        isr.first = p_isr;
 }
 
 /* Mask or unmaks the interrupts */
-void Isr_unmaskIrqs( BOOL onOff )
+void Isr_unmaskIrqs( T_ISR *p_isr, BOOL onOff )
 {
     U32 rc = OS_SUCCESS;
 
     if( onOff )
     {
         /* isr enable */
-        rc = OsIrqUnmask(&isr.isr_timeout);
+        rc = OsIrqUnmask(&p_isr->irq);
         if (rc != OS_SUCCESS)
             TRAP(ISR_TMO_UNMASK, rc);
     }
     else
     {
-        rc = OsIrqMask(&isr.isr_timeout);
+        rc = OsIrqMask(&p_isr->irq);
         if (rc != OS_SUCCESS)
             TRAP(ISR_TMO_MASK, rc);
     }
 }
+
+/* Worker thread: TRUE once per IRQ signalled since the last call */
+BOOL Isr_takePending(T_ISR *p_isr)
+{
+    if (!p_isr->pending)
+        return FALSE;
+
+    /* raised again meanwhile: the new event finds it taken, the HW
+     * status read after this covers it */
+    p_isr->pending = FALSE;
+    /* the recorder appends to the export, not from the ISR */
+    if (isr.hook)
+        isr.hook(p_isr->line);
+    return TRUE;
+}
+/* Install an interrupt recorder, NULL to remove it */
+void Isr_setHook( T_ISR_HOOK hook )
+{
+    isr.hook = hook;
+}
+
 void Test_simulate_SW_TIMER_interrupt_generation(void)
 {
-	isr_timeout(00, 00);
+	if (isr.first)
+		isr_timeout(isr.first->line, isr.first);
 }
\ No newline at end of file
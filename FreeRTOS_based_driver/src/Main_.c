@@ -4,32 +4,101 @@
 #include <Scheduler.h>
 #include <Drv.h>
 #include <Isr.h>
+#include <Pow.h>
+#include <HwSim.h>
+#include <Stress.h>
+#include <Bridge.h>
+#include <Record.h>
 #include <Main.h>
+#if defined(OS_SIM)
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 /*****************************************************************************/
 /* GLOBAL DATA                                                               */
 /*****************************************************************************/
 
+/*****************************************************************************/
+/* TYPE DEFINES                                                              */
+/*****************************************************************************/
+/**
+ * \brief A driver thread and the devices it serves. The pool threads come
+ * first, the threads of a device of their own are taken from the end.
+ */
+typedef struct main_shard_s
+{
+    T_THREAD thread;
+    T_MAIN_DEVICE *devices; /**< Served devices, in the order added */
+    U32 count;
+    BOOL own;               /**< Thread of its own of one device */
+} T_MAIN_SHARD;
+
 /*****************************************************************************/
 /* LOCAL DATA                                                                */
 /*****************************************************************************/
 static BOOL main_event_hdlr(T_THREAD_EVENT * event);
-static void thread_init(void);
+static BOOL main_event_expired(T_THREAD_EVENT * event);
+static BOOL Main_on_event(T_MAIN_DEVICE * device, T_THREAD_EVENT * event);
 
 static T_THREAD_CB thread_main_handlers[] = { main_event_hdlr,
                                               Scheduler_event_hdlr,
                                               NULL };
 
-static FAST_MEM_DATA_SECTION T_THREAD main_thread_ = {
-      .thread_name = "MAIN_THREAD",
-      .thread_event_name = "MAIN_E",
-      .event_handlers = thread_main_handlers,
-      .thread_start = thread_init,
-};
+/* One per MAIN_THREADS_MAX */
+static const char * const main_thread_names[MAIN_THREADS_MAX] = {
+      "MAIN_THREAD", "MAIN_THREAD1", "MAIN_THREAD2", "MAIN_THREAD3" };
+static const char * const main_thread_event_names[MAIN_THREADS_MAX] = {
+      "MAIN_E", "MAIN_E1", "MAIN_E2", "MAIN_E3" };
 
-static T_THREAD *main_thread = &main_thread_;
+static FAST_MEM_DATA_SECTION T_MAIN_SHARD main_shard[MAIN_THREADS_MAX];
+
+/** \brief Thread of the first device */
+static T_THREAD *main_thread = &main_shard[0].thread;
+
+static struct
+{
+    U32 pool;    /**< Pool threads, main_shard[0 .. pool) */
+    U32 devices; /**< Added so far */
+} main_devices = { .pool = MAIN_POOL_THREADS };
 
 DECLARE_SCHEDULER(main_scheduler, MAX_SCHEDULER_QUEUE_ENTRIES);
 
+/** \brief First device, target of the Main_* calls without a device */
+static T_MAIN_DEVICE main_device = {
+      .device_name = "MAIN",
+      .reg_base = HW_REG_BASE,
+      .irq_line = T_INTERRUPT_LINE_TIMEOUT,
+};
+
+static void Main_on_export_flush(const T_EXPORT_BATCH * P_BATCH, void * p_data);
+
+/**
+ * \brief Export of the published states, records are refused until a
+ * sink is set with Main_setExportSink
+ */
+static T_EXPORT main_export = {
+      .export_name = "MAIN_EXPORT",
+      .flush_age = MAIN_EXPORT_FLUSH_AGE,
+      .flush_cb = Main_on_export_flush,
+};
+
+static T_THREAD_ASYNC_STATE Main_power_up(T_THREAD_ASYNC * async);
+static void Main_publish_state(T_MAIN_DEVICE * device);
+static void Main_power_up_done(T_THREAD_ASYNC * async);
+
+/**
+ * \brief Driver thread watchdog. It has to run while the thread is stuck,
+ * so it is a kernel timer and not a thread timer.
+ */
+static struct
+{
+    OsTimer timer;
+#if defined(DRV_STATIC_ALLOC)
+    OsTimerMem timer_mem;
+#endif
+} main_watchdog;
+
 /*****************************************************************************/
 /* LOCAL FUNCTIONS                                                           */
 /*****************************************************************************/
@@ -39,16 +108,32 @@ DECLARE_SCHEDULER(main_scheduler, MAX_SCHEDULER_QUEUE_ENTRIES);
 
 void Main_init(void);
 void Main_reqSetMode(const t_base_cfg * P_MODE ,void (*cb)(void*),void * p_cb_data);
+void Main_reqSetModeUrgent(const t_base_cfg * P_MODE ,void (*cb)(void*),void * p_cb_data);
 void Main_getState( void (*cb)(U32 State));
 static int Main_init_done = 0;
-/* A software timer that is started from the tick hook. */
-static TimerHandle_t xTimer = NULL;
+/* Periodic timer of the driver thread simulating the timer interrupt */
+static T_THREAD_TIMER test_sw_timer;
 /* The rate at which data is sent to the queue.  The times are converted from
 milliseconds to ticks using the pdMS_TO_TICKS() macro. */
 #define mainTIMER_SEND_FREQUENCY_MS			pdMS_TO_TICKS( 2000UL )
 
-/* Priorities at which the tasks are created. */
+/* Priorities at which the tasks are created. */
 #define	main_TEST_TASK_PRIORITY		( tskIDLE_PRIORITY + 1 )
+
+#if defined(DRV_STATIC_ALLOC)
+/* Test tasks are reserved at build time like the driver thread */
+enum { TEST_TASK_MAIN, TEST_TASK_HOG, TEST_TASK_HIGH_PRIO, TEST_TASK_URGENT,
+	TEST_TASK_CANCELLED, TEST_TASK_MAX };
+static OsThreadMem test_task_mem[TEST_TASK_MAX];
+#define Test_task_create(func_, name_, prio_, mem_) \
+	xTaskCreateStatic(func_, name_, OS_THREAD_STACK_DEPTH, NULL, prio_, \
+		test_task_mem[mem_].stack, &test_task_mem[mem_].tcb)
+#else
+#define Test_task_create(func_, name_, prio_, mem_) \
+	xTaskCreate(func_, name_, configMINIMAL_STACK_SIZE, NULL, prio_, NULL)
+#endif
+/* Blocking calls of the zero heap test */
+#define TEST_ZERO_HEAP_CALLS 16
 /*-----------------------------------------------------------*/
 void Test_cb1(void * str) {
 	printf("Call Back CB1 - %s", (char *)str);
@@ -60,26 +145,453 @@ T_RESULT Test_cb3(void * str) {
 	printf("Call Back CB3 - %s", (char *)str);
 	return RESULT_OK;
 }
-static void TimerCallback(TimerHandle_t xTimerHandle)
-{
-
-	/* This is the software timer callback function.  The software timer has a
-	period of two seconds and is reset each time a key is pressed.  This
-	callback function will execute if the timer expires, which will only happen
-	if a key is not pressed for two seconds. */
-
-	/* Avoid compiler warnings resulting from the unused parameter. */
-	(void)xTimerHandle;
-
-	printf("Call Back - software timer\r\n");
-
-	/* Send to the queue - causing the queue receive task to unblock and
-	write out a message.  This function is called from the timer/daemon task, so
-	must not block.  Hence the block time is set to 0. */
-	if (Main_init_done)
-		Test_simulate_SW_TIMER_interrupt_generation();
-	// Re-start the Timer
-	BaseType_t xReturned = xTimerStart(xTimer, 0);
+/* Number of normal lane events queued ahead of the urgent one */
+#define TEST_LANE_BURST 8
+static U32 test_lane_seq;
+static U32 test_lane_urgent_seq;
+void Test_cb_lane_normal(U32 State) {
+	test_lane_seq++;
+}
+void Test_cb_lane_urgent(U32 State) {
+	test_lane_urgent_seq = ++test_lane_seq;
+}
+/* Urgent latency under load - normal events of TEST_LANE_WORK cycles each */
+#define TEST_LANE_BACKLOG 12
+#define TEST_LANE_WORK 500
+static U32 test_lane_backlog_done;
+static U32 test_lane_urgent_post;
+static U32 test_lane_urgent_latency;
+static U32 test_lane_urgent_behind;
+void Test_cb_lane_slow(U32 State) {
+	U32 start = OsGetCycles();
+	while (OsGetCycles() - start < TEST_LANE_WORK)
+		OsCpuRelax();
+	test_lane_backlog_done++;
+}
+void Test_cb_lane_urgent_timed(U32 State) {
+	test_lane_urgent_latency = OsGetCycles() - test_lane_urgent_post;
+	test_lane_urgent_behind = TEST_LANE_BACKLOG - test_lane_backlog_done;
+}
+/* Cancel test - SET_CFG burst, every third one is kept */
+#define TEST_CANCEL_EVENTS 6
+#define TEST_CANCEL_KEEP_EVERY 3
+static U32 test_cancel_done;
+void Test_cb_cancel(void * p) {
+	test_cancel_done++;
+}
+BOOL Test_is_cancelled(const T_THREAD_EVENT * event, void * p) {
+	return THREAD_EVENT_SET_CFG == event->event &&
+		Test_cb_cancel == event->parameters.cfg_event.completion_callback &&
+		!event->parameters.cfg_event.p_completion_callback_data;
+}
+BOOL Test_is_timeout(const T_THREAD_EVENT * event, void * p) {
+	return THREAD_EVENT_TIMEOUT == event->event;
+}
+/* TTL test - events posted with a TTL wait this long in the queue */
+#define TEST_TTL_TICKS 2
+#define TEST_TTL_STALL_TICKS 5
+static U32 test_ttl_expired, test_ttl_fresh, test_ttl_cfg_done;
+void Test_cb_ttl(U32 State) {
+	if (MAIN_STATE_EXPIRED == State)
+		test_ttl_expired++;
+	else
+		test_ttl_fresh++;
+}
+void Test_cb_ttl_cfg(void * p) {
+	T_MAIN_STATE_SNAPSHOT state;
+
+	/* run on the driver thread, the snapshot tells how it ended */
+	Main_readState(&state);
+	if (MAIN_CFG_EXPIRED == state.cfg_status)
+		test_ttl_cfg_done++;
+}
+/* Export test - state records checked by the sink, a slow sink makes the
+ * driver drop records */
+#define TEST_EXPORT_EVENTS 100
+#define TEST_EXPORT_BURST 200
+#define TEST_EXPORT_SLOW_TICKS 20
+#define TEST_EXPORT_SYNC_TIMEOUT 1000
+static struct {
+	U32 records;
+	U32 batches;
+	U32 next_generation;
+	U32 missing;      /* generations skipped */
+	U32 order_errors;
+	U32 slow;         /* ticks the sink takes per batch */
+	volatile BOOL synced;
+} test_export;
+T_RESULT Test_export_write(void * p_sink, const void * data, U32 size) {
+	const U8 * P_DATA = (const U8 *)data;
+
+	while (size >= sizeof(T_EXPORT_RECORD)) {
+		const T_EXPORT_RECORD * P_RECORD = (const T_EXPORT_RECORD *)P_DATA;
+		const T_MAIN_STATE_SNAPSHOT * P_STATE = (const T_MAIN_STATE_SNAPSHOT *)(P_RECORD + 1);
+		U32 step = sizeof(T_EXPORT_RECORD) + ((P_RECORD->size + 3U) & ~3U);
+
+		if (MAIN_EXPORT_STATE != P_RECORD->type || step > size ||
+			(test_export.records && P_STATE->generation < test_export.next_generation))
+			test_export.order_errors++;
+		else if (test_export.records)
+			test_export.missing += P_STATE->generation - test_export.next_generation;
+		test_export.next_generation = P_STATE->generation + 1;
+		test_export.records++;
+		P_DATA += step;
+		size -= step < size ? step : size;
+	}
+	test_export.batches++;
+	if (test_export.slow)
+		vTaskDelay(test_export.slow);
+	return RESULT_OK;
+}
+void Test_cb_export_synced(void * p) {
+	test_export.synced = TRUE;
+}
+/* Runs on the driver thread after the events posted before it, the state
+ * of this event is appended after the flush and stays buffered */
+void Test_cb_export_sync(U32 State) {
+	Export_flush(&main_export, Test_cb_export_synced, NULL);
+}
+void Test_export_wait(void) {
+	U32 start = OsGetTimestamp();
+
+	Main_getState(Test_cb_export_sync);
+	while (!test_export.synced && OsGetTimestamp() - start < TEST_EXPORT_SYNC_TIMEOUT)
+		vTaskDelay(1);
+}
+/* Record test - a small workload recorded to memory and replayed */
+#define TEST_RECORD_ROUNDS 4
+#define TEST_RECORD_GAP 5
+#define TEST_RECORD_LOG_SIZE 1024
+static struct {
+	U32 log[TEST_RECORD_LOG_SIZE / sizeof(U32)];
+	U32 size;
+} test_record;
+T_RESULT Test_record_write(void * p_sink, const void * data, U32 size) {
+	if (size > sizeof(test_record.log) - test_record.size)
+		return RESULT_NO_RESOURCES_AVAILABLE;
+	memcpy((U8 *)test_record.log + test_record.size, data, size);
+	test_record.size += size;
+	return RESULT_OK;
+}
+T_RESULT Test_cb_record(void * p) {
+	return RESULT_OK;
+}
+/* Async test - a slow power up leaves the driver thread to the timers and
+ * IRQs, an async handler awaits an IRQ, a sleep and a state request */
+#define TEST_ASYNC_POWER_UP (DRV_POWER_UP_TIMEOUT - 2)
+#define TEST_ASYNC_POWER_UP_LATE (DRV_POWER_UP_TIMEOUT + 5)
+#define TEST_ASYNC_PERIOD 1
+#define TEST_ASYNC_SLEEP 10
+#define TEST_ASYNC_TIMEOUT 100
+static struct {
+	T_THREAD_ASYNC async;
+	T_THREAD_TIMER timer;
+	U32 timer_hits;      /* expiries while the HW powered up */
+	U32 on_time;
+	U32 state_time;
+	volatile U32 state;
+	U32 irq_time;
+	U32 slept;
+	BOOL irq_timed_out;
+	BOOL state_timed_out;
+	volatile BOOL done;
+	volatile U32 late_time; /* power up past the timeout completed */
+	U32 late_status;
+} test_async;
+void Test_cb_async_timer(void * p) {
+	if (!test_async.on_time)
+		test_async.timer_hits++;
+}
+void Test_cb_async_on(void * p) {
+	test_async.on_time = OsGetTimestamp();
+}
+void Test_cb_async_late(void * p) {
+	T_MAIN_STATE_SNAPSHOT state;
+
+	Main_readState(&state);
+	test_async.late_status = state.cfg_status;
+	test_async.late_time = OsGetTimestamp();
+}
+void Test_cb_async_state(U32 State) {
+	test_async.state_time = OsGetTimestamp();
+	test_async.state = State;
+}
+T_THREAD_ASYNC_STATE Test_async_body(T_THREAD_ASYNC * async) {
+	THREAD_ASYNC_BEGIN(async);
+	THREAD_ASYNC_AWAIT_EVENT(async, THREAD_EVENT_TIMEOUT, TEST_ASYNC_TIMEOUT);
+	test_async.irq_timed_out = async->timed_out;
+	test_async.irq_time = OsGetTimestamp();
+	THREAD_ASYNC_SLEEP(async, TEST_ASYNC_SLEEP);
+	test_async.slept = OsGetTimestamp() - test_async.irq_time;
+	/* nobody asks for the state, the await times out */
+	THREAD_ASYNC_AWAIT_EVENT(async, THREAD_GET_STATE, TEST_ASYNC_SLEEP);
+	test_async.state_timed_out = async->timed_out;
+	THREAD_ASYNC_END(async);
+}
+void Test_async_done(T_THREAD_ASYNC * async) {
+	test_async.done = TRUE;
+}
+/* Completion test - callbacks leave the driver thread for a completion
+ * thread, then for a queue polled by the test task */
+#define TEST_COMPLETIONS 8
+#define TEST_COMPLETION_OVERFLOW (COMPLETION_QUEUE_ENTRIES + TEST_COMPLETIONS)
+static T_COMPLETION_QUEUE test_completion_thread = {
+	.queue_name = "COMPLETION",
+	.use_thread = TRUE,
+};
+static T_COMPLETION_QUEUE test_completion_polled = {
+	.queue_name = "TEST_COMPLETION",
+};
+static struct {
+	U32 count;
+	U32 on_driver;     /* run on the driver thread */
+	U32 on_thread;     /* run on the completion thread */
+	U32 order_errors;
+	U32 next;
+	TaskHandle_t poller;
+	U32 on_poller;     /* run in the test task */
+	U32 held_on_driver; /* on_driver while a polled callback held the queue */
+} test_completion;
+void Test_cb_completion(void * p) {
+	TaskHandle_t self = xTaskGetCurrentTaskHandle();
+	U32 seq = (U32)(uintptr_t)p;
+
+	if (seq != test_completion.next)
+		test_completion.order_errors++;
+	test_completion.next = seq + 1;
+	test_completion.count++;
+	if (self == main_thread->event_thread_id)
+		test_completion.on_driver++;
+	else if (self == test_completion_thread.thread.event_thread_id)
+		test_completion.on_thread++;
+	else if (self == test_completion.poller)
+		test_completion.on_poller++;
+}
+/* Polled callback that overfills its own queue while it runs */
+void Test_cb_completion_hold(void * p) {
+	static const t_base_cfg on = { ON, 0 };
+	U32 i, n;
+
+	for (n = 0; n < TEST_COMPLETION_OVERFLOW; n += TEST_COMPLETIONS)
+	{
+		for (i = n; i < n + TEST_COMPLETIONS; i++)
+			Main_reqSetMode(&on, Test_cb_completion, (void *)(uintptr_t)i);
+		vTaskDelay(1);
+	}
+	test_completion.held_on_driver = test_completion.on_driver;
+}
+#if defined(DRV_HW_SIM)
+/* Multi-device test - two more devices in a pool of two threads with the
+ * first one, the last device on a thread of its own */
+#define TEST_POOL_THREADS 2
+#define TEST_DEVICES 3
+#define TEST_DEVICE_IRQS 4
+DECLARE_SCHEDULER(test_device_scheduler, MAX_SCHEDULER_QUEUE_ENTRIES);
+static T_MAIN_DEVICE test_device[TEST_DEVICES] = {
+	{ .device_name = "DEV1", .reg_base = 1, .irq_line = HWSIM_IRQ_LINE(1) },
+	{ .device_name = "DEV2", .reg_base = 2, .irq_line = HWSIM_IRQ_LINE(2) },
+	{ .device_name = "DEV3", .reg_base = 3, .irq_line = HWSIM_IRQ_LINE(3),
+	  .own_thread = TRUE },
+};
+static struct {
+	U32 done;
+	U32 wrong_thread; /* not run on the thread of the device */
+	TaskHandle_t moved_on; /* ran the call of the re-initialized scheduler */
+	T_SCHEDULER *cancel_on; /* re-initialized under a blocked caller */
+	T_RESULT cancelled; /* result of the call dropped by the re-init */
+} test_dev;
+T_RESULT Test_cb_moved(void * p) {
+	test_dev.moved_on = xTaskGetCurrentTaskHandle();
+	return RESULT_OK;
+}
+/* Blocks on a call the scheduler has no grant for */
+static void Test_cancelled_caller_task(void * p) {
+	test_dev.cancelled = Scheduler_run(test_dev.cancel_on, Test_cb_moved, NULL);
+	vTaskDelete(NULL);
+}
+BOOL Test_scheduler_linked(T_THREAD * thread, T_SCHEDULER * scheduler) {
+	T_SCHEDULER *it;
+
+	for (it = (T_SCHEDULER *)thread->schedulers; it; it = it->next)
+		if (it == scheduler)
+			return TRUE;
+	return FALSE;
+}
+void Test_cb_device(void * p) {
+	T_MAIN_DEVICE *device = (T_MAIN_DEVICE *)p;
+
+	if (xTaskGetCurrentTaskHandle() != device->shard->thread.event_thread_id)
+		test_dev.wrong_thread++;
+	test_dev.done++;
+}
+T_RESULT Test_cb_device_call(void * p) {
+	Test_cb_device(p);
+	return RESULT_OK;
+}
+#endif
+#if defined(OS_SIM)
+/* Bridge test - a client on a mapping of its own, as another process */
+#define TEST_BRIDGE_NAME "/drv_bridge_test"
+#define TEST_BRIDGE_REQUESTS 4
+#define TEST_BRIDGE_TIMEOUT 100
+/* Forked client: wait per answer, parent polls in host milliseconds */
+#define TEST_BRIDGE_WAIT_US 1000000
+#define TEST_BRIDGE_CHILD_POLLS 2000
+/* Runs in the forked copy of the simulator, where only the client calls
+ * of the bridge may be used. Exit status 0 once every answer came. */
+static int Test_bridgeChild(void)
+{
+	T_BRIDGE_SHM * p_shm;
+	T_BRIDGE_RESPONSE rsp;
+	U32 client, seq, mode;
+	int failed = 0;
+
+	p_shm = Bridge_clientAttach(TEST_BRIDGE_NAME, &client);
+	if (!p_shm)
+		return 1;
+	/* one request at a time, the client sleeps in the futex for each */
+	for (seq = 0; seq < TEST_BRIDGE_REQUESTS && !failed; seq++)
+	{
+		mode = seq & 2 ? ON : OFF;
+		if (FAILED(Bridge_clientPost(p_shm, client, seq, seq & 1 ?
+				BRIDGE_REQ_GET_STATE : BRIDGE_REQ_SET_MODE, mode)) ||
+			FAILED(Bridge_clientWait(p_shm, client, &rsp, TEST_BRIDGE_WAIT_US)) ||
+			rsp.seq != seq || RESULT_OK != rsp.result || rsp.value != mode)
+			failed = 1;
+	}
+	Bridge_clientDetach(p_shm, client);
+	return failed;
+}
+#endif
+/* Token bucket refill period of the rate limit test */
+#define TEST_REFILL_PERIOD pdMS_TO_TICKS( 100UL )
+#define TEST_REFILL_CALLS 4
+static U32 test_paced_calls;
+T_RESULT Test_cb_paced(void * p) {
+	test_paced_calls++;
+	return RESULT_OK;
+}
+/* Second scheduler on the main thread for the round robin test */
+DECLARE_SCHEDULER(test_scheduler, MAX_SCHEDULER_QUEUE_ENTRIES);
+#define TEST_DRR_CALLS_A 4
+#define TEST_DRR_CALLS_B 8
+static char test_call_order[TEST_DRR_CALLS_A + TEST_DRR_CALLS_B + 1];
+static U32 test_call_len;
+T_RESULT Test_cb_order(void * p) {
+	test_call_order[test_call_len++] = *(const char *)p;
+	return RESULT_OK;
+}
+/* Scheduler callback running on the main thread, calling back into the
+ * same scheduler */
+T_RESULT Test_cb_nested(void * p) {
+	return Scheduler_run(main_scheduler, Test_cb3, (void *)"PASSED: Scheduler_run nested\n");
+}
+/* Priority inheritance test - a hog above the driver thread spins while a
+ * high priority task calls Scheduler_run */
+#define TEST_HOG_TICKS pdMS_TO_TICKS( 200UL )
+static void Test_hog_task(void * p) {
+	TickType_t start = xTaskGetTickCount();
+	while (xTaskGetTickCount() - start < TEST_HOG_TICKS)
+		;
+	vTaskDelete(NULL);
+}
+static void Test_high_prio_caller_task(void * p) {
+	TickType_t start;
+	/* let the hog take the CPU first */
+	vTaskDelay(2);
+	start = xTaskGetTickCount();
+	Scheduler_run(main_scheduler, Test_cb3, (void *)"PASSED: Scheduler_run high priority caller\n");
+	start = xTaskGetTickCount() - start;
+	if (start < TEST_HOG_TICKS / 2)
+		printf("PASSED: Round trip under contention %d ticks\n", start);
+	else
+		printf("FAILED: Round trip under contention %d ticks\n", start);
+	vTaskDelete(NULL);
+}
+/* Runs above the driver thread, posts while it works through the backlog */
+static void Test_urgent_poster_task(void * p) {
+	T_GET_STATE_EVENT event;
+	vTaskDelay(2);
+	event.completion_callback = Test_cb_lane_urgent_timed;
+	event.device = NULL;
+	test_lane_urgent_post = OsGetCycles();
+	Thread_send_event_prio(main_thread, THREAD_GET_STATE, &event,
+		sizeof(event), THREAD_EVENT_SEND_OPTION_DO_NOT_OR,
+		THREAD_EVENT_PRIORITY_URGENT);
+	vTaskDelete(NULL);
+}
+static U32 test_missed_calls;
+/* Idle time before clock gating in the power management test */
+#define TEST_POW_IDLE pdMS_TO_TICKS( 50UL )
+/* Interrupt generator load in the simulated device test */
+#define TEST_SIM_IRQ_RATE 100000
+#define TEST_SIM_RUN pdMS_TO_TICKS( 200UL )
+/* Rate sweep of the saturation test, doubled from TEST_SIM_IRQ_RATE */
+#define TEST_SIM_SWEEP_MAX 3200000
+#define TEST_SIM_SWEEP_RUN pdMS_TO_TICKS( 50UL )
+/* Set while the generator floods the driver with timeout IRQs */
+static BOOL test_quiet_timeout;
+/* Load of the multi producer stress test */
+#define TEST_STRESS_PRODUCERS 4
+#define TEST_STRESS_RUN pdMS_TO_TICKS( 500UL )
+/* Grant refilled every tick, far above what the producers post */
+#define TEST_STRESS_GRANT 1000
+T_RESULT Test_cb_sync(void * p) {
+	return RESULT_OK;
+}
+void Test_cb_missed(T_SCHEDULER_CALLBACK func, void * p, U32 lateness) {
+	test_missed_calls++;
+}
+/* Timer wheel test - one shot timers spread over three wheel levels, every
+ * other one stopped again, and a periodic timer stopping itself */
+#define TEST_TIMERS 1000
+#define TEST_TIMER_SPAN 5000
+#define TEST_TIMER_PERIOD 7
+#define TEST_TIMER_PERIODS 100
+static T_THREAD_TIMER test_timer[TEST_TIMERS];
+static T_THREAD_TIMER test_timer_periodic;
+static U32 test_timer_fired;
+static U32 test_timer_late;
+static U32 test_timer_periods;
+void Test_cb_timer(void * p) {
+	T_THREAD_TIMER *timer = (T_THREAD_TIMER *)p;
+
+	test_timer_fired++;
+	if (OsGetTimestamp() != timer->expiry)
+		test_timer_late++;
+}
+void Test_cb_timer_periodic(void * p) {
+	T_THREAD_TIMER *timer = (T_THREAD_TIMER *)p;
+
+	/* already re-armed, one period on from the expiry being delivered */
+	if (OsGetTimestamp() != timer->expiry - TEST_TIMER_PERIOD)
+		test_timer_late++;
+	if (++test_timer_periods == TEST_TIMER_PERIODS)
+		Thread_timer_stop(main_thread, timer);
+}
+/* Budget test - budget of a scheduler call, a call over it and one past the
+ * watchdog limit */
+#define TEST_BUDGET_TICKS 2
+#define TEST_SLOW_TICKS 5
+#define TEST_HANG_TICKS (MAIN_WATCHDOG_LIMIT_TICKS + 2 * MAIN_WATCHDOG_PERIOD)
+T_RESULT Test_cb_slow(void * p) {
+	U32 start = OsGetTimestamp();
+
+	while (OsGetTimestamp() - start < (U32)(uintptr_t)p)
+		;
+	return RESULT_OK;
+}
+static void TimerCallback(void * p)
+{
+	/* This is the software timer callback function. It runs on the driver
+	thread every two seconds, started from the expiry and not from the last
+	callback, so the period does not drift. */
+	(void)p;
+
+	printf("Call Back - software timer\r\n");
+
+	if (Main_init_done)
+		Test_simulate_SW_TIMER_interrupt_generation();
 }
 /*-----------------------------------------------------------*/
 
@@ -90,6 +602,9 @@ static void testTask(void *pvParameters)
 	(void)pvParameters;
 
 	t_base_cfg cfg = { .mode = ON };
+	T_GET_STATE_EVENT state_event;
+	T_MAIN_STATE_SNAPSHOT snapshot;
+	U32 i, prio;
 
 	Main_reqSetMode(&cfg, Test_cb1, (void *)"PASSED: Drv Set Mode : ON \n");
 	Main_getState(Test_cb2);
@@ -124,29 +639,1055 @@ static void testTask(void *pvParameters)
 		printf("Failed : Scheduler_run_async 4\n");
 	Scheduler_grant(main_scheduler, SCHEDULER_GRANT_1);
 
+	/* Priority lane test - an urgent event overtakes a queued normal burst */
+	vTaskSuspend(main_thread->event_thread_id);
+	for (i = 0; i < TEST_LANE_BURST; i++)
+		Main_getState(Test_cb_lane_normal);
+	state_event.completion_callback = Test_cb_lane_urgent;
+	state_event.device = NULL;
+	Thread_send_event_prio(main_thread, THREAD_GET_STATE, &state_event,
+		sizeof(state_event), THREAD_EVENT_SEND_OPTION_DO_NOT_OR,
+		THREAD_EVENT_PRIORITY_URGENT);
+	vTaskResume(main_thread->event_thread_id);
+	if (1 == test_lane_urgent_seq)
+		printf("PASSED: Urgent lane served before %d queued events\n", TEST_LANE_BURST);
+	else
+		printf("FAILED: Urgent lane served at position %d\n", test_lane_urgent_seq);
+	for (prio = 0; prio < THREAD_EVENT_PRIORITY_MAX; prio++)
+		printf("Lane %d : events %d latency max %d total %d ticks\n", prio,
+			main_thread->lane[prio].stat.events,
+			main_thread->lane[prio].stat.latency_max,
+			main_thread->lane[prio].stat.latency_total);
+
+	/* Urgent latency under a bulk backlog - a task above the driver thread
+	 * posts while the thread works through slow normal events */
+	vTaskSuspend(main_thread->event_thread_id);
+	for (i = 0; i < TEST_LANE_BACKLOG; i++)
+		Main_getState(Test_cb_lane_slow);
+	Test_task_create(Test_urgent_poster_task, "Urgent", main_TASK_PRIORITY + 1, TEST_TASK_URGENT);
+	vTaskResume(main_thread->event_thread_id);
+	if (TEST_LANE_BACKLOG == test_lane_backlog_done && test_lane_urgent_behind &&
+		test_lane_urgent_latency <= 2 * TEST_LANE_WORK)
+		printf("PASSED: Urgent latency %d cycles with %d of %d backlog events left\n",
+			test_lane_urgent_latency, test_lane_urgent_behind, TEST_LANE_BACKLOG);
+	else
+		printf("FAILED: Urgent latency %d cycles, %d backlog events left, %d done\n",
+			test_lane_urgent_latency, test_lane_urgent_behind, test_lane_backlog_done);
+	printf("Lane %d : latency max %d ticks under the backlog\n", THREAD_EVENT_PRIORITY_NORMAL,
+		main_thread->lane[THREAD_EVENT_PRIORITY_NORMAL].stat.latency_max);
+
+	/* Lane overrun - a full lane rejects the post and keeps its events */
+	{
+		U32 accepted, seq = test_lane_seq;
+		T_RESULT result = RESULT_OK;
+
+		vTaskSuspend(main_thread->event_thread_id);
+		state_event.completion_callback = Test_cb_lane_normal;
+		for (accepted = 0; accepted < MAX_THREAD_EVENT_ENTRIES; accepted++)
+		{
+			result = Thread_send_event_prio(main_thread, THREAD_GET_STATE, &state_event,
+				sizeof(state_event), THREAD_EVENT_SEND_OPTION_DO_NOT_OR,
+				THREAD_EVENT_PRIORITY_NORMAL);
+			if (FAILED(result))
+				break;
+		}
+		vTaskResume(main_thread->event_thread_id);
+		if (RESULT_NO_RESOURCES_AVAILABLE == result &&
+			MAX_THREAD_EVENT_ENTRIES - 1 == accepted && accepted == test_lane_seq - seq)
+			printf("PASSED: Full lane rejects post %d, %d queued events served\n",
+				accepted + 1, accepted);
+		else
+			printf("FAILED: Full lane result %d accepted %d served %d\n",
+				result, accepted, test_lane_seq - seq);
+	}
+
+	/* Cancel test - queued SET_CFG events not marked keep are dropped unseen */
+	test_cancel_done = 0;
+	vTaskSuspend(main_thread->event_thread_id);
+	for (i = 0; i < TEST_CANCEL_EVENTS; i++)
+		Main_reqSetMode(&cfg, Test_cb_cancel,
+			(i % TEST_CANCEL_KEEP_EVERY) ? NULL : (void *)"keep");
+	{
+		U32 cancelled = Thread_cancel_events(main_thread, Test_is_cancelled, NULL);
+
+		vTaskResume(main_thread->event_thread_id);
+		Main_getState(Test_cb2);
+		if (TEST_CANCEL_EVENTS - TEST_CANCEL_EVENTS / TEST_CANCEL_KEEP_EVERY == cancelled &&
+			TEST_CANCEL_EVENTS / TEST_CANCEL_KEEP_EVERY == test_cancel_done)
+			printf("PASSED: Cancel %d queued events, %d kept\n", cancelled, test_cancel_done);
+		else
+			printf("FAILED: Cancel %d events, %d completed\n", cancelled, test_cancel_done);
+	}
+
+	/* Cancelling a coalesced IRQ event must not swallow the next IRQ */
+	{
+		U32 cancelled;
+
+		test_quiet_timeout = TRUE;
+		vTaskSuspend(main_thread->event_thread_id);
+		Test_simulate_SW_TIMER_interrupt_generation();
+		cancelled = Thread_cancel_events(main_thread, Test_is_timeout, NULL);
+		Test_simulate_SW_TIMER_interrupt_generation();
+		vTaskResume(main_thread->event_thread_id);
+		vTaskDelay(1);
+		test_quiet_timeout = FALSE;
+		if (1 == cancelled && !main_device.isr.pending)
+			printf("PASSED: Cancelled IRQ event, next IRQ handled\n");
+		else
+			printf("FAILED: Cancelled %d IRQ events, next IRQ %s\n", cancelled,
+				main_device.isr.pending ? "lost" : "handled");
+	}
+
+	/* TTL test - after a stall the stale posts complete as expired, the
+	 * ones without a TTL are still handled */
+	{
+		U32 expired = main_thread->lane[THREAD_EVENT_PRIORITY_NORMAL].stat.expired;
+
+		Thread_set_ttl(main_thread, THREAD_EVENT_SET_CFG, TEST_TTL_TICKS);
+		vTaskSuspend(main_thread->event_thread_id);
+		Main_getStateTtl(Test_cb_ttl, TEST_TTL_TICKS);
+		Main_getState(Test_cb_ttl);
+		Main_reqSetMode(&cfg, Test_cb_ttl_cfg, NULL);
+		vTaskDelay(TEST_TTL_STALL_TICKS);
+		vTaskResume(main_thread->event_thread_id);
+		Thread_set_ttl(main_thread, THREAD_EVENT_SET_CFG, 0);
+		Main_getStateTtl(Test_cb_ttl, TEST_TTL_TICKS);
+		expired = main_thread->lane[THREAD_EVENT_PRIORITY_NORMAL].stat.expired - expired;
+		if (2 == expired && 1 == test_ttl_expired && 2 == test_ttl_fresh &&
+			1 == test_ttl_cfg_done)
+			printf("PASSED: TTL %d stale events expired, %d fresh handled\n",
+				expired, test_ttl_fresh);
+		else
+			printf("FAILED: TTL %d expired, %d/%d state, %d cfg\n", expired,
+				test_ttl_expired, test_ttl_fresh, test_ttl_cfg_done);
+	}
+
+	/* Token bucket test - calls are paced by the refill instead of grants.
+	 * Power cycle to resume the suspended scheduler with a fresh queue. */
+	cfg.mode = OFF;
+	Main_reqSetMode(&cfg, NULL, NULL);
+	cfg.mode = ON;
+	Main_reqSetMode(&cfg, NULL, NULL);
+	Scheduler_set_rate(main_scheduler, SCHEDULER_GRANT_1, TEST_REFILL_PERIOD, 2);
+	for (i = 0; i < TEST_REFILL_CALLS; i++)
+		Scheduler_run_async(main_scheduler, Test_cb_paced, NULL);
+	vTaskDelay((TEST_REFILL_CALLS + 1) * TEST_REFILL_PERIOD);
+	if (TEST_REFILL_CALLS == test_paced_calls)
+		printf("PASSED: Token bucket refill ran %d calls\n", test_paced_calls);
+	else
+		printf("FAILED: Token bucket refill ran %d calls\n", test_paced_calls);
+	printf("Scheduler : starved %d time %d max %d ticks\n",
+		main_scheduler->stat.starved, main_scheduler->stat.starved_time,
+		main_scheduler->stat.starved_time_max);
+	Scheduler_set_rate(main_scheduler, 0, 0, 0);
+
+	/* Round robin test - main_scheduler (share 1) and test_scheduler
+	 * (share 2) queue calls while the main thread is held */
+	Scheduler_init(test_scheduler, main_thread, TEST_DRR_CALLS_B);
+	Scheduler_set_share(test_scheduler, 2);
+	vTaskSuspend(main_thread->event_thread_id);
+	Scheduler_grant(main_scheduler, TEST_DRR_CALLS_A);
+	for (i = 0; i < TEST_DRR_CALLS_A; i++)
+		Scheduler_run_async(main_scheduler, Test_cb_order, (void *)"A");
+	for (i = 0; i < TEST_DRR_CALLS_B; i++)
+		Scheduler_run_async(test_scheduler, Test_cb_order, (void *)"B");
+	vTaskResume(main_thread->event_thread_id);
+	if (0 == strcmp(test_call_order, "BBABBABBABBA"))
+		printf("PASSED: Round robin order %s\n", test_call_order);
+	else
+		printf("FAILED: Round robin order %s\n", test_call_order);
+	printf("Scheduler A : calls %d wait max %d, B : calls %d wait max %d ticks\n",
+		main_scheduler->stat.calls, main_scheduler->stat.wait_time_max,
+		test_scheduler->stat.calls, test_scheduler->stat.wait_time_max);
+
+	/* Nested Scheduler_run from the scheduler thread runs inline */
+	Scheduler_grant(main_scheduler, 2);
+	if (FAILED(Scheduler_run(main_scheduler, Test_cb_nested, NULL)))
+		printf("FAILED : Scheduler_run nested\n");
+
+	/* Argument copy test - the caller's buffer is overwritten before the
+	 * queued calls run, small copies stay in the slot, large ones in the pool */
+	vTaskSuspend(main_thread->event_thread_id);
+	Scheduler_grant(main_scheduler, 2);
+	{
+		char args[64];
+		T_SCHEDULER_CALL_PARAMS params = { .cost = SCHEDULER_GRANT_1 };
+
+		strcpy(args, "PASSED: inline args\n");
+		params.args_size = strlen(args) + 1;
+		Scheduler_run_async_ex(main_scheduler, Test_cb3, args, &params);
+		strcpy(args, "PASSED: Scheduler_run_async pooled args\n");
+		params.args_size = strlen(args) + 1;
+		Scheduler_run_async_ex(main_scheduler, Test_cb3, args, &params);
+		strcpy(args, "FAILED: args not copied\n");
+	}
+	vTaskResume(main_thread->event_thread_id);
+
+	/* Priority inheritance test */
+	Scheduler_grant(main_scheduler, 1);
+	Test_task_create(Test_hog_task, "Hog", main_TASK_PRIORITY + 1, TEST_TASK_HOG);
+	Test_task_create(Test_high_prio_caller_task, "HighPrio", main_TASK_PRIORITY + 2, TEST_TASK_HIGH_PRIO);
+	vTaskDelay(TEST_HOG_TICKS + 10);
+
+#if defined(DRV_STATIC_ALLOC) && defined(OS_SIM)
+	/* Zero heap test - nothing allocated since boot, blocking calls and
+	 * the refill timer use reserved storage */
+	{
+		U32 allocs = OsSim_heapAllocs();
+		U32 done = 0;
+
+		Scheduler_grant(main_scheduler, TEST_ZERO_HEAP_CALLS);
+		for (i = 0; i < TEST_ZERO_HEAP_CALLS; i++)
+		{
+			if (RESULT_OK == Scheduler_run(main_scheduler, Test_cb_sync, NULL))
+				done++;
+		}
+		Scheduler_set_rate(main_scheduler, 1, 1, 1);
+		Scheduler_set_rate(main_scheduler, 0, 0, 0);
+		if (!allocs && !OsSim_heapAllocs() && TEST_ZERO_HEAP_CALLS == done)
+			printf("PASSED: Zero heap, %d blocking calls, thread %d scheduler %d bytes\n",
+				done, (int)sizeof(T_THREAD), (int)sizeof(T_SCHEDULER));
+		else
+			printf("FAILED: Zero heap, %d allocations, %d of %d calls\n",
+				OsSim_heapAllocs(), done, TEST_ZERO_HEAP_CALLS);
+	}
+#endif
+
+	/* Config transaction test - the unchanged mode is skipped, the clock
+	 * is applied, one completion for both */
+	{
+		static const t_base_cfg trans_cfg = { .mode = ON, .clock = 2 };
+		static const T_CFG_TRANSACTION transaction = { 2, {
+			{ .cfg.P_MODE = &trans_cfg, .cfg_type = CFG_SET_MODE },
+			{ .cfg.P_MODE = &trans_cfg, .cfg_type = CFG_SET_CLOCK } } };
+
+		static const T_CFG_TRANSACTION too_long = { .count = MAX_CFG_TRANSACTION_ITEMS + 1 };
+
+		Main_reqSetConfigTransaction(&transaction, Test_cb1,
+			(void *)"PASSED: Config transaction\n");
+		if (RESULT_PARAMETER_ERROR == Main_reqSetConfigTransaction(NULL, Test_cb1,
+				(void *)"FAILED: Config transaction NULL completed\n") &&
+			RESULT_PARAMETER_ERROR == Main_reqSetConfigTransaction(&too_long, Test_cb1,
+				(void *)"FAILED: Config transaction too long completed\n"))
+			printf("PASSED: Config transaction parameters checked\n");
+		else
+			printf("FAILED: Config transaction parameters not checked\n");
+	}
+
+	/* EDF test - deadline calls overtake a bulk call, a late call is dropped */
+	Scheduler_set_order(test_scheduler, SCHEDULER_ORDER_EDF, TRUE, Test_cb_missed);
+	memset(test_call_order, 0x00, sizeof(test_call_order));
+	test_call_len = 0;
+	vTaskSuspend(main_thread->event_thread_id);
+	Scheduler_grant(test_scheduler, 4);
+	Scheduler_run_async(test_scheduler, Test_cb_order, (void *)"H");
+	{
+		T_SCHEDULER_CALL_PARAMS params = { .cost = SCHEDULER_GRANT_1, .deadline = 50 };
+		Scheduler_run_async_ex(test_scheduler, Test_cb_order, (void *)"C", &params);
+		params.deadline = 20;
+		Scheduler_run_async_ex(test_scheduler, Test_cb_order, (void *)"U", &params);
+		params.deadline = 1;
+		Scheduler_run_async_ex(test_scheduler, Test_cb_order, (void *)"L", &params);
+	}
+	vTaskDelay(5);
+	vTaskResume(main_thread->event_thread_id);
+	if (0 == strcmp(test_call_order, "UCH") && 1 == test_missed_calls)
+		printf("PASSED: EDF order %s, late calls dropped %d\n", test_call_order,
+			test_scheduler->stat.deadline_dropped);
+	else
+		printf("FAILED: EDF order %s, late calls missed %d\n", test_call_order,
+			test_missed_calls);
+
+	/* Power management test - idle steps down to retention, the next
+	 * event restores full power. The short stay in retention doubles the
+	 * thresholds, the next idle period only reaches clock gating and stays
+	 * long enough there to halve them again. */
+	{
+		static const T_POW_POLICY policy = { { 0, TEST_POW_IDLE, 2 * TEST_POW_IDLE, 0 } };
+		static const T_POW_POLICY no_policy = { { 0 } };
+		T_POW_LEVEL idle_level, backoff_level;
+		T_POW_STAT pow_stat, backoff_stat;
+
+		Main_reqSetPowerPolicy(&policy, NULL, NULL);
+		vTaskDelay(3 * TEST_POW_IDLE);
+		idle_level = Pow_getLevel(&main_device.pow);
+		Main_getState(NULL);
+		Pow_getStat(&main_device.pow, &pow_stat);
+		if (POW_LEVEL_RETENTION == idle_level && POW_LEVEL_ON == pow_stat.level)
+			printf("PASSED: Idle power down to level %d and wake\n", idle_level);
+		else
+			printf("FAILED: Idle power level %d, after wake %d\n", idle_level, pow_stat.level);
+
+		vTaskDelay(3 * TEST_POW_IDLE + TEST_POW_IDLE / 2);
+		backoff_level = Pow_getLevel(&main_device.pow);
+		Main_getState(NULL);
+		Pow_getStat(&main_device.pow, &backoff_stat);
+		if (1 == pow_stat.backoff && POW_LEVEL_CLOCK_GATED == backoff_level &&
+			0 == backoff_stat.backoff && !backoff_stat.wake_timeouts
+#if defined(DRV_HW_SIM)
+			&& pow_stat.wake_latency_max >= HWSIM_EXIT_LATENCY_RETENTION &&
+			backoff_stat.wake_latency_total - pow_stat.wake_latency_total >=
+				HWSIM_EXIT_LATENCY_GATED &&
+			backoff_stat.wake_latency_total - pow_stat.wake_latency_total <
+				HWSIM_EXIT_LATENCY_RETENTION
+#endif
+			)
+			printf("PASSED: Power backoff up and down, wake latency %d ticks\n",
+				backoff_stat.wake_latency_max);
+		else
+			printf("FAILED: Power backoff %d then level %d backoff %d, latency %d %d\n",
+				pow_stat.backoff, backoff_level, backoff_stat.backoff,
+				pow_stat.wake_latency_max,
+				backoff_stat.wake_latency_total - pow_stat.wake_latency_total);
+		printf("Power : wakeups %d latency max %d, residency on %d gated %d retention %d ticks\n",
+			backoff_stat.wakeups, backoff_stat.wake_latency_max,
+			backoff_stat.residency[POW_LEVEL_ON], backoff_stat.residency[POW_LEVEL_CLOCK_GATED],
+			backoff_stat.residency[POW_LEVEL_RETENTION]);
+		Main_reqSetPowerPolicy(&no_policy, NULL, NULL);
+	}
+
+#if defined(DRV_HW_SIM)
+	/* Simulated device test - the interrupt generator drives the event
+	 * loop, every raised IRQ ends up serviced or coalesced */
+	{
+		static const T_HWSIM_IRQ_CFG irq_cfg = { TEST_SIM_IRQ_RATE, 4, 50, 1, HW_REG_BASE };
+		U32 expected = TEST_SIM_IRQ_RATE / configTICK_RATE_HZ * TEST_SIM_RUN;
+		U32 isr_calls = main_device.hw.stat.irq_timeout;
+		U32 spin_hits = main_thread->stat.spin_hits;
+		T_HWSIM_STAT sim_stat;
+
+		/* the driver thread polls between IRQs, posts have to reach it
+		 * while it spins */
+		test_quiet_timeout = TRUE;
+		main_thread->wait_mode = THREAD_WAIT_MODE_ADAPTIVE;
+		HwSim_startIrq(&irq_cfg);
+		vTaskDelay(TEST_SIM_RUN);
+		HwSim_stopIrq();
+		main_thread->wait_mode = THREAD_WAIT_MODE_BLOCK;
+		spin_hits = main_thread->stat.spin_hits - spin_hits;
+		/* the driver thread has handled the last timeout event once this
+		 * call made it through the same lane */
+		Scheduler_grant(main_scheduler, SCHEDULER_GRANT_1);
+		Scheduler_run(main_scheduler, Test_cb_sync, NULL);
+		test_quiet_timeout = FALSE;
+
+		HwSim_getStat(HW_REG_BASE, &sim_stat);
+		if (!sim_stat.irq_pending &&
+			sim_stat.irq_raised == sim_stat.irq_serviced + sim_stat.irq_coalesced &&
+			sim_stat.irq_raised > expected - expected / 5 &&
+			sim_stat.irq_raised < expected + expected / 5)
+			printf("PASSED: Simulated IRQs raised %d serviced %d coalesced %d\n",
+				sim_stat.irq_raised, sim_stat.irq_serviced, sim_stat.irq_coalesced);
+		else
+			printf("FAILED: Simulated IRQs raised %d (%d expected) serviced %d coalesced %d pending %x\n",
+				sim_stat.irq_raised, expected, sim_stat.irq_serviced,
+				sim_stat.irq_coalesced, sim_stat.irq_pending);
+		printf("Sim : %d bursts, %d ISR calls, %d not ready accesses\n",
+			sim_stat.bursts, main_device.hw.stat.irq_timeout - isr_calls, sim_stat.not_ready);
+		if (spin_hits)
+			printf("PASSED: Spinning driver thread caught %d posts, %d wakeups skipped\n",
+				spin_hits, main_thread->stat.wakeups_skipped);
+		else
+			printf("FAILED: Spinning driver thread caught no post\n");
+	}
+
+	/* Saturation test - double the offered rate until the generator falls
+	 * behind by more than 10 %, the interrupt load then takes the core */
+	{
+		static const T_HWSIM_IRQ_CFG base_cfg = { TEST_SIM_IRQ_RATE, 1, 0, 1, HW_REG_BASE };
+		T_HWSIM_IRQ_CFG sweep_cfg = base_cfg;
+		T_HWSIM_STAT before, after;
+		U32 saturation = 0, peak = 0;
+		U32 events, achieved;
+		TickType_t ticks;
+
+		test_quiet_timeout = TRUE;
+		for (; sweep_cfg.rate <= TEST_SIM_SWEEP_MAX && !saturation; sweep_cfg.rate *= 2)
+		{
+			/* the previous generator exits on its next wake up */
+			while (RESULT_WRONG_STATE == HwSim_startIrq(&sweep_cfg))
+				vTaskDelay(1);
+			HwSim_getStat(HW_REG_BASE, &before);
+			events = main_device.hw.stat.irq_timeout;
+			ticks = xTaskGetTickCount();
+			vTaskDelay(TEST_SIM_SWEEP_RUN);
+			HwSim_stopIrq();
+			HwSim_getStat(HW_REG_BASE, &after);
+			ticks = xTaskGetTickCount() - ticks;
+			events = main_device.hw.stat.irq_timeout - events;
+			achieved = (after.irq_raised - before.irq_raised) / ticks * configTICK_RATE_HZ;
+			printf("Sim : %d IRQ/s offered, %d/s raised, %d/s ISR calls\n",
+				sweep_cfg.rate, achieved, events / ticks * configTICK_RATE_HZ);
+			if (achieved < sweep_cfg.rate - sweep_cfg.rate / 10)
+				saturation = sweep_cfg.rate;
+			if (achieved > peak)
+				peak = achieved;
+		}
+		Scheduler_grant(main_scheduler, SCHEDULER_GRANT_1);
+		Scheduler_run(main_scheduler, Test_cb_sync, NULL);
+		test_quiet_timeout = FALSE;
+
+		HwSim_getStat(HW_REG_BASE, &after);
+		if (saturation && !after.irq_pending &&
+			after.irq_raised == after.irq_serviced + after.irq_coalesced)
+			printf("PASSED: Simulated IRQ load saturates at %d IRQ/s offered, %d/s sustained\n",
+				saturation, peak);
+		else
+			printf("FAILED: Simulated IRQ load saturation %d, pending %x\n",
+				saturation, after.irq_pending);
+	}
+#endif
+
+	/* Timer wheel test */
+	{
+		U32 stopped = 0;
+		U32 cascaded = main_thread->timers.stat.cascaded;
+
+		for (i = 0; i < TEST_TIMERS; i++)
+		{
+			test_timer[i].callback = Test_cb_timer;
+			test_timer[i].p_data = &test_timer[i];
+			Thread_timer_start(main_thread, &test_timer[i],
+				1 + (i * 7919) % TEST_TIMER_SPAN, 0);
+		}
+		for (i = 0; i < TEST_TIMERS; i += 2)
+		{
+			if (RESULT_OK == Thread_timer_stop(main_thread, &test_timer[i]))
+				stopped++;
+		}
+		test_timer_periodic.callback = Test_cb_timer_periodic;
+		test_timer_periodic.p_data = &test_timer_periodic;
+		Thread_timer_start(main_thread, &test_timer_periodic,
+			TEST_TIMER_PERIOD, TEST_TIMER_PERIOD);
+
+		vTaskDelay(TEST_TIMER_SPAN + 1);
+		if (TEST_TIMERS - stopped == test_timer_fired &&
+			TEST_TIMER_PERIODS == test_timer_periods && !test_timer_late &&
+			RESULT_NOT_HANDLED == Thread_timer_stop(main_thread, &test_timer_periodic))
+			printf("PASSED: Timer wheel %d expiries on time, %d refiled\n",
+				test_timer_fired + test_timer_periods,
+				main_thread->timers.stat.cascaded - cascaded);
+		else
+			printf("FAILED: Timer wheel fired %d of %d, periods %d, late %d\n",
+				test_timer_fired, TEST_TIMERS - stopped, test_timer_periods,
+				test_timer_late);
+	}
+
+	/* Budget test - scheduler calls over the budget are reported by name,
+	 * the one spinning past the watchdog limit as hung too */
+	{
+		T_THREAD_ACCOUNT account = { 0 };
+		T_THREAD_ACCOUNT hdlr_before = { 0 }, hdlr_after = { 0 };
+		U32 hangs = main_thread->stat.hangs;
+		U32 overruns = main_thread->stat.overruns;
+		U32 account_full = main_thread->stat.account_full;
+		BOOL accounted;
+
+		Thread_get_account(main_thread, (T_THREAD_FUNC)Scheduler_event_hdlr, &hdlr_before);
+		Thread_set_budget(main_thread, THREAD_EVENT_SCHED_RUN,
+			TEST_BUDGET_TICKS * OS_CYCLES_PER_TICK);
+		Scheduler_grant(main_scheduler, 2);
+		Scheduler_run(main_scheduler, Test_cb_slow, (void *)(uintptr_t)TEST_SLOW_TICKS);
+		Scheduler_run(main_scheduler, Test_cb_slow, (void *)(uintptr_t)TEST_HANG_TICKS);
+		Thread_set_budget(main_thread, THREAD_EVENT_SCHED_RUN, 0);
+
+		accounted = SUCCEEDED(Thread_get_account(main_thread,
+			(T_THREAD_FUNC)Test_cb_slow, &account));
+		Thread_get_account(main_thread, (T_THREAD_FUNC)Scheduler_event_hdlr, &hdlr_after);
+		overruns = main_thread->stat.overruns - overruns;
+		account_full = main_thread->stat.account_full - account_full;
+		/* the handler's self time leaves out the slow calls it made; with
+		 * the account table full the thread still counts the overruns */
+		if ((accounted ? 2 == account.calls && 2 == account.overruns :
+				account_full >= 2 && 2 == overruns) &&
+			hangs + 1 == main_thread->stat.hangs &&
+			hdlr_before.overruns == hdlr_after.overruns)
+		{
+			if (accounted)
+				printf("PASSED: Budget %d overruns, 1 hang, slowest call %d cycles\n",
+					overruns, account.cycles_max);
+			else
+				printf("PASSED: Budget %d overruns, 1 hang, account table full\n",
+					overruns);
+		}
+		else
+			printf("FAILED: Budget calls %d overruns %d/%d hangs %d handler overruns %d, %d unaccounted\n",
+				account.calls, account.overruns, overruns, main_thread->stat.hangs - hangs,
+				hdlr_after.overruns - hdlr_before.overruns, account_full);
+	}
+
+	/* Export test - size, age and back pressure */
+	{
+		T_EXPORT_SINK sink = { Test_export_write, NULL };
+		U32 records = main_export.stat.records;
+		U32 dropped = main_export.stat.dropped;
+		U32 by_age = main_export.stat.by_age;
+
+		memset(&test_export, 0, sizeof(test_export));
+		Main_setExportSink(&sink);
+		for (i = 0; i < TEST_EXPORT_EVENTS; i++)
+			Main_getState(NULL);
+		Test_export_wait();
+		records = main_export.stat.records - records;
+		if (test_export.synced && records > TEST_EXPORT_EVENTS &&
+			records == test_export.records + 1 && !test_export.missing &&
+			!test_export.order_errors &&
+			test_export.batches > records * (sizeof(T_EXPORT_RECORD) +
+				sizeof(T_MAIN_STATE_SNAPSHOT)) / EXPORT_BUFFER_SIZE)
+			printf("PASSED: Export %d records in %d batches\n",
+				test_export.records, test_export.batches);
+		else
+			printf("FAILED: Export %d of %d records, %d batches, %d missing, %d order errors\n",
+				test_export.records, records, test_export.batches,
+				test_export.missing, test_export.order_errors);
+
+		/* a lone record leaves by age */
+		records = test_export.records;
+		Main_getState(NULL);
+		vTaskDelay(MAIN_EXPORT_FLUSH_AGE + 2);
+		if (main_export.stat.by_age > by_age && test_export.records > records)
+			printf("PASSED: Export flushed by age after %d ticks\n", MAIN_EXPORT_FLUSH_AGE);
+		else
+			printf("FAILED: Export age flush %d records\n", test_export.records - records);
+
+		memset(&test_export, 0, sizeof(test_export));
+		test_export.slow = TEST_EXPORT_SLOW_TICKS;
+		records = main_export.stat.records;
+		for (i = 0; i < TEST_EXPORT_BURST; i++)
+			Main_getState(NULL);
+		Test_export_wait();
+		/* a record after the burst shows the dropped ones as a gap */
+		test_export.synced = FALSE;
+		Main_getState(NULL);
+		Test_export_wait();
+		records = main_export.stat.records - records;
+		dropped = main_export.stat.dropped - dropped;
+		if (test_export.synced && dropped && records == test_export.records + 1 &&
+			dropped == test_export.missing && !test_export.order_errors)
+			printf("PASSED: Export back pressure %d records dropped, %d written\n",
+				dropped, test_export.records);
+		else
+			printf("FAILED: Export back pressure %d dropped, %d missing, %d of %d records\n",
+				dropped, test_export.missing, test_export.records, records);
+
+		/* write out the last state before the sink goes */
+		test_export.synced = FALSE;
+		Export_flush(&main_export, Test_cb_export_synced, NULL);
+		while (!test_export.synced)
+			vTaskDelay(1);
+		Main_setExportSink(NULL);
+	}
+
+	/* Record test - every round posts a configuration, a state request, a
+	 * scheduler call and an IRQ; replays post them again */
+	{
+		T_RECORD_CFG record_cfg = { { 0 }, { 0 } };
+		T_RECORD_REPLAY_CFG replay_cfg = { 0 };
+		T_RECORD_STAT record_stat = { 0 };
+		T_RECORD_REPORT fast, timed;
+		T_RESULT fast_result, timed_result;
+		t_base_cfg mode = { ON, 0 };
+
+		record_cfg.threads[0] = main_thread;
+		record_cfg.sink.write = Test_record_write;
+		test_record.size = 0;
+		test_quiet_timeout = TRUE;
+		Scheduler_grant(main_scheduler, TEST_RECORD_ROUNDS);
+		Record_start(&record_cfg);
+		for (i = 0; i < TEST_RECORD_ROUNDS; i++)
+		{
+			Main_reqSetMode(&mode, NULL, NULL);
+			Main_getState(NULL);
+			Scheduler_run_async(main_scheduler, Test_cb_record, NULL);
+			Test_simulate_SW_TIMER_interrupt_generation();
+			vTaskDelay(TEST_RECORD_GAP);
+		}
+		Record_stop(&record_stat);
+
+		replay_cfg.log = test_record.log;
+		replay_cfg.size = test_record.size;
+		replay_cfg.threads[0] = main_thread;
+		replay_cfg.scheduler = main_scheduler;
+		replay_cfg.mode = RECORD_REPLAY_FAST;
+		Scheduler_grant(main_scheduler, TEST_RECORD_ROUNDS);
+		fast_result = Record_replay(&replay_cfg, &fast);
+		replay_cfg.mode = RECORD_REPLAY_TIMED;
+		Scheduler_grant(main_scheduler, TEST_RECORD_ROUNDS);
+		timed_result = Record_replay(&replay_cfg, &timed);
+		test_quiet_timeout = FALSE;
+
+		if (RESULT_OK == fast_result && RESULT_OK == timed_result &&
+			!record_stat.dropped && fast.records == record_stat.records &&
+			fast.replayed == 4 * TEST_RECORD_ROUNDS &&
+			fast.irqs == TEST_RECORD_ROUNDS &&
+			fast.completed == fast.replayed - fast.irqs &&
+			timed.completed == fast.completed &&
+			fast.duration < timed.duration && timed.duration >= timed.recorded)
+			printf("PASSED: Replay %d records, fast %d ticks, timed %d of %d ticks\n",
+				fast.replayed, fast.duration, timed.duration, timed.recorded);
+		else
+			printf("FAILED: Replay %d/%d records, %d/%d replayed, %d/%d completed, results %d %d\n",
+				fast.records, record_stat.records, fast.replayed, timed.replayed,
+				fast.completed, timed.completed, fast_result, timed_result);
+		printf("Replay latency max : fast %d timed %d cycles\n",
+			fast.latency_max, timed.latency_max);
+	}
+
+	/* Async test - power up and awaits without blocking the driver thread */
+	{
+		static const t_base_cfg off = { OFF, 0 };
+		static const t_base_cfg on = { ON, 0 };
+		U32 start;
+
+		memset(&test_async, 0, sizeof(test_async));
+		test_quiet_timeout = TRUE;
+		Main_setPowerUpAsync(TRUE);
+#if defined(DRV_HW_SIM)
+		HwSim_setPowerUpDelay(TEST_ASYNC_POWER_UP);
+#endif
+		test_async.timer.callback = Test_cb_async_timer;
+		Thread_timer_start(main_thread, &test_async.timer, TEST_ASYNC_PERIOD,
+			TEST_ASYNC_PERIOD);
+
+		Main_reqSetMode(&off, NULL, NULL);
+		start = OsGetTimestamp();
+		Main_reqSetMode(&on, Test_cb_async_on, NULL);
+		Main_getState(Test_cb_async_state);
+		vTaskDelay(1);
+		Test_simulate_SW_TIMER_interrupt_generation();
+		while (!test_async.state_time && OsGetTimestamp() - start < TEST_ASYNC_TIMEOUT)
+			vTaskDelay(1);
+		Thread_timer_stop(main_thread, &test_async.timer);
+#if defined(DRV_HW_SIM)
+		HwSim_setPowerUpDelay(HWSIM_POWER_UP_DELAY);
+#endif
+		Main_setPowerUpAsync(FALSE);
+
+		if (test_async.on_time - start >= TEST_ASYNC_POWER_UP &&
+			test_async.timer_hits >= TEST_ASYNC_POWER_UP / TEST_ASYNC_PERIOD - 1 &&
+			ON == test_async.state && test_async.state_time >= test_async.on_time)
+			printf("PASSED: Async power up %d ticks, %d timer expiries meanwhile\n",
+				test_async.on_time - start, test_async.timer_hits);
+		else
+			printf("FAILED: Async power up %d ticks, %d timer expiries, state %d\n",
+				test_async.on_time - start, test_async.timer_hits, test_async.state);
+
+		test_async.async.func = Test_async_body;
+		test_async.async.done_cb = Test_async_done;
+		Thread_async_start(main_thread, &test_async.async);
+		vTaskDelay(2);
+		start = OsGetTimestamp();
+		Test_simulate_SW_TIMER_interrupt_generation();
+		while (!test_async.done && OsGetTimestamp() - start < TEST_ASYNC_TIMEOUT)
+			vTaskDelay(1);
+		test_quiet_timeout = FALSE;
+
+		if (test_async.done && !test_async.irq_timed_out &&
+			test_async.irq_time == start && test_async.slept >= TEST_ASYNC_SLEEP &&
+			test_async.state_timed_out)
+			printf("PASSED: Async handler awaited IRQ, slept %d ticks, event timed out\n",
+				test_async.slept);
+		else
+			printf("FAILED: Async handler done %d, IRQ %d at %d, slept %d, state %d\n",
+				test_async.done, test_async.irq_timed_out, test_async.irq_time - start,
+				test_async.slept, test_async.state_timed_out);
+	}
+
+#if defined(DRV_HW_SIM)
+	/* Async power up past the timeout - the request fails without a
+	 * blocking retry, the HW is powered down and stays OFF */
+	{
+		static const t_base_cfg off = { OFF, 0 };
+		static const t_base_cfg on = { ON, 0 };
+		T_MAIN_STATE_SNAPSHOT state;
+		U32 start;
+
+		Main_setPowerUpAsync(TRUE);
+		HwSim_setPowerUpDelay(TEST_ASYNC_POWER_UP_LATE);
+		Main_reqSetMode(&off, NULL, NULL);
+		start = OsGetTimestamp();
+		test_async.late_time = 0;
+		Main_reqSetMode(&on, Test_cb_async_late, NULL);
+		while (!test_async.late_time && OsGetTimestamp() - start < TEST_ASYNC_TIMEOUT)
+			vTaskDelay(1);
+		HwSim_setPowerUpDelay(HWSIM_POWER_UP_DELAY);
+		Main_setPowerUpAsync(FALSE);
+		Main_readState(&state);
+		Main_reqSetMode(&on, NULL, NULL);
+
+		if (MAIN_CFG_FAILED == test_async.late_status && OFF == state.mode &&
+			test_async.late_time - start >= DRV_POWER_UP_TIMEOUT &&
+			test_async.late_time - start < TEST_ASYNC_POWER_UP_LATE)
+			printf("PASSED: Async power up failed after %d ticks, HW left OFF\n",
+				test_async.late_time - start);
+		else
+			printf("FAILED: Async power up past the timeout status %d mode %d after %d ticks\n",
+				test_async.late_status, state.mode, test_async.late_time - start);
+	}
+#endif
+
+	/* Completion test - the driver handles a burst of requests in one go,
+	 * the completion thread runs their callbacks in one batch */
+	{
+		static const t_base_cfg on = { ON, 0 };
+		U32 polled_early, polled, n, overflows;
+
+		memset(&test_completion, 0, sizeof(test_completion));
+		test_completion.poller = xTaskGetCurrentTaskHandle();
+		Completion_init(&test_completion_thread);
+		Main_setCompletionQueue(&test_completion_thread);
+		vTaskSuspend(main_thread->event_thread_id);
+		for (i = 0; i < TEST_COMPLETIONS; i++)
+			Main_reqSetMode(&on, Test_cb_completion, (void *)(uintptr_t)i);
+		vTaskResume(main_thread->event_thread_id);
+		for (i = 0; i < 10 && test_completion.count < TEST_COMPLETIONS; i++)
+			vTaskDelay(1);
+		if (TEST_COMPLETIONS == test_completion.on_thread && !test_completion.order_errors &&
+			1 == test_completion_thread.stat.batches)
+			printf("PASSED: Completions %d callbacks off the driver thread in %d batch\n",
+				test_completion.on_thread, test_completion_thread.stat.batches);
+		else
+			printf("FAILED: Completions %d on thread, %d on driver, %d order errors, %d batches\n",
+				test_completion.on_thread, test_completion.on_driver,
+				test_completion.order_errors, test_completion_thread.stat.batches);
+
+		memset(&test_completion, 0, sizeof(test_completion));
+		test_completion.poller = xTaskGetCurrentTaskHandle();
+		Completion_init(&test_completion_polled);
+		Main_setCompletionQueue(&test_completion_polled);
+		for (i = 0; i < TEST_COMPLETIONS; i++)
+			Main_reqSetMode(&on, Test_cb_completion, (void *)(uintptr_t)i);
+		vTaskDelay(1);
+		polled_early = test_completion.count;
+		polled = Completion_poll(&test_completion_polled, 0);
+		Main_setCompletionQueue(NULL);
+		if (!polled_early && TEST_COMPLETIONS == polled &&
+			TEST_COMPLETIONS == test_completion.on_poller && !test_completion.order_errors)
+			printf("PASSED: Completions %d callbacks polled by the requester\n", polled);
+		else
+			printf("FAILED: Completions polled %d, %d early, %d in the requester, %d order errors\n",
+				polled, polled_early, test_completion.on_poller, test_completion.order_errors);
+
+		/* nobody polls: past a full queue the driver thread runs the
+		 * oldest callbacks itself, in order with the queued ones */
+		memset(&test_completion, 0, sizeof(test_completion));
+		test_completion.poller = xTaskGetCurrentTaskHandle();
+		Main_setCompletionQueue(&test_completion_polled);
+		for (n = 0; n < TEST_COMPLETION_OVERFLOW; n += TEST_COMPLETIONS)
+		{
+			for (i = n; i < n + TEST_COMPLETIONS; i++)
+				Main_reqSetMode(&on, Test_cb_completion, (void *)(uintptr_t)i);
+			vTaskDelay(1);
+		}
+		polled = Completion_poll(&test_completion_polled, 0);
+		Main_setCompletionQueue(NULL);
+		if (TEST_COMPLETION_OVERFLOW == test_completion.count && !test_completion.order_errors &&
+			COMPLETION_QUEUE_ENTRIES == polled &&
+			TEST_COMPLETION_OVERFLOW - COMPLETION_QUEUE_ENTRIES == test_completion.on_driver)
+			printf("PASSED: Completions overflow, %d run by the driver thread in order\n",
+				test_completion.on_driver);
+		else
+			printf("FAILED: Completions overflow %d run, %d by the driver, %d polled, %d order errors\n",
+				test_completion.count, test_completion.on_driver, polled,
+				test_completion.order_errors);
+
+		/* a consumer busy in a callback does not hold up the driver
+		 * thread, past a full queue it runs the callbacks itself */
+		memset(&test_completion, 0, sizeof(test_completion));
+		test_completion.poller = xTaskGetCurrentTaskHandle();
+		overflows = test_completion_polled.stat.overflows;
+		Main_setCompletionQueue(&test_completion_polled);
+		Main_reqSetMode(&on, Test_cb_completion_hold, NULL);
+		vTaskDelay(1);
+		Completion_poll(&test_completion_polled, 0);
+		Main_setCompletionQueue(NULL);
+		if (TEST_COMPLETION_OVERFLOW == test_completion.count &&
+			TEST_COMPLETIONS == test_completion.held_on_driver &&
+			test_completion_polled.stat.overflows - overflows >= TEST_COMPLETIONS)
+			printf("PASSED: Completions busy consumer, %d run by the driver thread meanwhile\n",
+				test_completion.held_on_driver);
+		else
+			printf("FAILED: Completions busy consumer %d run, %d by the driver meanwhile\n",
+				test_completion.count, test_completion.held_on_driver);
+	}
+
+#if defined(DRV_HW_SIM)
+	/* Multi-device test - every device is configured, interrupted and
+	 * called on its own driver thread, against its own registers */
+	{
+		static const t_base_cfg on = { ON, 0 };
+		static const t_base_cfg off = { OFF, 0 };
+		static const T_POW_POLICY policy = { { 0, TEST_POW_IDLE, 2 * TEST_POW_IDLE, 0 } };
+		static const T_POW_POLICY no_policy = { { 0 } };
+		T_MAIN_STATE_SNAPSHOT state;
+		T_HWSIM_STAT sim_stat;
+		U32 n, added = 0, ok = 0, threads = 0, idle = 0;
+
+		memset(&test_dev, 0, sizeof(test_dev));
+		test_device[TEST_DEVICES - 1].scheduler = test_device_scheduler;
+		Main_setPoolThreads(TEST_POOL_THREADS);
+		for (i = 0; i < TEST_DEVICES; i++)
+			if (SUCCEEDED(Main_addDevice(&test_device[i])))
+				added++;
+		for (i = 0; i < TEST_DEVICES; i++)
+			Main_devReqSetMode(&test_device[i], &on, Test_cb_device, &test_device[i]);
+		for (i = 0; i < 10 && test_dev.done < TEST_DEVICES; i++)
+			vTaskDelay(1);
+
+		test_quiet_timeout = TRUE;
+		for (n = 0; n < TEST_DEVICE_IRQS; n++)
+		{
+			for (i = 0; i < TEST_DEVICES; i++)
+				HwSim_raiseIrq(test_device[i].reg_base, HW_IRQ_TIMEOUT);
+			vTaskDelay(1);
+		}
+		test_quiet_timeout = FALSE;
+		Scheduler_grant(test_device_scheduler, SCHEDULER_GRANT_1);
+		Scheduler_run(test_device_scheduler, Test_cb_device_call,
+			&test_device[TEST_DEVICES - 1]);
+
+		for (i = 0; i < TEST_DEVICES; i++)
+		{
+			Main_devReadState(&test_device[i], &state);
+			HwSim_getStat(test_device[i].reg_base, &sim_stat);
+			if (ON == state.mode && test_device[i].index == state.device &&
+				TEST_DEVICE_IRQS == state.irq_timeout && !sim_stat.irq_pending &&
+				TEST_DEVICE_IRQS == sim_stat.irq_serviced)
+				ok++;
+		}
+		for (i = 0; i < MAIN_THREADS_MAX; i++)
+			if (main_shard[i].count)
+				threads++;
+
+		/* a scheduler re-initialized on another thread leaves the old
+		 * one, its calls run on the new thread */
+		{
+			T_THREAD *other = &test_device[0].shard->thread;
+			BOOL moved;
+
+			Scheduler_init(test_scheduler, other, SCHEDULER_GRANT_1);
+			moved = !Test_scheduler_linked(main_thread, test_scheduler) &&
+				Test_scheduler_linked(other, test_scheduler);
+			Scheduler_run(test_scheduler, Test_cb_moved, NULL);
+			Scheduler_init(test_scheduler, main_thread, 0);
+			if (moved && test_dev.moved_on == other->event_thread_id &&
+				Test_scheduler_linked(main_thread, test_scheduler) &&
+				!Test_scheduler_linked(other, test_scheduler))
+				printf("PASSED: Scheduler moved between threads and back\n");
+			else
+				printf("FAILED: Scheduler move, linked %d, ran on the new thread %d\n",
+					moved, test_dev.moved_on == other->event_thread_id);
+		}
+
+		/* a re-init hands a caller still waiting for grant RESULT_CANCELLED */
+		test_dev.cancel_on = test_scheduler;
+		test_dev.cancelled = RESULT_OK;
+		test_dev.moved_on = NULL;
+		Test_task_create(Test_cancelled_caller_task, "Cancelled",
+			main_TEST_TASK_PRIORITY + 1, TEST_TASK_CANCELLED);
+		vTaskDelay(2);
+		Scheduler_init(test_scheduler, main_thread, 0);
+		vTaskDelay(2);
+		if (RESULT_CANCELLED == test_dev.cancelled && !test_dev.moved_on)
+			printf("PASSED: Scheduler re-init cancels a blocked call\n");
+		else
+			printf("FAILED: Scheduler re-init, blocked call got %d, ran %d\n",
+				test_dev.cancelled, NULL != test_dev.moved_on);
+
+		/* every device steps down on its own, the snapshot shows it */
+		for (i = 0; i < TEST_DEVICES; i++)
+			Main_devReqSetPowerPolicy(&test_device[i], &policy, NULL, NULL);
+		vTaskDelay(3 * TEST_POW_IDLE);
+		for (i = 0; i < TEST_DEVICES; i++)
+		{
+			Main_devReadState(&test_device[i], &state);
+			if (POW_LEVEL_RETENTION == state.power_level &&
+				POW_LEVEL_RETENTION == Pow_getLevel(&test_device[i].pow))
+				idle++;
+			Main_devReqSetPowerPolicy(&test_device[i], &no_policy, NULL, NULL);
+		}
+
+		for (i = 0; i < TEST_DEVICES; i++)
+			Main_devReqSetMode(&test_device[i], &off, Test_cb_device, &test_device[i]);
+		for (i = 0; i < 10 && test_dev.done < 2 * TEST_DEVICES + 1; i++)
+			vTaskDelay(1);
+		Main_readState(&state);
+
+		if (TEST_DEVICES == added && TEST_DEVICES == ok && 3 == threads &&
+			test_device[0].shard != main_device.shard &&
+			test_device[1].shard == main_device.shard &&
+			test_device[2].shard->own && 2 * TEST_DEVICES + 1 == test_dev.done &&
+			!test_dev.wrong_thread && ON == state.mode && TEST_DEVICES == idle)
+			printf("PASSED: Devices %d on %d threads, %d IRQs each serviced on their own thread, %d idle\n",
+				TEST_DEVICES + 1, threads, TEST_DEVICE_IRQS, idle);
+		else
+			printf("FAILED: Devices %d added, %d ok, %d threads, %d of %d done, %d on a wrong thread, %d idle\n",
+				added, ok, threads, test_dev.done, 2 * TEST_DEVICES + 1,
+				test_dev.wrong_thread, idle);
+	}
+#endif
+
+#if defined(OS_SIM)
+	/* Bridge test - requests through shared memory, answers matched by seq */
+	{
+		T_BRIDGE_SHM * p_shm = NULL;
+		T_BRIDGE_RESPONSE rsp, got[TEST_BRIDGE_REQUESTS];
+		U32 client, seen = 0, start;
+
+		memset(got, 0, sizeof(got));
+		if (SUCCEEDED(Bridge_open(TEST_BRIDGE_NAME)))
+			p_shm = Bridge_clientAttach(TEST_BRIDGE_NAME, &client);
+		if (p_shm)
+		{
+			Bridge_clientPost(p_shm, client, 0, BRIDGE_REQ_SET_MODE, ON);
+			Bridge_clientPost(p_shm, client, 1, BRIDGE_REQ_GET_STATE, 0);
+			Bridge_clientPost(p_shm, client, 2, BRIDGE_REQ_READ_STATE, 0);
+			Bridge_clientPost(p_shm, client, 3, BRIDGE_REQ_MAX, 0);
+			start = OsGetTimestamp();
+			while (seen != (1U << TEST_BRIDGE_REQUESTS) - 1 &&
+				OsGetTimestamp() - start < TEST_BRIDGE_TIMEOUT)
+			{
+				if (SUCCEEDED(Bridge_clientPoll(p_shm, client, &rsp)) &&
+					rsp.seq < TEST_BRIDGE_REQUESTS)
+				{
+					got[rsp.seq] = rsp;
+					seen |= 1U << rsp.seq;
+				}
+				else
+				{
+					vTaskDelay(1);
+				}
+			}
+			Bridge_clientDetach(p_shm, client);
+		}
+		Bridge_close();
+		if (seen == (1U << TEST_BRIDGE_REQUESTS) - 1 &&
+			RESULT_OK == got[0].result && ON == got[0].value &&
+			RESULT_OK == got[1].result && ON == got[1].value &&
+			RESULT_OK == got[2].result && got[2].state.generation &&
+			RESULT_NOT_SUPPORTED == got[3].result)
+			printf("PASSED: Bridge %d requests answered through shared memory\n",
+				TEST_BRIDGE_REQUESTS);
+		else
+			printf("FAILED: Bridge answers %x, results %d %d %d %d\n", seen,
+				got[0].result, got[1].result, got[2].result, got[3].result);
+	}
+
+	/* Bridge test - a client in a forked process sleeps in the futex while
+	 * the simulator serves it */
+	{
+		T_BRIDGE_STAT bridge_stat;
+		int status = -1;
+		pid_t pid = -1;
+		U32 polls;
+
+		if (SUCCEEDED(Bridge_open(TEST_BRIDGE_NAME)))
+		{
+			fflush(stdout);
+			pid = fork();
+			if (0 == pid)
+				_exit(Test_bridgeChild());
+		}
+		/* a tick per host millisecond, the simulated clock would run away
+		 * from the client otherwise */
+		for (polls = 0; pid > 0 && !waitpid(pid, &status, WNOHANG); polls++)
+		{
+			if (TEST_BRIDGE_CHILD_POLLS == polls)
+			{
+				kill(pid, SIGKILL);
+				waitpid(pid, &status, 0);
+				break;
+			}
+			usleep(1000);
+			vTaskDelay(1);
+		}
+		Bridge_getStat(&bridge_stat);
+		Bridge_close();
+		if (pid > 0 && WIFEXITED(status) && !WEXITSTATUS(status))
+			printf("PASSED: Bridge forked client answered, %d futex wake ups\n",
+				bridge_stat.wakeups);
+		else
+			printf("FAILED: Bridge forked client status %x after %d polls\n",
+				status, polls);
+	}
+#endif
+
+	/* Stress test - producers post a random mix of events, calls and IRQs,
+	 * every tag has to arrive once and in order per path */
+	{
+		T_STRESS_CFG stress_cfg = { 0 };
+		T_STRESS_REPORT report;
+		T_RESULT result;
+
+		stress_cfg.thread = main_thread;
+		stress_cfg.scheduler = main_scheduler;
+		stress_cfg.producers = TEST_STRESS_PRODUCERS;
+		stress_cfg.duration = TEST_STRESS_RUN;
+		stress_cfg.mix[STRESS_OP_EVENT] = 4;
+		stress_cfg.mix[STRESS_OP_RUN_ASYNC] = 4;
+		stress_cfg.mix[STRESS_OP_RUN] = 1;
+		stress_cfg.mix[STRESS_OP_IRQ] = 1;
+		stress_cfg.seed = 1;
+
+		test_quiet_timeout = TRUE;
+		Scheduler_set_rate(main_scheduler, TEST_STRESS_GRANT, 1, TEST_STRESS_GRANT);
+		result = Stress_run(&stress_cfg, &report);
+		Scheduler_set_rate(main_scheduler, 0, 0, 0);
+		test_quiet_timeout = FALSE;
+		if (RESULT_OK == result && report.posted == report.received)
+			printf("PASSED: Stress %d tags, %d per second\n", report.received, report.throughput);
+		else
+			printf("FAILED: Stress result %d posted %d received %d lost %d duplicated %d reordered %d\n",
+				result, report.posted, report.received, report.lost,
+				report.duplicated, report.reordered);
+		printf("Stress : %d rejected, %d IRQs, latency max %d avg %d ticks\n",
+			report.rejected, report.irqs, report.latency_max, report.latency_avg);
+	}
+
+	/* Timed out call - the held main thread can not take the call, it is
+	 * cancelled and must not run once the thread is back */
+	{
+		T_RESULT result;
+		U32 calls = main_scheduler->stat.calls;
+
+		vTaskSuspend(main_thread->event_thread_id);
+		result = Scheduler_run(main_scheduler, Test_cb3, (void *)"FAILED: timed out call ran\n");
+		vTaskResume(main_thread->event_thread_id);
+		vTaskDelay(1);
+		if (RESULT_TIMEOUT == result && calls == main_scheduler->stat.calls &&
+			!main_thread->waiters[main_TEST_TASK_PRIORITY])
+			printf("PASSED: Timed out Scheduler_run cancelled, priority released\n");
+		else
+			printf("FAILED: Timed out Scheduler_run result %d calls %d waiters %d\n",
+				result, main_scheduler->stat.calls - calls,
+				main_thread->waiters[main_TEST_TASK_PRIORITY]);
+	}
+
+	/* Snapshot test - state readable without a thread round trip */
+	Main_readState(&snapshot);
+	if (ON == snapshot.mode && 2 == snapshot.clock)
+		printf("PASSED: State snapshot %d : mode %d clock %d queued %d\n",
+			snapshot.generation, snapshot.mode, snapshot.clock, snapshot.queue_depth);
+	else
+		printf("FAILED: State snapshot mode %d clock %d\n", snapshot.mode, snapshot.clock);
+
 	printf("\n\nAll Test Completed ! \n\n\n\n");
 
 }
 /*-----------------------------------------------------------*/
 /* Creates a Test Thread & SW Timer to simulate a Timer Interrupt
 */
-void Main_TestInit() 
-{
-	const TickType_t xTimerPeriod = mainTIMER_SEND_FREQUENCY_MS;
-
-	//Test Thread creation
-	xTaskCreate(testTask, "TestThread", configMINIMAL_STACK_SIZE, NULL, main_TEST_TASK_PRIORITY, NULL);
-
-	/* Create the software timer, but don't start it yet. */
-	xTimer = xTimerCreate("Timer",				/* The text name assigned to the software timer - for debug only as it is not used by the kernel. */
-		xTimerPeriod,		/* The period of the software timer in ticks. */
-		pdFALSE,			/* xAutoReload is set to pdFALSE, so this is a one shot timer. */
-		NULL,				/* The timer's ID is not used. */
+void Main_TestInit() 
+{
+	const TickType_t xTimerPeriod = mainTIMER_SEND_FREQUENCY_MS;
 
-		TimerCallback);/* The function executed when the timer expires. */
+	//Test Thread creation
+	Test_task_create(testTask, "TestThread", main_TEST_TASK_PRIORITY, TEST_TASK_MAIN);
 
-	//The scheduler has not started yet so a block time is not used.
-	BaseType_t xReturned = xTimerStart(xTimer, 0);
+	/* Periodic timer on the driver thread timer service */
+	test_sw_timer.callback = TimerCallback;
+	test_sw_timer.p_data = NULL;
+	Thread_timer_start(main_thread, &test_sw_timer, xTimerPeriod, xTimerPeriod);
 }
 int main_driver()
 {
@@ -163,80 +1704,247 @@ int main_driver()
 }
 #endif
 
+/* The device of a handle, NULL for the first one */
+static T_MAIN_DEVICE * Main_device(T_MAIN_DEVICE * device)
+{
+    return device ? device : &main_device;
+}
+
+/* Driver thread running the caller, NULL if it is none */
+static T_MAIN_SHARD * Main_shard_self(void)
+{
+    OsThread self;
+    U32 i, rc;
+
+    rc = OsThreadGetCurrent(&self);
+    if (rc != OS_SUCCESS)
+        return NULL;
+
+    for (i = 0; i < MAIN_THREADS_MAX; i++)
+    {
+        if (main_shard[i].count && self == main_shard[i].thread.event_thread_id)
+            return &main_shard[i];
+    }
+    return NULL;
+}
+
 /* This non-blocking-function posts HW CONF message to Thread.
  * and calls the call back once HW configuration is done */
-static inline void Main_reqSetConfig(T_CFG cfg_type,
+static inline T_RESULT Main_reqSetConfig(T_MAIN_DEVICE * device,
+                                            T_CFG cfg_type,
                                             const void * P_CFG,
                                             void (*cb)(void*),
-                                            void * p_cb_data)
+                                            void * p_cb_data,
+                                            T_THREAD_EVENT_PRIORITY prio)
 {
     T_EVENT_CFG event;
+
+    device = Main_device(device);
+    if (!device->shard)
+        return RESULT_WRONG_STATE;
+
     event.cfg_type = cfg_type;
     event.cfg.P_CFG = P_CFG;
     event.completion_callback =cb;
     event.p_completion_callback_data =p_cb_data;
+    event.device = device;
     /* thread_send_event_ex traps on fatal errors */
-    Thread_send_event_ex(main_thread,
+    return Thread_send_event_prio(&device->shard->thread,
                                    THREAD_EVENT_SET_CFG, &event,
                                    sizeof(T_EVENT_CFG)
-                                   ,THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
+                                   ,THREAD_EVENT_SEND_OPTION_DO_NOT_OR, prio);
 }
-static void Main_on_set_mode(T_EVENT_CFG set_mode )
+static BOOL Main_mode_changed(T_MAIN_DEVICE * device, const void * P_CFG)
 {
-    U32 new_mode = set_mode.cfg.P_MODE->mode;
-    U32 old_mode = Drv_isActive();
-
-    if (old_mode == new_mode)
-        return;
+    return ((const t_base_cfg *)P_CFG)->mode != Drv_isActive(&device->hw);
+}
 
-    //mask all interrupts
-    Isr_unmaskIrqs(false);
+static void Main_apply_mode(T_MAIN_DEVICE * device, const void * P_CFG)
+{
+    const t_base_cfg * P_MODE = (const t_base_cfg *)P_CFG;
+    U32 new_mode = P_MODE->mode;
+    U32 old_mode = Drv_isActive(&device->hw);
 
     LOG_EVENT(LOG_ON_SET_MODE,new_mode);
 
-    if (!new_mode)
+    if (!new_mode && device->scheduler)
     {
         /*  Power OFF */
-        Scheduler_suspend(main_scheduler);
+        Scheduler_suspend(device->scheduler);
     }
 
     // just forward the config to  DRV
-    Drv_setMode(set_mode.cfg.P_MODE);
+    Drv_setMode(&device->hw, P_MODE);
 
-    if (new_mode)
+    /*  Power ON from OFF */
+    if (new_mode && !old_mode && device->scheduler)
+        Scheduler_init(device->scheduler, &device->shard->thread,
+                       SCHEDULER_GRANT_1);
+}
+
+static BOOL Main_clock_changed(T_MAIN_DEVICE * device, const void * P_CFG)
+{
+    return ((const t_base_cfg *)P_CFG)->clock != device->hw.config.clock;
+}
+
+static void Main_apply_clock(T_MAIN_DEVICE * device, const void * P_CFG)
+{
+    Drv_setClock(&device->hw, (const t_base_cfg *)P_CFG);
+}
+
+static BOOL Main_power_policy_changed(T_MAIN_DEVICE * device, const void * P_CFG)
+{
+    return 0 != memcmp(P_CFG, Pow_getPolicy(&device->pow), sizeof(T_POW_POLICY));
+}
+
+static void Main_apply_power_policy(T_MAIN_DEVICE * device, const void * P_CFG)
+{
+    Pow_setPolicy(&device->pow, (const T_POW_POLICY *)P_CFG);
+}
+
+/**
+ * \brief Per T_CFG diff against the t_HW config and apply step. apply()
+ * only runs for changed items and always with all interrupts masked.
+ */
+static const struct
+{
+    BOOL (*changed)(T_MAIN_DEVICE * device, const void * P_CFG);
+    void (*apply)(T_MAIN_DEVICE * device, const void * P_CFG);
+} main_cfg_handlers[CFG_MAX] = {
+    [CFG_SET_MODE] = { Main_mode_changed, Main_apply_mode },
+    [CFG_SET_CLOCK] = { Main_clock_changed, Main_apply_clock },
+    [CFG_SET_POWER_POLICY] = { Main_power_policy_changed, Main_apply_power_policy },
+};
+
+/* Hand a completion to the completion queue of the device, or run it
+ * right away if there is none. The driver thread makes room in a full
+ * queue, in request order. If a consumer is busy with it the callback
+ * runs right away, ahead of the queued ones, counted as an overflow. */
+static void Main_complete(T_MAIN_DEVICE * device, const T_COMPLETION * P_COMPLETION)
+{
+    T_COMPLETION_QUEUE *queue = device->completion_queue;
+    T_THREAD *thread = &device->shard->thread;
+
+    if (queue && SUCCEEDED(Completion_post_drain(queue, P_COMPLETION, thread)))
+        return;
+
+    Thread_watch_begin(thread, (T_THREAD_FUNC)P_COMPLETION->cb.cfg);
+    if (COMPLETION_CFG == P_COMPLETION->type)
+        P_COMPLETION->cb.cfg(P_COMPLETION->arg.p_data);
+    else
+        P_COMPLETION->cb.state(P_COMPLETION->arg.state);
+    Thread_watch_end(thread);
+}
+
+static void Main_complete_cfg(T_MAIN_DEVICE * device, void (*cb)(void*),
+                              void * p_cb_data)
+{
+    T_COMPLETION completion;
+
+    completion.type = COMPLETION_CFG;
+    completion.cb.cfg = cb;
+    completion.arg.p_data = p_cb_data;
+    Main_complete(device, &completion);
+}
+
+static void Main_complete_state(T_MAIN_DEVICE * device, void (*cb)(U32),
+                                U32 state)
+{
+    T_COMPLETION completion;
+
+    completion.type = COMPLETION_STATE;
+    completion.cb.state = cb;
+    completion.arg.state = state;
+    Main_complete(device, &completion);
+}
+
+/* Apply all changed items inside one IRQ mask window, then complete once */
+static void Main_apply_config(T_MAIN_DEVICE * device,
+                              const T_CFG_ITEM * P_ITEMS, U32 count,
+                              void (*cb)(void*), void * p_cb_data)
+{
+    BOOL masked = FALSE;
+    U32 i;
+
+    for (i = 0; i < count; i++)
     {
-        /*  Power ON from OFF */
-        if (!old_mode)
-            Scheduler_init(main_scheduler, main_thread, SCHEDULER_GRANT_1);
+        T_CFG cfg_type = P_ITEMS[i].cfg_type;
 
-        //unmask all interrupts if  is not OFF
-        Isr_unmaskIrqs(true);
+        if (cfg_type >= CFG_MAX)
+        {
+            printf("HW CFG unknown CMD: %u", cfg_type );
+            continue;
+        }
+
+        if (!main_cfg_handlers[cfg_type].changed(device, P_ITEMS[i].cfg.P_CFG))
+            continue;
+
+        //mask all interrupts
+        if (!masked)
+        {
+            Isr_unmaskIrqs(&device->isr, false);
+            masked = TRUE;
+        }
+
+        main_cfg_handlers[cfg_type].apply(device, P_ITEMS[i].cfg.P_CFG);
     }
 
+    //unmask all interrupts if  is not OFF
+    if (masked && Drv_isActive(&device->hw))
+        Isr_unmaskIrqs(&device->isr, true);
+
     /* Call the completion call back */
-    if(set_mode.completion_callback)
-        (set_mode.completion_callback)(set_mode.p_completion_callback_data);
+    device->cfg_status = MAIN_CFG_APPLIED;
+    if(cb)
+        Main_complete_cfg(device, cb, p_cb_data);
 }
 
-static void Main_on_set_config(const T_EVENT_CFG * P_SET_CFG )
+/* A lone SET_MODE ON from OFF is applied once the HW is ready */
+static BOOL Main_power_up_start(T_MAIN_DEVICE * device,
+                                const T_EVENT_CFG * P_SET_CFG)
 {
+    if (!device->power_up.enabled || CFG_SET_MODE != P_SET_CFG->cfg_type ||
+        device->power_up.async.running ||
+        !P_SET_CFG->cfg.P_MODE->mode || Drv_isActive(&device->hw))
+        return FALSE;
+
+    device->power_up.set_cfg = *P_SET_CFG;
+    return SUCCEEDED(Thread_async_start(&device->shard->thread,
+                                        &device->power_up.async));
+}
+
+static void Main_on_set_config(T_MAIN_DEVICE * device,
+                               const T_EVENT_CFG * P_SET_CFG )
+{
+    T_CFG_ITEM item;
+
     LOG_EVENT(MAIN_ON_SET_CONFIG, P_SET_CFG->cfg_type);
     switch (P_SET_CFG->cfg_type)
     {
-        case CFG_SET_MODE:
-            Main_on_set_mode(*P_SET_CFG);
+        case CFG_TRANSACTION:
+            Main_apply_config(device,
+                              P_SET_CFG->cfg.P_TRANSACTION->items,
+                              P_SET_CFG->cfg.P_TRANSACTION->count,
+                              P_SET_CFG->completion_callback,
+                              P_SET_CFG->p_completion_callback_data);
         break;
 
         default:
-            printf("HW CFG unknown CMD: %u", P_SET_CFG->cfg_type );
+            if (Main_power_up_start(device, P_SET_CFG))
+                break;
+            item.cfg_type = P_SET_CFG->cfg_type;
+            item.cfg.P_CFG = P_SET_CFG->cfg.P_CFG;
+            Main_apply_config(device, &item, 1,
+                              P_SET_CFG->completion_callback,
+                              P_SET_CFG->p_completion_callback_data);
         break;
     }
 }
 
-void Main_on_get_state(T_GET_STATE_EVENT state_event)
+void Main_on_get_state(T_MAIN_DEVICE * device, T_GET_STATE_EVENT state_event)
 {
     U32 state = OFF;
-    switch(Drv_isActive())
+    switch(Drv_isActive(&device->hw))
     {
         case OFF:
             state = OFF;
@@ -250,30 +1958,152 @@ void Main_on_get_state(T_GET_STATE_EVENT state_event)
     }
 
     if(state_event.completion_callback)
-        (state_event.completion_callback)(state);
+        Main_complete_state(device, state_event.completion_callback, state);
 }
 
-/* Main  thread which handles the events and sends data to CPS
+static T_THREAD_ASYNC_STATE Main_power_up(T_THREAD_ASYNC * async)
+{
+    T_MAIN_DEVICE *device = (T_MAIN_DEVICE *)async->p_data;
+
+    THREAD_ASYNC_BEGIN(async);
+    Drv_powerUp(&device->hw);
+    THREAD_ASYNC_AWAIT_UNTIL(async, Drv_isReady(&device->hw), DRV_POWER_UP_TIMEOUT);
+    if (async->timed_out)
+    {
+        /* Drv_setMode would wait for the HW once more, fail instead */
+        Drv_powerDown(&device->hw);
+        device->cfg_status = MAIN_CFG_FAILED;
+        Main_publish_state(device);
+        if (device->power_up.set_cfg.completion_callback)
+            Main_complete_cfg(device, device->power_up.set_cfg.completion_callback,
+                              device->power_up.set_cfg.p_completion_callback_data);
+    }
+    else
+    {
+        /* Drv_setMode finds the HW ready */
+        Main_on_set_config(device, &device->power_up.set_cfg);
+        Main_publish_state(device);
+    }
+    THREAD_ASYNC_END(async);
+}
+
+/* Hand the requests held back to the handler, until one powers up again */
+static void Main_power_up_done(T_THREAD_ASYNC * async)
+{
+    T_MAIN_DEVICE *device = (T_MAIN_DEVICE *)async->p_data;
+    T_THREAD_EVENT event;
+
+    while (!async->running && device->power_up.rd != device->power_up.wr)
+    {
+        event = device->power_up.deferred[device->power_up.rd % MAIN_DEFERRED_EVENTS];
+        device->power_up.rd++;
+        Main_on_event(device, &event);
+    }
+}
+
+static void Main_on_timer(T_MAIN_DEVICE * device,
+                          const T_TIMER_EVENT * P_TIMER_EVENT)
+{
+    T_THREAD *thread = &device->shard->thread;
+
+    Thread_watch_begin(thread, (T_THREAD_FUNC)P_TIMER_EVENT->callback);
+    P_TIMER_EVENT->callback(P_TIMER_EVENT->p_data);
+    Thread_watch_end(thread);
+}
+
+/* Budget overruns and hung callbacks of the driver threads */
+static void Main_on_overrun(T_THREAD_FUNC func, T_THREAD_EVENT_TYPE event,
+                            U32 cycles, BOOL hung)
+{
+    printf("%s: callback %p, event %d, %u cycles\n",
+           hung ? "Hung" : "Overrun", (void *)func, event, cycles);
+}
+
+static void Main_watchdog_cb(OsTimer timer)
+{
+    U32 i;
+
+    (void)timer;
+    for (i = 0; i < MAIN_THREADS_MAX; i++)
+    {
+        if (main_shard[i].count)
+            Thread_watchdog_check(&main_shard[i].thread);
+    }
+    OsTimerStart(&main_watchdog.timer, MAIN_WATCHDOG_PERIOD);
+}
+
+/* Publish the device state for Main_devReadState (driver thread only) */
+static void Main_publish_state(T_MAIN_DEVICE * device)
+{
+    T_MAIN_STATE_SNAPSHOT *p_state = &device->snapshot.state;
+
+    device->snapshot.seq++;
+    os_data_sync_barrier();
+
+    p_state->generation++;
+    p_state->mode = device->hw.config.mode;
+    p_state->clock = device->hw.config.clock;
+    p_state->power_level = Pow_getLevel(&device->pow);
+    p_state->irq_timeout = device->hw.stat.irq_timeout;
+    p_state->queue_depth = Thread_queue_depth(&device->shard->thread);
+    p_state->cfg_status = device->cfg_status;
+    p_state->cfg_expired = device->cfg_expired;
+
+    os_data_sync_barrier();
+    device->snapshot.seq++;
+
+    /* dropped while the export lags behind, the generation shows the gap */
+    Export_append(&main_export, MAIN_EXPORT_STATE, p_state, sizeof(*p_state));
+}
+
+/* Runs on the export thread after every batch */
+static void Main_on_export_flush(const T_EXPORT_BATCH * P_BATCH, void * p_data)
+{
+    (void)p_data;
+    if (FAILED(P_BATCH->result))
+        printf("Export: batch %u of %u records failed %d\n",
+               P_BATCH->seq, P_BATCH->records, P_BATCH->result);
+}
+
+/* Handles the events of one device and sends data to CPS
  */
-static BOOL main_event_hdlr(T_THREAD_EVENT *event)
+static BOOL Main_on_event(T_MAIN_DEVICE * device, T_THREAD_EVENT *event)
 {
     BOOL status = TRUE;
-    if (Drv_isActive())
+
+    if (device->power_up.async.running &&
+        (THREAD_EVENT_SET_CFG == event->event || THREAD_GET_STATE == event->event))
+    {
+        if (device->power_up.wr - device->power_up.rd < MAIN_DEFERRED_EVENTS)
+        {
+            device->power_up.deferred[device->power_up.wr % MAIN_DEFERRED_EVENTS] = *event;
+            device->power_up.wr++;
+            return TRUE;
+        }
+        /* handled out of order rather than lost */
+        FATAL(RESULT_FAILURE, MAIN_DEFERRED_OVERRUN);
+    }
+    if (Drv_isActive(&device->hw))
     {
         LOG_EVENT(LOG_MAIN_EVENT_HANDLER_ENTER, event->event);
         switch (event->event)
         {
             case THREAD_EVENT_SET_CFG:
-                Main_on_set_config(&event->parameters.cfg_event);
+                Main_on_set_config(device, &event->parameters.cfg_event);
             break;
             case THREAD_GET_STATE:
-                Main_on_get_state(event->parameters.state);
+                Main_on_get_state(device, event->parameters.state);
                 break;
 			case THREAD_EVENT_TIMEOUT:
+				Drv_ackIrq(&device->hw);
 #ifdef TEST
-				printf("PASSED: Timer Timeout Event Processed : DRV ON \n");
+				if (!test_quiet_timeout)
+					printf("PASSED: Timer Timeout Event Processed : DRV ON \n");
 #endif
 				break;
+			case THREAD_EVENT_TIMER:
+				Main_on_timer(device, &event->parameters.timer_event);
+				break;
             default:
                 status = FALSE;
             break;
@@ -286,29 +2116,179 @@ static BOOL main_event_hdlr(T_THREAD_EVENT *event)
         switch (event->event)
         {
             case THREAD_EVENT_SET_CFG:
-                Main_on_set_config(&event->parameters.cfg_event);
+                Main_on_set_config(device, &event->parameters.cfg_event);
             break;
             case THREAD_GET_STATE:
-				Main_on_get_state(event->parameters.state);
+				Main_on_get_state(device, event->parameters.state);
 
                 break;
 			case THREAD_EVENT_TIMEOUT:
 #ifdef TEST
-				printf("PASSED: Timer Timeout Event Processed : DRV OFF \n");
+				if (!test_quiet_timeout)
+					printf("PASSED: Timer Timeout Event Processed : DRV OFF \n");
 #endif
 				break;
+			case THREAD_EVENT_TIMER:
+				Main_on_timer(device, &event->parameters.timer_event);
+				break;
 			default:
                 status = FALSE;
             break;
         }
     }
+    Main_publish_state(device);
     LOG_EVENT(LOG_MAIN_EVENT_HANDLER_EXIT, status);
     return status;
 }
 
-static void thread_init(void)
+/* Event handler of every driver thread: requests go to the device they
+ * name, one timeout event to every device of the thread whose line was
+ * raised, other events to the first device of the thread */
+static BOOL main_event_hdlr(T_THREAD_EVENT *event)
+{
+    T_MAIN_SHARD *shard = Main_shard_self();
+    T_MAIN_DEVICE *device;
+
+    if (!shard)
+        return FALSE;
+
+    /* every event and IRQ of the thread passes here first, restore full
+     * power of its devices */
+    for (device = shard->devices; device; device = device->next)
+        Pow_wake(&device->pow);
+
+    switch (event->event)
+    {
+        case THREAD_EVENT_SET_CFG:
+            return Main_on_event(Main_device(event->parameters.cfg_event.device),
+                                 event);
+        case THREAD_GET_STATE:
+            return Main_on_event(Main_device(event->parameters.state.device),
+                                 event);
+        case THREAD_EVENT_TIMEOUT:
+            for (device = shard->devices; device; device = device->next)
+            {
+                if (Isr_takePending(&device->isr))
+                    Main_on_event(device, event);
+            }
+            return TRUE;
+        default:
+            return Main_on_event(shard->devices, event);
+    }
+}
+
+/* Stale events: configuration requests complete without touching the HW
+ * and publish MAIN_CFG_EXPIRED first, state requests report
+ * MAIN_STATE_EXPIRED, a stale timeout IRQ is only acknowledged */
+static BOOL main_event_expired(T_THREAD_EVENT *event)
+{
+    const T_EVENT_CFG *P_SET_CFG = &event->parameters.cfg_event;
+    void (*state_cb)(U32) = event->parameters.state.completion_callback;
+    T_MAIN_SHARD *shard;
+    T_MAIN_DEVICE *device;
+
+    LOG_EVENT(LOG_MAIN_EVENT_EXPIRED, event->event);
+    switch (event->event)
+    {
+        case THREAD_EVENT_SET_CFG:
+            device = Main_device(P_SET_CFG->device);
+            device->cfg_status = MAIN_CFG_EXPIRED;
+            device->cfg_expired++;
+            Main_publish_state(device);
+            if (P_SET_CFG->completion_callback)
+                Main_complete_cfg(device, P_SET_CFG->completion_callback,
+                                  P_SET_CFG->p_completion_callback_data);
+            break;
+        case THREAD_GET_STATE:
+            if (state_cb)
+                Main_complete_state(Main_device(event->parameters.state.device),
+                                    state_cb, MAIN_STATE_EXPIRED);
+            break;
+        case THREAD_EVENT_TIMEOUT:
+            shard = Main_shard_self();
+            for (device = shard ? shard->devices : NULL; device; device = device->next)
+            {
+                if (Isr_takePending(&device->isr) && Drv_isActive(&device->hw))
+                    Drv_ackIrq(&device->hw);
+            }
+            break;
+        default:
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* Pool thread with the fewest devices, or a free thread for a device with
+ * one of its own */
+static T_MAIN_SHARD * Main_shard_pick(BOOL own)
+{
+    T_MAIN_SHARD *shard = NULL;
+    U32 i;
+
+    if (own)
+    {
+        /* taken from the end, the pool may still grow */
+        for (i = MAIN_THREADS_MAX; i-- > main_devices.pool;)
+        {
+            if (!main_shard[i].count)
+                return &main_shard[i];
+        }
+        return NULL;
+    }
+
+    for (i = 0; i < main_devices.pool; i++)
+    {
+        if (!shard || main_shard[i].count < shard->count)
+            shard = &main_shard[i];
+    }
+    return shard;
+}
+
+/* Idle hook of the driver threads: the devices of the thread step down
+ * their power levels and publish the new one, the thread wakes for the
+ * next threshold due */
+static U32 Main_on_idle(U32 idle_time)
+{
+    T_MAIN_SHARD *shard = Main_shard_self();
+    T_MAIN_DEVICE *device;
+    T_POW_LEVEL level;
+    U32 timeout = OS_INFINITE;
+    U32 next;
+
+    for (device = shard ? shard->devices : NULL; device; device = device->next)
+    {
+        level = Pow_getLevel(&device->pow);
+        next = Pow_onIdle(&device->pow, idle_time);
+        if (level != Pow_getLevel(&device->pow))
+            Main_publish_state(device);
+        if (next < timeout)
+            timeout = next;
+    }
+    return timeout;
+}
+
+/* Create the driver thread of a shard for its first device */
+static T_RESULT Main_shard_start(T_MAIN_SHARD * shard, BOOL own)
 {
-    Isr_init(main_thread);
+    U32 i = (U32)(shard - main_shard);
+    T_THREAD *thread = &shard->thread;
+    T_RESULT res;
+
+    thread->thread_name = main_thread_names[i];
+    thread->thread_event_name = main_thread_event_names[i];
+    thread->event_handlers = thread_main_handlers;
+    thread->event_expired = main_event_expired;
+    thread->thread_idle = Main_on_idle;
+
+    res = Thread_create(thread);
+    if (FAILED(res))
+        return res;
+
+    Thread_set_watchdog(thread,
+                        MAIN_WATCHDOG_LIMIT_TICKS * OS_CYCLES_PER_TICK,
+                        Main_on_overrun);
+    shard->own = own;
+    return RESULT_OK;
 }
 
 
@@ -322,24 +2302,271 @@ void Main_init(void)
 {
     T_RESULT res;
 
-    res = Thread_create(main_thread);
+    U32 rc;
+
+    main_device.scheduler = main_scheduler;
+    res = Main_addDevice(&main_device);
     ASSERT(RESULT_OK, res, THREAD_CREATE);
+
+    res = Export_init(&main_export);
+    ASSERT(RESULT_OK, res, EXPORT_INIT);
+
+#if defined(DRV_STATIC_ALLOC)
+    rc = OsTimerCreateStatic(&main_watchdog.timer, "MAIN_WD", Main_watchdog_cb,
+                             NULL, &main_watchdog.timer_mem);
+#else
+    rc = OsTimerCreate(&main_watchdog.timer, "MAIN_WD", Main_watchdog_cb, NULL);
+#endif
+    ASSERT(OS_SUCCESS, rc, WATCHDOG_CREATE);
+    OsTimerStart(&main_watchdog.timer, MAIN_WATCHDOG_PERIOD);
+}
+
+/* Pool threads the devices without own_thread are spread over, 1 ..
+ * MAIN_THREADS_MAX. Added devices keep their thread, RESULT_WRONG_STATE
+ * if the change would take away a thread in use. */
+T_RESULT Main_setPoolThreads(U32 count)
+{
+    U32 i;
+
+    if (!count || count > MAIN_THREADS_MAX)
+        return RESULT_PARAMETER_ERROR;
+
+    for (i = 0; i < MAIN_THREADS_MAX; i++)
+    {
+        if (main_shard[i].count && main_shard[i].own == (i < count))
+            return RESULT_WRONG_STATE;
+    }
+    main_devices.pool = count;
+    return RESULT_OK;
+}
+
+/* Add a device, OFF, to the pool thread serving the fewest devices or to
+ * a thread of its own. One caller at a time, devices are never removed.
+ * RESULT_NO_RESOURCES_AVAILABLE if no thread is left for own_thread. */
+T_RESULT Main_addDevice(T_MAIN_DEVICE * device)
+{
+    T_MAIN_SHARD *shard;
+    T_MAIN_DEVICE **pp_last;
+    T_RESULT res;
+
+    if (!device || !device->device_name)
+        return RESULT_PARAMETER_ERROR;
+
+    if (device->shard)
+        return RESULT_WRONG_STATE;
+
+    shard = Main_shard_pick(device->own_thread);
+    if (!shard)
+        return RESULT_NO_RESOURCES_AVAILABLE;
+
+    if (!shard->count)
+    {
+        res = Main_shard_start(shard, device->own_thread);
+        if (FAILED(res))
+            return res;
+    }
+
+    Drv_init(&device->hw, device->reg_base);
+    device->index = main_devices.devices++;
+    device->next = NULL;
+    device->completion_queue = NULL;
+    device->cfg_status = MAIN_CFG_APPLIED;
+    device->cfg_expired = 0;
+    memset(&device->snapshot, 0x00, sizeof(device->snapshot));
+    device->snapshot.state.device = device->index;
+    memset(&device->power_up, 0x00, sizeof(device->power_up));
+    device->power_up.async.func = Main_power_up;
+    device->power_up.async.done_cb = Main_power_up_done;
+    device->power_up.async.p_data = device;
+    device->shard = shard;
+
+    Isr_init(&device->isr, device->irq_line, &shard->thread, &device->hw);
+    Pow_init(&device->pow, &device->hw);
+
+    /* the thread may walk its list meanwhile, link the device last */
+    for (pp_last = &shard->devices; *pp_last; pp_last = &(*pp_last)->next)
+        ;
+    os_data_sync_barrier();
+    *pp_last = device;
+    shard->count++;
+    return RESULT_OK;
 }
 
 void Main_reqSetMode(const t_base_cfg * P_MODE ,void (*cb)(void*),void * p_cb_data)
 {
-    Main_reqSetConfig(CFG_SET_MODE,P_MODE,cb,p_cb_data);
+    Main_devReqSetMode(NULL, P_MODE, cb, p_cb_data);
+}
+
+void Main_devReqSetMode(T_MAIN_DEVICE * device, const t_base_cfg * P_MODE,
+                        void (*cb)(void*), void * p_cb_data)
+{
+    Main_reqSetConfig(device,CFG_SET_MODE,P_MODE,cb,p_cb_data,
+                      THREAD_EVENT_PRIORITY_NORMAL);
+}
+
+/* Apply several T_CFG items in one IRQ mask window. Only items differing
+ * from the t_HW config are applied; cb fires once when the transaction
+ * is done. P_TRANSACTION must stay valid until then. */
+T_RESULT Main_reqSetConfigTransaction(const T_CFG_TRANSACTION * P_TRANSACTION,
+                                      void (*cb)(void*), void * p_cb_data)
+{
+    return Main_devReqSetConfigTransaction(NULL, P_TRANSACTION, cb, p_cb_data);
+}
+
+/* RESULT_PARAMETER_ERROR for a missing transaction or more than
+ * MAX_CFG_TRANSACTION_ITEMS items, cb is not called then */
+T_RESULT Main_devReqSetConfigTransaction(T_MAIN_DEVICE * device,
+                                         const T_CFG_TRANSACTION * P_TRANSACTION,
+                                         void (*cb)(void*), void * p_cb_data)
+{
+    if (!P_TRANSACTION || P_TRANSACTION->count > MAX_CFG_TRANSACTION_ITEMS)
+        return RESULT_PARAMETER_ERROR;
+
+    return Main_reqSetConfig(device,CFG_TRANSACTION,P_TRANSACTION,cb,p_cb_data,
+                             THREAD_EVENT_PRIORITY_NORMAL);
+}
+
+/* Install an automatic power management policy for the first device, the
+ * driver thread steps down the power levels after the given idle times.
+ * P_POLICY must stay valid until the completion callback. */
+void Main_reqSetPowerPolicy(const T_POW_POLICY * P_POLICY,
+                            void (*cb)(void*), void * p_cb_data)
+{
+    Main_devReqSetPowerPolicy(NULL, P_POLICY, cb, p_cb_data);
+}
+
+void Main_devReqSetPowerPolicy(T_MAIN_DEVICE * device,
+                               const T_POW_POLICY * P_POLICY,
+                               void (*cb)(void*), void * p_cb_data)
+{
+    Main_reqSetConfig(device,CFG_SET_POWER_POLICY,P_POLICY,cb,p_cb_data,
+                      THREAD_EVENT_PRIORITY_NORMAL);
+}
+
+/* Same as Main_reqSetMode but overtakes all queued normal events,
+ * including pending normal configuration requests (e.g. power off) */
+void Main_reqSetModeUrgent(const t_base_cfg * P_MODE ,void (*cb)(void*),void * p_cb_data)
+{
+    Main_devReqSetModeUrgent(NULL, P_MODE, cb, p_cb_data);
+}
+
+void Main_devReqSetModeUrgent(T_MAIN_DEVICE * device,
+                              const t_base_cfg * P_MODE,
+                              void (*cb)(void*), void * p_cb_data)
+{
+    Main_reqSetConfig(device,CFG_SET_MODE,P_MODE,cb,p_cb_data,
+                      THREAD_EVENT_PRIORITY_URGENT);
+}
+
+/* Copy the state published after the last handled event. Does not post
+ * an event and can be called from any task; use Main_getState to get
+ * the state ordered with pending configuration requests. Not from an
+ * ISR: a reader interrupting the driver thread in the middle of a
+ * publish on the same core would retry for ever. */
+void Main_readState(T_MAIN_STATE_SNAPSHOT * P_STATE)
+{
+    Main_devReadState(NULL, P_STATE);
+}
+
+void Main_devReadState(T_MAIN_DEVICE * device, T_MAIN_STATE_SNAPSHOT * P_STATE)
+{
+    U32 seq;
+
+    if (!P_STATE)
+        return;
+
+    device = Main_device(device);
+    do
+    {
+        seq = device->snapshot.seq;
+        os_data_sync_barrier();
+        *P_STATE = device->snapshot.state;
+        os_data_sync_barrier();
+    } while ((seq & 1U) || seq != device->snapshot.seq);
 }
 
 void Main_getState( void (*cb)(U32 State))
+{
+    Main_devGetState(NULL, cb);
+}
+
+void Main_devGetState(T_MAIN_DEVICE * device, void (*cb)(U32 State))
 {
     T_GET_STATE_EVENT event;
+
+    device = Main_device(device);
+    if (!device->shard)
+        return;
+
     event.completion_callback = cb;
+    event.device = device;
 
     /* thread_send_event_ex traps on fatal errors */
-    Thread_send_event_ex(main_thread,
+    Thread_send_event_ex(&device->shard->thread,
                                    THREAD_GET_STATE, &event,
                                    sizeof(T_GET_STATE_EVENT)
                                    ,THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
 }
 
+/* Export every state published from now on to P_SINK, NULL to stop. The
+ * records of all devices go to the same sink. */
+T_RESULT Main_setExportSink(const T_EXPORT_SINK * P_SINK)
+{
+    return Export_set_sink(&main_export, P_SINK);
+}
+
+/* Deliver the completion callbacks of all requests through an initialized
+ * queue from now on, NULL to run them on the driver thread again. The
+ * callbacks of one queue keep the order of the requests. */
+T_RESULT Main_setCompletionQueue(T_COMPLETION_QUEUE * queue)
+{
+    return Main_devSetCompletionQueue(NULL, queue);
+}
+
+T_RESULT Main_devSetCompletionQueue(T_MAIN_DEVICE * device,
+                                    T_COMPLETION_QUEUE * queue)
+{
+    if (queue && !queue->initialized)
+        return RESULT_WRONG_STATE;
+
+    Main_device(device)->completion_queue = queue;
+    return RESULT_OK;
+}
+
+/* Power up of Main_reqSetMode ON without blocking the driver thread. The
+ * completion comes later, the mode must stay valid until then. */
+void Main_setPowerUpAsync(BOOL on)
+{
+    Main_devSetPowerUpAsync(NULL, on);
+}
+
+void Main_devSetPowerUpAsync(T_MAIN_DEVICE * device, BOOL on)
+{
+    Main_device(device)->power_up.enabled = on;
+}
+
+/* Same as Main_getState, but cb gets MAIN_STATE_EXPIRED if the request
+ * is still queued ttl ticks after this call */
+void Main_getStateTtl( void (*cb)(U32 State), U32 ttl)
+{
+    Main_devGetStateTtl(NULL, cb, ttl);
+}
+
+void Main_devGetStateTtl(T_MAIN_DEVICE * device, void (*cb)(U32 State),
+                         U32 ttl)
+{
+    T_GET_STATE_EVENT event;
+
+    device = Main_device(device);
+    if (!device->shard)
+        return;
+
+    event.completion_callback = cb;
+    event.device = device;
+
+    Thread_send_event_ttl(&device->shard->thread,
+                          THREAD_GET_STATE, &event,
+                          sizeof(T_GET_STATE_EVENT),
+                          THREAD_EVENT_SEND_OPTION_DO_NOT_OR,
+                          THREAD_EVENT_PRIORITY_NORMAL, ttl);
+}
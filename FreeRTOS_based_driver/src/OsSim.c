@@ -0,0 +1,928 @@
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include "extern.h"
+
+#if defined(OS_SIM)
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+#define OS_SIM_DUE(time_) ((int32_t)(sim.tick - (time_)) >= 0)
+#define OS_SIM_BEFORE(a_, b_) ((int32_t)((a_) - (b_)) < 0)
+
+/*****************************************************************************/
+/* TYPE DEFINES                                                              */
+/*****************************************************************************/
+typedef enum
+{
+    OS_SIM_TASK_FREE = 0,
+    OS_SIM_TASK_READY,
+    OS_SIM_TASK_BLOCKED,
+    OS_SIM_TASK_SUSPENDED,
+    OS_SIM_TASK_DELETED
+} T_OS_SIM_TASK_STATE;
+
+struct os_sim_task_s
+{
+    T_OS_SIM_TASK_STATE state;
+    const char *name;
+    TaskFunction_t func;
+    void *param;
+    UBaseType_t priority;
+    uint32_t ready_seq; /**< FIFO order among tasks of equal priority */
+
+    /* Blocking wait */
+    void *wait_obj;     /**< Event group or semaphore, NULL for a delay */
+    EventBits_t wait_bits;
+    BaseType_t wait_clear;
+    BaseType_t wait_all;
+    EventBits_t wait_result;
+    BOOL timed;
+    TickType_t wake_time;
+    BOOL timed_out;     /**< Also set when resumed out of a wait */
+    uint32_t notify;    /**< Task notification count */
+
+    ucontext_t ctx;
+};
+
+struct os_sim_event_group_s
+{
+    BOOL used;
+    EventBits_t bits;
+};
+
+struct os_sim_semaphore_s
+{
+    BOOL used;
+    BOOL given;
+};
+
+struct os_sim_timer_s
+{
+    BOOL used;
+    const char *name;
+    TickType_t period;
+    BOOL auto_reload;
+    void *id;
+    TimerCallbackFunction_t cb;
+    BOOL active;
+    TickType_t expiry;
+};
+
+/*****************************************************************************/
+/* LOCAL DATA                                                                */
+/*****************************************************************************/
+static struct
+{
+    TickType_t tick;
+    uint32_t cycles;      /**< Modelled CPU time within the current tick */
+    TickType_t limit;     /**< Virtual end of the run */
+    uint32_t seed;
+    uint32_t rand;
+    uint32_t nesting;     /**< Critical sections, no switch while > 0 */
+    uint32_t isr_nesting; /**< Interrupt handlers running */
+    BOOL slice_end;       /**< A tick passed while the current task ran */
+    uint32_t ready_seq;
+    uint32_t switches;
+    uint32_t heap_allocs; /**< Objects created by the dynamic API */
+
+    struct os_sim_task_s *current; /**< NULL in the scheduler context */
+    ucontext_t sched_ctx;
+
+    struct os_sim_task_s task[OS_SIM_TASKS_MAX];
+    struct os_sim_event_group_s group[OS_SIM_EVENT_GROUPS_MAX];
+    struct os_sim_semaphore_s sem[OS_SIM_SEMAPHORES_MAX];
+    struct os_sim_timer_s timer[OS_SIM_TIMERS_MAX];
+} sim;
+
+static char os_sim_stack[OS_SIM_TASKS_MAX][OS_SIM_STACK_SIZE];
+
+/*****************************************************************************/
+/* FUNCTION PROTOTYPES                                                       */
+/*****************************************************************************/
+extern int main_driver(void);
+
+/*****************************************************************************/
+/* LOCAL FUNCTIONS                                                           */
+/*****************************************************************************/
+static void OsSim_makeReady(struct os_sim_task_s *t)
+{
+    t->state = OS_SIM_TASK_READY;
+    t->ready_seq = sim.ready_seq++;
+    t->wait_obj = NULL;
+    t->timed = FALSE;
+}
+
+/* Highest priority ready task, FIFO among equals unless a seed is set */
+static struct os_sim_task_s *OsSim_pick(void)
+{
+    struct os_sim_task_s *best = NULL;
+    uint32_t i, count = 0, n;
+
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (OS_SIM_TASK_READY != t->state)
+            continue;
+        if (!best || t->priority > best->priority)
+        {
+            best = t;
+            count = 1;
+        }
+        else if (t->priority == best->priority)
+        {
+            count++;
+            if (OS_SIM_BEFORE(t->ready_seq, best->ready_seq))
+                best = t;
+        }
+    }
+
+    if (!sim.seed || count < 2)
+        return best;
+
+    n = OsSim_rand() % count;
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (OS_SIM_TASK_READY == t->state && t->priority == best->priority && !n--)
+            return t;
+    }
+    return best;
+}
+
+static BOOL OsSim_timerDue(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < OS_SIM_TIMERS_MAX; i++)
+        if (sim.timer[i].active && OS_SIM_DUE(sim.timer[i].expiry))
+            return TRUE;
+    return FALSE;
+}
+
+/* Does the current task have to give way, as it would under preemption? */
+static BOOL OsSim_mustSwitch(void)
+{
+    uint32_t i;
+
+    if (!OS_SIM_BEFORE(sim.tick, sim.limit) || OsSim_timerDue())
+        return TRUE;
+
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (t == sim.current || OS_SIM_TASK_READY != t->state)
+            continue;
+        if (t->priority > sim.current->priority ||
+            (sim.slice_end && t->priority == sim.current->priority))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Back to the scheduler, returns once the current task is picked again */
+static void OsSim_switch(void)
+{
+    struct os_sim_task_s *t = sim.current;
+
+    swapcontext(&t->ctx, &sim.sched_ctx);
+}
+
+static void OsSim_reschedule(void)
+{
+    if (!sim.current || sim.nesting || OS_SIM_TASK_READY != sim.current->state)
+        return;
+    if (!OsSim_mustSwitch())
+        return;
+
+    if (sim.slice_end)
+        sim.current->ready_seq = sim.ready_seq++;
+    OsSim_switch();
+}
+
+static void OsSim_block(struct os_sim_task_s *t, void *obj, TickType_t timeout)
+{
+    t->state = OS_SIM_TASK_BLOCKED;
+    t->wait_obj = obj;
+    t->timed = portMAX_DELAY != timeout;
+    t->wake_time = sim.tick + timeout;
+    t->timed_out = FALSE;
+    OsSim_switch();
+}
+
+static void OsSim_wakeTimeouts(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (OS_SIM_TASK_BLOCKED == t->state && t->timed && OS_SIM_DUE(t->wake_time))
+        {
+            OsSim_makeReady(t);
+            t->timed_out = TRUE;
+        }
+    }
+}
+
+/* Account modelled CPU time of the current task */
+static void OsSim_consume(uint32_t cycles)
+{
+    if (!sim.current)
+        return;
+
+    sim.cycles += cycles;
+    while (sim.cycles >= OS_SIM_CYCLES_PER_TICK)
+    {
+        sim.cycles -= OS_SIM_CYCLES_PER_TICK;
+        sim.tick++;
+        sim.slice_end = TRUE;
+        OsSim_wakeTimeouts();
+    }
+    OsSim_reschedule();
+}
+
+/* Every task blocked: jump to the next timeout or timer expiry, FALSE if
+ * there is none before the end of the run */
+static BOOL OsSim_idle(void)
+{
+    TickType_t next = 0;
+    BOOL found = FALSE;
+    uint32_t i;
+
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (OS_SIM_TASK_BLOCKED == t->state && t->timed &&
+            (!found || OS_SIM_BEFORE(t->wake_time, next)))
+        {
+            next = t->wake_time;
+            found = TRUE;
+        }
+    }
+    for (i = 0; i < OS_SIM_TIMERS_MAX; i++)
+    {
+        if (sim.timer[i].active &&
+            (!found || OS_SIM_BEFORE(sim.timer[i].expiry, next)))
+        {
+            next = sim.timer[i].expiry;
+            found = TRUE;
+        }
+    }
+
+    if (!found)
+    {
+        printf("OsSim: every task blocked for ever at tick %u\n", sim.tick);
+        return FALSE;
+    }
+    if (!OS_SIM_BEFORE(next, sim.limit))
+    {
+        sim.tick = sim.limit;
+        return FALSE;
+    }
+
+    if (OS_SIM_BEFORE(sim.tick, next))
+    {
+        sim.tick = next;
+        sim.cycles = 0;
+    }
+    OsSim_wakeTimeouts();
+    return TRUE;
+}
+
+/* Timer callbacks run in the scheduler context, above every task */
+static void OsSim_runTimers(void)
+{
+    struct os_sim_timer_s *due;
+    uint32_t i;
+
+    for (;;)
+    {
+        due = NULL;
+        for (i = 0; i < OS_SIM_TIMERS_MAX; i++)
+        {
+            struct os_sim_timer_s *timer = &sim.timer[i];
+
+            if (timer->active && OS_SIM_DUE(timer->expiry) &&
+                (!due || OS_SIM_BEFORE(timer->expiry, due->expiry)))
+                due = timer;
+        }
+        if (!due)
+            return;
+
+        if (due->auto_reload)
+            due->expiry += due->period;
+        else
+            due->active = FALSE;
+        due->cb(due);
+    }
+}
+
+static void OsSim_taskEntry(void)
+{
+    sim.current->func(sim.current->param);
+    vTaskDelete(NULL);
+}
+
+static BOOL OsSim_bitsMatch(EventBits_t bits, EventBits_t wait_bits, BaseType_t all)
+{
+    return all ? (bits & wait_bits) == wait_bits : (bits & wait_bits) != 0;
+}
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+void OsSim_enterCritical(void)
+{
+    sim.nesting++;
+}
+
+void OsSim_exitCritical(void)
+{
+    if (sim.nesting && !--sim.nesting)
+        OsSim_reschedule();
+}
+
+/* CPU pause hint, the task is only preempted by what a tick wakes */
+void OsSim_relax(void)
+{
+    OsSim_consume(OS_SIM_RELAX_CYCLES);
+}
+
+/* Interrupts are modelled as critical sections, nothing preempts them */
+UBaseType_t OsSim_enterCriticalFromIsr(void)
+{
+    sim.nesting++;
+    return 0;
+}
+
+void OsSim_exitCriticalFromIsr(UBaseType_t mask)
+{
+    (void)mask;
+    OsSim_exitCritical();
+}
+
+/* Run a handler in interrupt context, tasks it woke run on exit */
+void OsSim_isrEnter(void)
+{
+    sim.isr_nesting++;
+    sim.nesting++;
+    OsSim_consume(OS_SIM_ISR_CYCLES);
+}
+
+void OsSim_isrExit(void)
+{
+    sim.isr_nesting--;
+    OsSim_exitCritical();
+}
+
+BaseType_t xPortIsInsideInterrupt(void)
+{
+    return sim.isr_nesting ? pdTRUE : pdFALSE;
+}
+
+/* Give way to ready tasks of the same or a higher priority */
+void OsSim_yield(void)
+{
+    uint32_t i;
+
+    if (!sim.current)
+        return;
+
+    OsSim_consume(OS_SIM_YIELD_CYCLES);
+    if (sim.nesting)
+        return;
+
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (t != sim.current && OS_SIM_TASK_READY == t->state &&
+            t->priority >= sim.current->priority)
+        {
+            sim.current->ready_seq = sim.ready_seq++;
+            OsSim_switch();
+            return;
+        }
+    }
+}
+
+/* Kernel objects created through the dynamic API, i.e. from the heap on
+ * the target */
+uint32_t OsSim_heapAllocs(void)
+{
+    return sim.heap_allocs;
+}
+
+/* Modelled CPU time since start, reading it costs nothing */
+uint32_t OsSim_cycles(void)
+{
+    return sim.tick * OS_SIM_CYCLES_PER_TICK + sim.cycles;
+}
+
+/* Seeded random sequence for models that want reproducible noise */
+uint32_t OsSim_rand(void)
+{
+    sim.rand = sim.rand * 1664525U + 1013904223U;
+    return sim.rand >> 8;
+}
+
+/* Task, event group and timer pools behind the dynamic and static API */
+static struct os_sim_task_s *OsSim_taskCreate(TaskFunction_t func, const char *name,
+                                              void *param, UBaseType_t priority)
+{
+    struct os_sim_task_s *t = NULL;
+    uint32_t i;
+
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        if (OS_SIM_TASK_FREE == sim.task[i].state)
+        {
+            t = &sim.task[i];
+            break;
+        }
+    }
+    if (!t)
+        return NULL;
+
+    memset(t, 0, sizeof(*t));
+    t->name = name;
+    t->func = func;
+    t->param = param;
+    t->priority = priority < configMAX_PRIORITIES ? priority : configMAX_PRIORITIES - 1;
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = os_sim_stack[i];
+    t->ctx.uc_stack.ss_size = OS_SIM_STACK_SIZE;
+    t->ctx.uc_link = NULL;
+    makecontext(&t->ctx, OsSim_taskEntry, 0);
+    OsSim_makeReady(t);
+    return t;
+}
+
+static struct os_sim_event_group_s *OsSim_eventGroupCreate(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < OS_SIM_EVENT_GROUPS_MAX; i++)
+    {
+        if (!sim.group[i].used)
+        {
+            sim.group[i].used = TRUE;
+            sim.group[i].bits = 0;
+            return &sim.group[i];
+        }
+    }
+    return NULL;
+}
+
+static struct os_sim_timer_s *OsSim_timerCreate(const char *name, TickType_t period,
+                                                UBaseType_t auto_reload, void *id,
+                                                TimerCallbackFunction_t cb)
+{
+    uint32_t i;
+
+    if (!period || !cb)
+        return NULL;
+
+    for (i = 0; i < OS_SIM_TIMERS_MAX; i++)
+    {
+        struct os_sim_timer_s *timer = &sim.timer[i];
+
+        if (!timer->used)
+        {
+            memset(timer, 0, sizeof(*timer));
+            timer->used = TRUE;
+            timer->name = name;
+            timer->period = period;
+            timer->auto_reload = auto_reload;
+            timer->id = id;
+            timer->cb = cb;
+            return timer;
+        }
+    }
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint16_t depth,
+                       void *param, UBaseType_t priority, TaskHandle_t *p_task)
+{
+    struct os_sim_task_s *t;
+
+    (void)depth;
+    t = OsSim_taskCreate(func, name, param, priority);
+    if (!t)
+        return pdFAIL;
+    sim.heap_allocs++;
+    if (p_task)
+        *p_task = t;
+
+    OsSim_reschedule();
+    return pdPASS;
+}
+
+/* The host stack comes from the pool, a host call chain needs far more
+ * than the target depth */
+TaskHandle_t xTaskCreateStatic(TaskFunction_t func, const char *name,
+                               uint32_t depth, void *param,
+                               UBaseType_t priority, StackType_t *stack,
+                               StaticTask_t *tcb)
+{
+    struct os_sim_task_s *t;
+
+    (void)depth;
+    if (!stack || !tcb)
+        return NULL;
+    t = OsSim_taskCreate(func, name, param, priority);
+    if (t)
+        OsSim_reschedule();
+    return t;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    struct os_sim_task_s *t = task ? task : sim.current;
+
+    if (!t)
+        return;
+
+    if (t == sim.current)
+    {
+        /* the scheduler frees the slot once off this stack */
+        t->state = OS_SIM_TASK_DELETED;
+        OsSim_switch();
+    }
+    t->state = OS_SIM_TASK_FREE;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (!sim.current)
+        return;
+
+    if (!ticks)
+        OsSim_yield();
+    else
+        OsSim_block(sim.current, NULL, ticks);
+}
+
+void vTaskSuspend(TaskHandle_t task)
+{
+    struct os_sim_task_s *t = task ? task : sim.current;
+
+    if (!t || OS_SIM_TASK_FREE == t->state || OS_SIM_TASK_DELETED == t->state)
+        return;
+
+    t->state = OS_SIM_TASK_SUSPENDED;
+    if (t == sim.current)
+        OsSim_switch();
+}
+
+/* A task suspended in a wait returns from it as timed out */
+void vTaskResume(TaskHandle_t task)
+{
+    if (!task || OS_SIM_TASK_SUSPENDED != task->state)
+        return;
+
+    OsSim_makeReady(task);
+    task->timed_out = TRUE;
+    OsSim_reschedule();
+}
+
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority)
+{
+    struct os_sim_task_s *t = task ? task : sim.current;
+
+    if (!t)
+        return;
+
+    t->priority = priority < configMAX_PRIORITIES ? priority : configMAX_PRIORITIES - 1;
+    OsSim_reschedule();
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    struct os_sim_task_s *t = task ? task : sim.current;
+
+    return t ? t->priority : tskIDLE_PRIORITY;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return sim.current;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    OsSim_consume(OS_SIM_TICK_READ_CYCLES);
+    return sim.tick;
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return sim.tick;
+}
+
+/* Runs the tasks until the virtual end of the run or a deadlock */
+void vTaskStartScheduler(void)
+{
+    struct os_sim_task_s *t;
+
+    while (OS_SIM_BEFORE(sim.tick, sim.limit))
+    {
+        OsSim_runTimers();
+
+        t = OsSim_pick();
+        if (!t)
+        {
+            if (!OsSim_idle())
+                return;
+            continue;
+        }
+
+        sim.current = t;
+        sim.slice_end = FALSE;
+        sim.switches++;
+        swapcontext(&sim.sched_ctx, &t->ctx);
+        sim.current = NULL;
+
+        if (OS_SIM_TASK_DELETED == t->state)
+            t->state = OS_SIM_TASK_FREE;
+    }
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notify++;
+    if (OS_SIM_TASK_BLOCKED == task->state && task->wait_obj == &task->notify)
+    {
+        OsSim_makeReady(task);
+        OsSim_reschedule();
+    }
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout)
+{
+    struct os_sim_task_s *t = sim.current;
+    uint32_t value;
+
+    if (!t)
+        return 0;
+
+    if (!t->notify && timeout)
+        OsSim_block(t, &t->notify, timeout);
+
+    value = t->notify;
+    if (value)
+        t->notify = clear ? 0 : value - 1;
+    return value;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct os_sim_event_group_s *group = OsSim_eventGroupCreate();
+
+    if (group)
+        sim.heap_allocs++;
+    return group;
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *storage)
+{
+    if (!storage)
+        return NULL;
+    return OsSim_eventGroupCreate();
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+                                BaseType_t clear, BaseType_t all,
+                                TickType_t timeout)
+{
+    struct os_sim_task_s *t = sim.current;
+    EventBits_t value = group->bits;
+
+    if (OsSim_bitsMatch(value, bits, all))
+    {
+        if (clear)
+            group->bits &= ~bits;
+        return value;
+    }
+    if (!timeout || !t)
+        return value;
+
+    t->wait_bits = bits;
+    t->wait_clear = clear;
+    t->wait_all = all;
+    OsSim_block(t, group, timeout);
+
+    return t->timed_out ? group->bits : t->wait_result;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t clear = 0;
+    uint32_t i;
+
+    group->bits |= bits;
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (OS_SIM_TASK_BLOCKED == t->state && t->wait_obj == group &&
+            OsSim_bitsMatch(group->bits, t->wait_bits, t->wait_all))
+        {
+            t->wait_result = group->bits;
+            if (t->wait_clear)
+                clear |= t->wait_bits;
+            OsSim_makeReady(t);
+        }
+    }
+    group->bits &= ~clear;
+    bits = group->bits;
+
+    OsSim_reschedule();
+    return bits;
+}
+
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits,
+                                     BaseType_t *p_woken)
+{
+    /* the switch is held back until OsSim_isrExit */
+    xEventGroupSetBits(group, bits);
+    if (p_woken)
+        *p_woken = pdFALSE;
+    return pdPASS;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    EventBits_t value = group->bits;
+
+    group->bits &= ~bits;
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    return group->bits;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < OS_SIM_SEMAPHORES_MAX; i++)
+    {
+        if (!sim.sem[i].used)
+        {
+            sim.sem[i].used = TRUE;
+            sim.sem[i].given = FALSE;
+            sim.heap_allocs++;
+            return &sim.sem[i];
+        }
+    }
+    return NULL;
+}
+
+/* Hands the semaphore to the longest waiting task of the highest priority */
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    struct os_sim_task_s *waiter = NULL;
+    uint32_t i;
+
+    for (i = 0; i < OS_SIM_TASKS_MAX; i++)
+    {
+        struct os_sim_task_s *t = &sim.task[i];
+
+        if (OS_SIM_TASK_BLOCKED != t->state || t->wait_obj != sem)
+            continue;
+        if (!waiter || t->priority > waiter->priority ||
+            (t->priority == waiter->priority &&
+             OS_SIM_BEFORE(t->ready_seq, waiter->ready_seq)))
+            waiter = t;
+    }
+
+    if (waiter)
+    {
+        OsSim_makeReady(waiter);
+        OsSim_reschedule();
+        return pdTRUE;
+    }
+
+    if (sem->given)
+        return pdFALSE;
+    sem->given = TRUE;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+    struct os_sim_task_s *t = sim.current;
+
+    if (sem->given)
+    {
+        sem->given = FALSE;
+        return pdTRUE;
+    }
+    if (!timeout || !t)
+        return pdFALSE;
+
+    OsSim_block(t, sem, timeout);
+    return t->timed_out ? pdFALSE : pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    sem->used = FALSE;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period,
+                           UBaseType_t auto_reload, void *id,
+                           TimerCallbackFunction_t cb)
+{
+    struct os_sim_timer_s *timer =
+        OsSim_timerCreate(name, period, auto_reload, id, cb);
+
+    if (timer)
+        sim.heap_allocs++;
+    return timer;
+}
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period,
+                                 UBaseType_t auto_reload, void *id,
+                                 TimerCallbackFunction_t cb,
+                                 StaticTimer_t *storage)
+{
+    if (!storage)
+        return NULL;
+    return OsSim_timerCreate(name, period, auto_reload, id, cb);
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+    (void)wait;
+    timer->expiry = sim.tick + timer->period;
+    timer->active = TRUE;
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+    (void)wait;
+    timer->active = FALSE;
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period,
+                              TickType_t wait)
+{
+    if (!period)
+        return pdFAIL;
+
+    timer->period = period;
+    return xTimerStart(timer, wait);
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
+
+/**
+ * \brief Host entry: drv [-s seed] [-t seconds]. The same seed gives the
+ * same run, seed 0 keeps tasks of equal priority in FIFO order.
+ */
+int main(int argc, char **argv)
+{
+    unsigned long run_time = OS_SIM_RUN_TIME_DEFAULT;
+    clock_t start;
+    int i;
+
+    for (i = 1; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "-s"))
+            sim.seed = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+        else if (!strcmp(argv[i], "-t"))
+            run_time = strtoul(argv[i + 1], NULL, 0);
+    }
+    sim.rand = sim.seed;
+    sim.limit = (TickType_t)(run_time * configTICK_RATE_HZ);
+
+    start = clock();
+    main_driver();
+    printf("OsSim: %lu s simulated in %lu ms, seed %u, %u task switches\n",
+           run_time, (unsigned long)((clock() - start) * 1000 / CLOCKS_PER_SEC),
+           sim.seed, sim.switches);
+    return 0;
+}
+
+#endif /* OS_SIM */
@@ -1,6 +1,7 @@
 /*****************************************************************************/
 /* INCLUDES                                                                  */
 /*****************************************************************************/
+#include <string.h>
 #include "Pow.h"
 #include "Drv.h"
 #include "Main.h"
@@ -23,15 +24,143 @@
 /*****************************************************************************/
 /* LOCAL FUNCTIONS                                                           */
 /*****************************************************************************/
+/* Program the HW for a power level */
+static void Pow_setLevelHw(T_POW * p_pow, T_POW_LEVEL level)
+{
+    U32 power = HW_REG_READ(p_pow->p_hw->reg_base, HW_REG_POWER);
+
+    power &= ~HW_POWER_LEVEL_MASK;
+    power |= ((U32)level << HW_POWER_LEVEL_SHIFT) & HW_POWER_LEVEL_MASK;
+    HW_REG_WRITE(p_pow->p_hw->reg_base, HW_REG_POWER, power);
+}
+
+static void Pow_enterLevel(T_POW * p_pow, T_POW_LEVEL level)
+{
+    U32 now = OsGetTimestamp();
+
+    p_pow->stat.residency[p_pow->level] += now - p_pow->level_enter;
+    p_pow->stat.entries[level]++;
+    p_pow->level_enter = now;
+    p_pow->level = level;
+
+    Pow_setLevelHw(p_pow, level);
+}
 
 /*****************************************************************************/
 /* EXPORTED FUNCTIONS                                                        */
 /*****************************************************************************/
 /* Helper function to set the HW clock */
-U32 Pow_setPowCfg(U32 onOff, U32 clock)
+U32 Pow_setPowCfg(volatile t_HW * p_hw, U32 onOff, U32 clock)
+{
+    U32 power = (onOff ? HW_POWER_ON : 0) | (clock << HW_POWER_CLOCK_SHIFT);
+
+    HW_REG_WRITE(p_hw->reg_base, HW_REG_POWER, power);
+    return power;
+}
+
+/* Start managing the power levels of a device, without a policy */
+void Pow_init(T_POW * p_pow, volatile t_HW * p_hw)
+{
+    memset(p_pow, 0x00, sizeof(*p_pow));
+    p_pow->p_hw = p_hw;
+    p_pow->level_enter = OsGetTimestamp();
+}
+
+/* Install a new policy, applied from the next idle period on */
+void Pow_setPolicy(T_POW * p_pow, const T_POW_POLICY * P_POLICY)
+{
+    p_pow->policy = *P_POLICY;
+    p_pow->backoff = 0;
+}
+
+const T_POW_POLICY * Pow_getPolicy(const T_POW * P_POW)
+{
+    return &P_POW->policy;
+}
+
+/**
+ *  Idle hook of the driver thread: step down to the deepest level whose
+ *  idle threshold has passed. Returns the time until the next threshold.
+ */
+U32 Pow_onIdle(T_POW * p_pow, U32 idle_time)
+{
+    U32 level, threshold;
+    T_POW_LEVEL target = p_pow->level;
+
+    /* Only a powered HW is managed, Drv_setMode OFF is explicit */
+    if (!p_pow->p_hw || !Drv_isActive(p_pow->p_hw))
+        return OS_INFINITE;
+
+    for (level = p_pow->level + 1; level < POW_LEVEL_MAX; level++)
+    {
+        threshold = p_pow->policy.idle_time[level] << p_pow->backoff;
+        if (!threshold)
+            continue;
+
+        if (idle_time < threshold)
+        {
+            if (target != p_pow->level)
+                Pow_enterLevel(p_pow, target);
+            return threshold - idle_time;
+        }
+        target = (T_POW_LEVEL)level;
+    }
+
+    if (target != p_pow->level)
+        Pow_enterLevel(p_pow, target);
+
+    return OS_INFINITE;
+}
+
+/**
+ *  Back to full power before an event is handled, returns once the HW is
+ *  ready again. A sleep shorter than the
+ *  threshold that led to it doubles the thresholds (hysteresis), a long
+ *  enough one halves them again.
+ */
+void Pow_wake(T_POW * p_pow)
+{
+    U32 start, latency;
+
+    if (POW_LEVEL_ON == p_pow->level)
+        return;
+
+    start = OsGetTimestamp();
+    if (start - p_pow->level_enter < p_pow->policy.idle_time[p_pow->level])
+    {
+        if (p_pow->backoff < POW_BACKOFF_MAX)
+            p_pow->backoff++;
+    }
+    else if (p_pow->backoff)
+    {
+        p_pow->backoff--;
+    }
+
+    Pow_enterLevel(p_pow, POW_LEVEL_ON);
+
+    /* the HW takes the exit latency of the level it left */
+    if (Drv_isActive(p_pow->p_hw) && !Drv_waitReady(p_pow->p_hw))
+        p_pow->stat.wake_timeouts++;
+
+    latency = OsGetTimestamp() - start;
+    p_pow->stat.wakeups++;
+    p_pow->stat.wake_latency_total += latency;
+    if (latency > p_pow->stat.wake_latency_max)
+        p_pow->stat.wake_latency_max = latency;
+}
+
+T_POW_LEVEL Pow_getLevel(const T_POW * P_POW)
+{
+    return P_POW->level;
+}
+
+/* Statistics including the time spent in the current level so far */
+void Pow_getStat(const T_POW * P_POW, T_POW_STAT * P_STAT)
 {
-    /* TODO - Implementation specific */
-    return (onOff | (clock << 8));
+    *P_STAT = P_POW->stat;
+    P_STAT->level = P_POW->level;
+    P_STAT->residency[P_POW->level] += OsGetTimestamp() - P_POW->level_enter;
+    P_STAT->backoff = P_POW->backoff;
 }
 
 
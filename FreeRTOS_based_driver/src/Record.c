@@ -0,0 +1,546 @@
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include <stddef.h>
+#include <string.h>
+#if defined(OS_SIM)
+#include <stdio.h>
+#include <stdlib.h>
+#endif
+#include "Record.h"
+#include "Isr.h"
+
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+/** \brief Payload of a record without value */
+#define RECORD_EVENT_HEADER_SIZE offsetof(T_RECORD_EVENT, value)
+
+/*****************************************************************************/
+/* TYPE DEFINES                                                              */
+/*****************************************************************************/
+/**
+ * \brief Replayed configuration, the event points at the copy until its
+ * completion
+ */
+typedef struct
+{
+    volatile BOOL busy;
+    U32 post_cycles;
+    union
+    {
+        t_base_cfg mode;
+        T_POW_POLICY policy;
+    } value;
+} T_RECORD_SLOT;
+
+/**
+ * \brief Post times of replayed state requests of one lane, completed in
+ * lane order
+ */
+typedef struct
+{
+    U32 post_cycles[RECORD_SLOTS];
+    volatile U32 wr;
+    volatile U32 rd;
+} T_RECORD_STATE_FIFO;
+
+/*****************************************************************************/
+/* LOCAL DATA                                                                */
+/*****************************************************************************/
+static T_EXPORT record_export = {
+      .export_name = "RECORD",
+      .flush_age = RECORD_FLUSH_AGE,
+};
+
+static struct
+{
+    /* recording */
+    T_RECORD_CFG cfg;
+    volatile BOOL recording;
+    volatile BOOL synced;
+    U32 records;
+    U32 dropped;
+    U32 bytes;
+
+    /* replay */
+    BOOL replaying;
+    T_RECORD_REPLAY_CFG replay;
+    volatile U32 outstanding; /**< Posted, not completed */
+    U32 last_done;            /**< OsGetTimestamp() of the last completion */
+    T_RECORD_SLOT slot[RECORD_SLOTS];
+    T_RECORD_STATE_FIFO state[THREAD_EVENT_PRIORITY_MAX];
+    T_RECORD_REPORT report;
+} record;
+
+/*****************************************************************************/
+/* LOCAL FUNCTIONS                                                           */
+/*****************************************************************************/
+static void Record_append(T_RECORD_TYPE type, const T_RECORD_EVENT * P_EVENT,
+                          U32 value_size)
+{
+    if (record.recording)
+        Export_append(&record_export, (U16)type, P_EVENT,
+                      RECORD_EVENT_HEADER_SIZE + value_size);
+}
+
+/* Post hook of the recorded threads, context of the sender */
+static void Record_onPost(T_THREAD * thread, T_THREAD_EVENT_TYPE event,
+                          const void * data, U32 size,
+                          T_THREAD_EVENT_PRIORITY prio, U32 ttl)
+{
+    const T_EVENT_CFG *P_SET_CFG = (const T_EVENT_CFG *)data;
+    T_RECORD_EVENT entry;
+    U32 i, value_size = 0;
+
+    /* the interrupt record stands for the timeout events it posts, these
+     * come from ISR context where the export can not be used */
+    if (THREAD_EVENT_TIMEOUT == event)
+        return;
+
+    for (i = 0; i < RECORD_THREADS_MAX; i++)
+    {
+        if (record.cfg.threads[i] == thread)
+            break;
+    }
+    if (RECORD_THREADS_MAX == i)
+        return;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.thread = (U8)i;
+    entry.event = (U8)event;
+    entry.prio = (U8)prio;
+    entry.cfg_type = CFG_MAX;
+    entry.ttl = ttl;
+
+    /* pointers are meaningless in a log, the values they point at are
+     * copied; transactions are recorded without their items */
+    if (THREAD_EVENT_SET_CFG == event && size >= sizeof(*P_SET_CFG))
+    {
+        entry.cfg_type = (U8)P_SET_CFG->cfg_type;
+        switch (P_SET_CFG->cfg_type)
+        {
+            case CFG_SET_MODE:
+            case CFG_SET_CLOCK:
+                entry.value.mode = *P_SET_CFG->cfg.P_MODE;
+                value_size = sizeof(entry.value.mode);
+                break;
+            case CFG_SET_POWER_POLICY:
+                entry.value.policy = *(const T_POW_POLICY *)P_SET_CFG->cfg.P_CFG;
+                value_size = sizeof(entry.value.policy);
+                break;
+            default:
+                break;
+        }
+    }
+
+    Record_append(RECORD_TYPE_EVENT, &entry, value_size);
+}
+
+/* Interrupt hook, worker thread taking the line */
+static void Record_onIrq(U32 vector_number)
+{
+    T_RECORD_EVENT entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.thread = RECORD_THREAD_IRQ;
+    entry.event = THREAD_EVENT_TIMEOUT;
+    entry.prio = THREAD_EVENT_PRIORITY_NORMAL;
+    entry.cfg_type = CFG_MAX;
+    entry.value.vector = vector_number;
+    Record_append(RECORD_TYPE_IRQ, &entry, sizeof(entry.value.vector));
+}
+
+static void Record_hook(BOOL on)
+{
+    U32 i;
+
+    for (i = 0; i < RECORD_THREADS_MAX; i++)
+    {
+        if (record.cfg.threads[i])
+            Thread_set_post_cb(record.cfg.threads[i], on ? Record_onPost : NULL);
+    }
+    Isr_setHook(on ? Record_onIrq : NULL);
+}
+
+static void Record_cbSynced(void * p_data)
+{
+    record.synced = TRUE;
+}
+
+/* Completion of a replayed event or call, driver thread */
+static void Record_done(U32 post_cycles)
+{
+    U32 latency = OsGetCycles() - post_cycles;
+    U32 bucket = 0;
+
+    while (bucket < RECORD_LATENCY_BUCKETS - 1 && (latency >> bucket))
+        bucket++;
+    record.report.latency[bucket]++;
+    if (latency > record.report.latency_max)
+        record.report.latency_max = latency;
+    record.report.completed++;
+    record.last_done = OsGetTimestamp();
+    os_atomic_sub_U32(&record.outstanding, 1);
+}
+
+static void Record_cbCfg(void * p_data)
+{
+    T_RECORD_SLOT *p_slot = (T_RECORD_SLOT *)p_data;
+
+    Record_done(p_slot->post_cycles);
+    p_slot->busy = FALSE;
+}
+
+static void Record_stateDone(T_THREAD_EVENT_PRIORITY prio)
+{
+    T_RECORD_STATE_FIFO *p_fifo = &record.state[prio];
+
+    Record_done(p_fifo->post_cycles[p_fifo->rd % RECORD_SLOTS]);
+    p_fifo->rd++;
+}
+
+static void Record_cbStateUrgent(U32 State)
+{
+    Record_stateDone(THREAD_EVENT_PRIORITY_URGENT);
+}
+
+static void Record_cbStateNormal(U32 State)
+{
+    Record_stateDone(THREAD_EVENT_PRIORITY_NORMAL);
+}
+
+static T_RESULT Record_cbCall(void * p_data)
+{
+    Record_done(*(const U32 *)p_data);
+    return RESULT_OK;
+}
+
+static T_RECORD_SLOT *Record_slotGet(void)
+{
+    U32 i;
+
+    for (i = 0; i < RECORD_SLOTS; i++)
+    {
+        if (!record.slot[i].busy)
+        {
+            record.slot[i].busy = TRUE;
+            return &record.slot[i];
+        }
+    }
+    return NULL;
+}
+
+static T_RESULT Record_postCfg(T_THREAD * thread, const T_RECORD_EVENT * P_EVENT,
+                               U32 size)
+{
+    T_RECORD_SLOT *p_slot;
+    T_EVENT_CFG event;
+    U32 value_size;
+    T_RESULT result;
+
+    switch (P_EVENT->cfg_type)
+    {
+        case CFG_SET_MODE:
+        case CFG_SET_CLOCK:
+            value_size = sizeof(P_EVENT->value.mode);
+            break;
+        case CFG_SET_POWER_POLICY:
+            value_size = sizeof(P_EVENT->value.policy);
+            break;
+        default:
+            return RESULT_NOT_SUPPORTED;
+    }
+    if (size < RECORD_EVENT_HEADER_SIZE + value_size)
+        return RESULT_NOT_SUPPORTED;
+
+    p_slot = Record_slotGet();
+    if (!p_slot)
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    memcpy_s(&p_slot->value, sizeof(p_slot->value), &P_EVENT->value, value_size);
+
+    event.cfg_type = (T_CFG)P_EVENT->cfg_type;
+    event.cfg.P_CFG = &p_slot->value;
+    event.completion_callback = Record_cbCfg;
+    event.p_completion_callback_data = p_slot;
+    /* devices are not recorded, replayed on the first one */
+    event.device = NULL;
+
+    /* the driver thread preempts the post, count it beforehand */
+    os_atomic_add_U32(&record.outstanding, 1);
+    p_slot->post_cycles = OsGetCycles();
+    result = Thread_send_event_ttl(thread, THREAD_EVENT_SET_CFG, &event,
+                                   sizeof(event), THREAD_EVENT_SEND_OPTION_DO_NOT_OR,
+                                   (T_THREAD_EVENT_PRIORITY)P_EVENT->prio,
+                                   P_EVENT->ttl);
+    if (FAILED(result))
+    {
+        os_atomic_sub_U32(&record.outstanding, 1);
+        p_slot->busy = FALSE;
+    }
+    return result;
+}
+
+static T_RESULT Record_postState(T_THREAD * thread, const T_RECORD_EVENT * P_EVENT)
+{
+    T_THREAD_EVENT_PRIORITY prio = (T_THREAD_EVENT_PRIORITY)P_EVENT->prio;
+    T_RECORD_STATE_FIFO *p_fifo = &record.state[prio];
+    T_GET_STATE_EVENT event;
+    T_RESULT result;
+
+    event.completion_callback = THREAD_EVENT_PRIORITY_URGENT == prio ?
+                                Record_cbStateUrgent : Record_cbStateNormal;
+    event.device = NULL;
+
+    os_atomic_add_U32(&record.outstanding, 1);
+    p_fifo->post_cycles[p_fifo->wr % RECORD_SLOTS] = OsGetCycles();
+    p_fifo->wr++;
+    result = Thread_send_event_ttl(thread, THREAD_GET_STATE, &event,
+                                   sizeof(event), THREAD_EVENT_SEND_OPTION_DO_NOT_OR,
+                                   prio, P_EVENT->ttl);
+    if (FAILED(result))
+    {
+        /* not queued, the driver thread never saw it */
+        p_fifo->wr--;
+        os_atomic_sub_U32(&record.outstanding, 1);
+    }
+    return result;
+}
+
+static T_RESULT Record_postCall(void)
+{
+    T_SCHEDULER_CALL_PARAMS params = { 0 };
+    U32 post_cycles;
+    T_RESULT result;
+
+    if (!record.replay.scheduler)
+        return RESULT_NOT_SUPPORTED;
+
+    params.args_size = sizeof(post_cycles);
+    os_atomic_add_U32(&record.outstanding, 1);
+    post_cycles = OsGetCycles();
+    result = Scheduler_run_async_ex(record.replay.scheduler, Record_cbCall,
+                                    &post_cycles, &params);
+    if (FAILED(result))
+        os_atomic_sub_U32(&record.outstanding, 1);
+    return result;
+}
+
+/* Post one record again, RESULT_NOT_SUPPORTED if it cannot be replayed */
+static T_RESULT Record_post(const T_EXPORT_RECORD * P_RECORD)
+{
+    const T_RECORD_EVENT *P_EVENT = (const T_RECORD_EVENT *)(P_RECORD + 1);
+    T_THREAD *thread;
+
+    if (RECORD_TYPE_IRQ == P_RECORD->type)
+    {
+        /* the simulated timer interrupt is the only source */
+        Test_simulate_SW_TIMER_interrupt_generation();
+        record.report.irqs++;
+        return RESULT_OK;
+    }
+
+    if (RECORD_TYPE_EVENT != P_RECORD->type ||
+        P_EVENT->thread >= RECORD_THREADS_MAX ||
+        P_EVENT->prio >= THREAD_EVENT_PRIORITY_MAX)
+        return RESULT_NOT_SUPPORTED;
+    thread = record.replay.threads[P_EVENT->thread];
+    if (!thread)
+        return RESULT_NOT_SUPPORTED;
+
+    switch (P_EVENT->event)
+    {
+        case THREAD_EVENT_SET_CFG:
+            return Record_postCfg(thread, P_EVENT, P_RECORD->size);
+        case THREAD_GET_STATE:
+            return Record_postState(thread, P_EVENT);
+        case THREAD_EVENT_SCHED_RUN:
+            /* the recorded call is a pointer, a no-op call takes its place */
+            return Record_postCall();
+        default:
+            /* grants, close and export events follow from the others */
+            return RESULT_NOT_SUPPORTED;
+    }
+}
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+/**
+ * \brief Record the events posted to P_CFG->threads and the interrupts
+ * until Record_stop. The log goes to P_CFG->sink in batches.
+ */
+T_RESULT Record_start(const T_RECORD_CFG * P_CFG)
+{
+    T_RESULT result;
+
+    if (!P_CFG || !P_CFG->sink.write)
+        return RESULT_PARAMETER_ERROR;
+
+    if (record.recording || record.replaying)
+        return RESULT_WRONG_STATE;
+
+    if (!record_export.initialized)
+    {
+        result = Export_init(&record_export);
+        if (FAILED(result))
+            return result;
+    }
+
+    record.cfg = *P_CFG;
+    record.records = record_export.stat.records;
+    record.dropped = record_export.stat.dropped;
+    record.bytes = record_export.stat.bytes;
+    Export_set_sink(&record_export, &P_CFG->sink);
+
+    record.recording = TRUE;
+    Record_hook(TRUE);
+    return RESULT_OK;
+}
+
+/**
+ * \brief Stop recording and wait until the log is written. Blocks the
+ * calling task.
+ */
+T_RESULT Record_stop(T_RECORD_STAT * p_stat)
+{
+    U32 start;
+
+    if (!record.recording)
+        return RESULT_WRONG_STATE;
+
+    Record_hook(FALSE);
+    record.recording = FALSE;
+
+    record.synced = FALSE;
+    Export_flush(&record_export, Record_cbSynced, NULL);
+    start = OsGetTimestamp();
+    while (!record.synced && OsGetTimestamp() - start < RECORD_DRAIN_TIMEOUT)
+        vTaskDelay(1);
+    Export_set_sink(&record_export, NULL);
+
+    if (p_stat)
+    {
+        p_stat->records = record_export.stat.records - record.records;
+        p_stat->dropped = record_export.stat.dropped - record.dropped;
+        p_stat->bytes = record_export.stat.bytes - record.bytes;
+    }
+    return record.synced ? RESULT_OK : RESULT_TIMEOUT;
+}
+
+/**
+ * \brief Post a log again and wait for the driver to finish it. Blocks the
+ * calling task, which has to run below the replayed threads.
+ *
+ * @return RESULT_PARAMETER_ERROR if the log is malformed, RESULT_TIMEOUT
+ * if replayed events did not complete
+ */
+T_RESULT Record_replay(const T_RECORD_REPLAY_CFG * P_CFG,
+                       T_RECORD_REPORT * p_report)
+{
+    const U8 *P_LOG;
+    const T_EXPORT_RECORD *P_RECORD;
+    U32 offset = 0, step, first_time = 0, start = 0, wait;
+    T_RESULT result = RESULT_OK;
+
+    if (!P_CFG || !P_CFG->log || !p_report)
+        return RESULT_PARAMETER_ERROR;
+
+    if (record.recording || record.replaying)
+        return RESULT_WRONG_STATE;
+
+    record.replaying = TRUE;
+    record.replay = *P_CFG;
+    record.outstanding = 0;
+    memset(record.slot, 0, sizeof(record.slot));
+    memset(record.state, 0, sizeof(record.state));
+    memset(&record.report, 0, sizeof(record.report));
+
+    P_LOG = (const U8 *)P_CFG->log;
+    while (offset + sizeof(T_EXPORT_RECORD) <= P_CFG->size)
+    {
+        P_RECORD = (const T_EXPORT_RECORD *)(P_LOG + offset);
+        step = sizeof(T_EXPORT_RECORD) + EXPORT_ALIGN(P_RECORD->size);
+        if (step > P_CFG->size - offset ||
+            P_RECORD->size < RECORD_EVENT_HEADER_SIZE ||
+            P_RECORD->size > sizeof(T_RECORD_EVENT))
+        {
+            result = RESULT_PARAMETER_ERROR;
+            break;
+        }
+        offset += step;
+
+        if (!record.report.records++)
+        {
+            first_time = P_RECORD->time;
+            start = OsGetTimestamp();
+        }
+        record.report.recorded = P_RECORD->time - first_time;
+
+        if (RECORD_REPLAY_TIMED == P_CFG->mode)
+        {
+            wait = (P_RECORD->time - first_time) - (OsGetTimestamp() - start);
+            if ((S32)wait > 0)
+                vTaskDelay(wait);
+        }
+        while (record.outstanding >= RECORD_SLOTS)
+            vTaskDelay(1);
+
+        if (SUCCEEDED(Record_post(P_RECORD)))
+            record.report.replayed++;
+        else
+            record.report.skipped++;
+    }
+
+    wait = OsGetTimestamp();
+    while (record.outstanding && OsGetTimestamp() - wait < RECORD_DRAIN_TIMEOUT)
+        vTaskDelay(1);
+    if (record.outstanding && SUCCEEDED(result))
+        result = RESULT_TIMEOUT;
+
+    record.report.duration = (record.report.completed ? record.last_done :
+                              OsGetTimestamp()) - start;
+    *p_report = record.report;
+    record.replaying = FALSE;
+    return result;
+}
+
+#if defined(OS_SIM)
+/**
+ * \brief Replay a log written to a file of the Linux host, see
+ * Export_fd_write. P_CFG->log and size are ignored.
+ */
+T_RESULT Record_replayFile(const char * P_PATH,
+                           const T_RECORD_REPLAY_CFG * P_CFG,
+                           T_RECORD_REPORT * p_report)
+{
+    T_RECORD_REPLAY_CFG cfg;
+    FILE *p_file;
+    void *p_log;
+    long size;
+    T_RESULT result = RESULT_FAILURE;
+
+    if (!P_PATH || !P_CFG)
+        return RESULT_PARAMETER_ERROR;
+
+    p_file = fopen(P_PATH, "rb");
+    if (!p_file)
+        return RESULT_FAILURE;
+
+    if (!fseek(p_file, 0, SEEK_END) && (size = ftell(p_file)) > 0 &&
+        !fseek(p_file, 0, SEEK_SET))
+    {
+        p_log = malloc((size_t)size);
+        if (p_log && (size_t)size == fread(p_log, 1, (size_t)size, p_file))
+        {
+            cfg = *P_CFG;
+            cfg.log = p_log;
+            cfg.size = (U32)size;
+            result = Record_replay(&cfg, p_report);
+        }
+        free(p_log);
+    }
+    fclose(p_file);
+    return result;
+}
+#endif
@@ -10,6 +10,21 @@
 #include <string.h>
 #include "Scheduler.h"
 
+/*******************************************************************
+ *  LOCAL DATA
+ ******************************************************************/
+/**
+ * \brief Argument copies too large for a queue slot, shared by all
+ * schedulers
+ */
+static struct
+{
+    spinlock_t lock;
+    U32 used; /**< Bit n set if block n is allocated */
+    void *block[SCHEDULER_ARGS_POOL_BLOCKS]
+               [SCHEDULER_ARGS_POOL_BLOCK_SIZE / sizeof(void *)];
+} scheduler_args_pool;
+
 /*******************************************************************
  *  LOCAL FUNCTIONS
  ******************************************************************/
@@ -31,85 +46,664 @@ static void scheduler_grant_decr_(T_SCHEDULER *scheduler,
     os_atomic_sub_U32(&scheduler->current_grant, grant);
 }
 
+/* Add the grant of all refill periods elapsed since the last refill */
+static void scheduler_refill_(T_SCHEDULER *scheduler, U32 now)
+{
+    U32 periods, grant;
+
+    if (!scheduler->refill_period)
+        return;
+
+    periods = (now - scheduler->last_refill) / scheduler->refill_period;
+    if (!periods)
+        return;
+
+    scheduler->last_refill += periods * scheduler->refill_period;
+
+    if (scheduler->current_grant >= scheduler->burst)
+        return;
+
+    grant = scheduler->burst - scheduler->current_grant;
+    if (periods <= grant / scheduler->refill_amount)
+        grant = periods * scheduler->refill_amount;
+
+    scheduler_grant_incr_(scheduler, grant);
+}
+
+static void scheduler_refill_timer_cb_(OsTimer timer)
+{
+    T_SCHEDULER *scheduler = (T_SCHEDULER *)OsTimerGetArg(timer);
+    T_SCHEDULER_EVENT grant_event;
+
+    grant_event.scheduler = scheduler;
+    grant_event.tag = 0;
+
+    Thread_send_event_ex(scheduler->thread, THREAD_EVENT_SCHED_GRANT,
+                         &grant_event, sizeof(grant_event),
+                         THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
+}
+
+/* Head of the queue can not run for lack of grant */
+static void scheduler_starve_begin_(T_SCHEDULER *scheduler, U32 now)
+{
+    U32 elapsed;
+
+    if (!scheduler->starving)
+    {
+        scheduler->starving = TRUE;
+        scheduler->starve_start = now;
+        scheduler->stat.starved++;
+    }
+
+    /* without refill only Scheduler_grant() can restart the queue */
+    if (scheduler->refill_period)
+    {
+        elapsed = now - scheduler->last_refill;
+        OsTimerStart(&scheduler->refill_timer,
+                     elapsed < scheduler->refill_period ?
+                     scheduler->refill_period - elapsed : 1);
+    }
+}
+
+static void scheduler_starve_end_(T_SCHEDULER *scheduler, U32 now)
+{
+    U32 starved_time;
+
+    if (!scheduler->starving)
+        return;
+
+    scheduler->starving = FALSE;
+    starved_time = now - scheduler->starve_start;
+    scheduler->stat.starved_time += starved_time;
+    if (starved_time > scheduler->stat.starved_time_max)
+        scheduler->stat.starved_time_max = starved_time;
+}
+
+/* TRUE if queue slot a has to run before queue slot b */
+static BOOL scheduler_call_before_(const T_SCHEDULER *scheduler, U16 a, U16 b)
+{
+    const T_SCHEDULER_REMOTE_CALL *call_a = &scheduler->queue[a];
+    const T_SCHEDULER_REMOTE_CALL *call_b = &scheduler->queue[b];
+
+    if (call_a->has_deadline != call_b->has_deadline)
+        return call_a->has_deadline;
+
+    if (call_a->has_deadline && call_a->deadline != call_b->deadline)
+        return (S32)(call_a->deadline - call_b->deadline) < 0;
+
+    return (S32)(call_a->seq - call_b->seq) < 0;
+}
+
+static void scheduler_heap_swap_(T_SCHEDULER *scheduler, U16 i, U16 j)
+{
+    U16 slot = scheduler->heap[i];
+
+    scheduler->heap[i] = scheduler->heap[j];
+    scheduler->heap[j] = slot;
+}
+
+static void scheduler_heap_sift_up_(T_SCHEDULER *scheduler, U16 pos)
+{
+    while (pos)
+    {
+        U16 parent = (pos - 1) / 2;
+
+        if (!scheduler_call_before_(scheduler, scheduler->heap[pos],
+                                    scheduler->heap[parent]))
+            break;
+        scheduler_heap_swap_(scheduler, pos, parent);
+        pos = parent;
+    }
+}
+
+static void scheduler_heap_sift_down_(T_SCHEDULER *scheduler, U16 pos)
+{
+    for (;;)
+    {
+        U16 first = pos;
+        U16 child = 2 * pos + 1;
+
+        if (child < scheduler->heap_count &&
+            scheduler_call_before_(scheduler, scheduler->heap[child],
+                                   scheduler->heap[first]))
+            first = child;
+        child++;
+        if (child < scheduler->heap_count &&
+            scheduler_call_before_(scheduler, scheduler->heap[child],
+                                   scheduler->heap[first]))
+            first = child;
+
+        if (first == pos)
+            break;
+        scheduler_heap_swap_(scheduler, pos, first);
+        pos = first;
+    }
+}
+
+/* Take a queue slot out of the deadline heap and free it */
+static void scheduler_heap_remove_(T_SCHEDULER *scheduler, U16 slot)
+{
+    U16 pos;
+
+    os_spinlock_obtain(&scheduler->lock);
+
+    for (pos = 0; pos < scheduler->heap_count; pos++)
+    {
+        if (scheduler->heap[pos] == slot)
+        {
+            scheduler->heap_count--;
+            if (pos != scheduler->heap_count)
+            {
+                scheduler->heap[pos] = scheduler->heap[scheduler->heap_count];
+                scheduler_heap_sift_up_(scheduler, pos);
+                scheduler_heap_sift_down_(scheduler, pos);
+            }
+            break;
+        }
+    }
+    scheduler->queue[slot].func = NULL;
+
+    os_spinlock_release(&scheduler->lock);
+}
+
+/* Next call to execute, NULL if the queue is empty */
+static T_SCHEDULER_REMOTE_CALL *scheduler_peek_(T_SCHEDULER *scheduler)
+{
+    T_SCHEDULER_REMOTE_CALL *remote_call = NULL;
+
+    if (SCHEDULER_ORDER_EDF == scheduler->order)
+    {
+        os_spinlock_obtain(&scheduler->lock);
+        if (scheduler->heap_count)
+            remote_call = &scheduler->queue[scheduler->heap[0]];
+        os_spinlock_release(&scheduler->lock);
+    }
+    else if (scheduler->queue_rd != scheduler->queue_wr)
+    {
+        remote_call = &scheduler->queue[scheduler->queue_rd];
+    }
+
+    return remote_call;
+}
+
+/* Release the call returned by scheduler_peek_ */
+static void scheduler_pop_(T_SCHEDULER *scheduler,
+                           T_SCHEDULER_REMOTE_CALL *remote_call)
+{
+    if (SCHEDULER_ORDER_EDF == scheduler->order)
+        scheduler_heap_remove_(scheduler,
+                               (U16)(remote_call - scheduler->queue));
+    else
+        scheduler->queue_rd = (scheduler->queue_rd + 1) % scheduler->queue_length;
+}
+
+static void *scheduler_args_alloc_(void)
+{
+    void *block = NULL;
+    U32 i;
+
+    os_spinlock_obtain(&scheduler_args_pool.lock);
+    for (i = 0; i < SCHEDULER_ARGS_POOL_BLOCKS; i++)
+    {
+        if (!(scheduler_args_pool.used & (1U << i)))
+        {
+            scheduler_args_pool.used |= (1U << i);
+            block = scheduler_args_pool.block[i];
+            break;
+        }
+    }
+    os_spinlock_release(&scheduler_args_pool.lock);
+
+    return block;
+}
+
+static void scheduler_args_free_(void *block)
+{
+    U32 i = (U32)(((void **)block - scheduler_args_pool.block[0]) /
+                  (SCHEDULER_ARGS_POOL_BLOCK_SIZE / sizeof(void *)));
+
+    os_spinlock_obtain(&scheduler_args_pool.lock);
+    scheduler_args_pool.used &= ~(1U << i);
+    os_spinlock_release(&scheduler_args_pool.lock);
+}
+
+/* Signal the caller of a finished or dropped call */
+static void scheduler_complete_(T_SCHEDULER *scheduler,
+                                T_SCHEDULER_REMOTE_CALL *remote_call,
+                                T_RESULT call_result)
+{
+    /* drop the inherited priority before the caller gets to run again */
+    if (remote_call->inherit_priority)
+    {
+        Thread_priority_release(scheduler->thread,
+                                remote_call->inherit_priority);
+        remote_call->inherit_priority = 0;
+    }
+
+    if (remote_call->args_pool)
+    {
+        scheduler_args_free_(remote_call->args_pool);
+        remote_call->args_pool = NULL;
+    }
+
+    if (remote_call->result)
+        *remote_call->result = call_result;
+
+    /* Make sure all the memory operations are complete before
+     * signalling completion. */
+    os_data_sync_barrier();
+
+    if (remote_call->sem)
+        OsSemRelease(remote_call->sem);
+
+    remote_call->processed = TRUE;
+}
+
+/* Take a queued call for running or dropping, FALSE if it was cancelled */
+static BOOL scheduler_claim_(T_SCHEDULER *scheduler,
+                             T_SCHEDULER_REMOTE_CALL *remote_call)
+{
+    BOOL cancelled;
+
+    os_spinlock_obtain(&scheduler->lock);
+    cancelled = remote_call->processed;
+    remote_call->processed = TRUE;
+    os_spinlock_release(&scheduler->lock);
+
+    return !cancelled;
+}
+
+/**
+ *  Cancel a queued call by its enqueue seq, for a blocking caller which
+ *  stopped waiting or a call whose wake up could not be posted. Returns
+ *  RESULT_WRONG_STATE if the scheduler thread already claimed the call,
+ *  a blocking caller then has to wait for the completion, result and sem
+ *  live on its stack. RESULT_NOT_HANDLED if the call is gone from the
+ *  queue: completed, or dropped by a re-init, its sem is released.
+ */
+static T_RESULT scheduler_cancel_(T_SCHEDULER *scheduler, U32 seq)
+{
+    T_SCHEDULER_REMOTE_CALL *remote_call = NULL;
+    T_RESULT local_result = RESULT_NOT_HANDLED;
+    void *args_pool = NULL;
+    U32 inherit_priority = 0;
+    U16 i, slot, count;
+
+    os_spinlock_obtain(&scheduler->lock);
+    if (SCHEDULER_ORDER_EDF == scheduler->order)
+        count = scheduler->heap_count;
+    else
+        count = (scheduler->queue_wr + scheduler->queue_length -
+                 scheduler->queue_rd) % scheduler->queue_length;
+    for (i = 0; i < count; i++)
+    {
+        if (SCHEDULER_ORDER_EDF == scheduler->order)
+            slot = scheduler->heap[i];
+        else
+            slot = (scheduler->queue_rd + i) % scheduler->queue_length;
+        if (scheduler->queue[slot].seq != seq)
+            continue;
+        if (scheduler->queue[slot].processed)
+        {
+            local_result = RESULT_WRONG_STATE;
+            break;
+        }
+        local_result = RESULT_OK;
+        remote_call = &scheduler->queue[slot];
+        remote_call->processed = TRUE;
+        remote_call->result = NULL;
+        remote_call->sem = NULL;
+        args_pool = remote_call->args_pool;
+        remote_call->args_pool = NULL;
+        inherit_priority = remote_call->inherit_priority;
+        remote_call->inherit_priority = 0;
+        break;
+    }
+    os_spinlock_release(&scheduler->lock);
+
+    /* the caller stopped waiting, the thread must not keep its priority */
+    if (inherit_priority)
+        Thread_priority_release(scheduler->thread, inherit_priority);
+    if (args_pool)
+        scheduler_args_free_(args_pool);
+
+    return local_result;
+}
+
+/**
+ *  Report a call which reached the head of the queue after its deadline.
+ *  Returns TRUE if the call has to be dropped.
+ */
+static BOOL scheduler_check_deadline_(T_SCHEDULER *scheduler,
+                                      T_SCHEDULER_REMOTE_CALL *remote_call)
+{
+    S32 lateness;
+
+    if (!remote_call->has_deadline)
+        return FALSE;
+
+    lateness = (S32)(OsGetTimestamp() - remote_call->deadline);
+    if (lateness <= 0)
+        return FALSE;
+
+    if (!remote_call->deadline_missed)
+    {
+        remote_call->deadline_missed = TRUE;
+        scheduler->stat.deadline_missed++;
+        LOG_EVENT(SCHEDULER_DEADLINE_MISSED, lateness);
+        if (scheduler->miss_cb)
+            scheduler->miss_cb(remote_call->func, remote_call->func_args,
+                               (U32)lateness);
+    }
+
+    return scheduler->drop_missed;
+}
+
 static T_RESULT scheduler_enqueue_(T_SCHEDULER *scheduler,
                                            T_SCHEDULER_CALLBACK func,
                                            void *func_args,
                                            T_RESULT *result,
-                                           OsSem *sem)
+                                           OsSem *sem,
+                                           const T_SCHEDULER_CALL_PARAMS *params,
+                                           U32 inherit_priority,
+                                           U32 *p_seq)
 {
     T_SCHEDULER_REMOTE_CALL *remote_call;
     T_RESULT local_result = RESULT_OK;
-
-    U16 new_wr;
+    U32 cost = params ? params->cost : SCHEDULER_GRANT_1;
+    U32 args_size = params ? params->args_size : 0;
+    void *args_pool = NULL;
+    U16 new_wr = 0;
+    U16 slot;
 
     if (!scheduler)
         return RESULT_PARAMETER_ERROR;
 
+    /* a call costing more than the bucket holds would never run */
+    if (scheduler->refill_period && cost > scheduler->burst)
+        return RESULT_PARAMETER_ERROR;
+
+    if (args_size > SCHEDULER_ARGS_POOL_BLOCK_SIZE ||
+        (args_size && !func_args))
+        return RESULT_PARAMETER_ERROR;
+
+    if (args_size > SCHEDULER_INLINE_ARGS_SIZE)
+    {
+        args_pool = scheduler_args_alloc_();
+        if (!args_pool)
+        {
+            scheduler->stat.args_pool_empty++;
+            return RESULT_NO_RESOURCES_AVAILABLE;
+        }
+        memcpy_s(args_pool, SCHEDULER_ARGS_POOL_BLOCK_SIZE, func_args, args_size);
+        func_args = args_pool;
+    }
+
     os_spinlock_obtain(&scheduler->lock);
 
+    if (SCHEDULER_ORDER_EDF == scheduler->order)
+    {
+        /* any free slot, the heap keeps the order */
+        for (slot = 0; slot < scheduler->queue_length; slot++)
+        {
+            if (!scheduler->queue[slot].func)
+                break;
+        }
+    }
+    else
+    {
+        slot = scheduler->queue_wr;
+        new_wr = (scheduler->queue_wr + 1) % scheduler->queue_length;
+        if (new_wr == scheduler->queue_rd)
+            slot = scheduler->queue_length;
+    }
+
     /* check if queue is full */
-    new_wr = (scheduler->queue_wr + 1) % scheduler->queue_length;
-    if (new_wr == scheduler->queue_rd)
+    if (slot >= scheduler->queue_length)
     {
+        if (args_pool)
+            scheduler_args_free_(args_pool);
         local_result = RESULT_NO_RESOURCES_AVAILABLE;
         goto exit;
     }
 
-    remote_call = &scheduler->queue[scheduler->queue_wr];
+    remote_call = &scheduler->queue[slot];
+    if (args_size && !args_pool)
+    {
+        memcpy_s(remote_call->args_inline, sizeof(remote_call->args_inline),
+                 func_args, args_size);
+        func_args = remote_call->args_inline;
+    }
     remote_call->processed = FALSE;
     remote_call->func = func;
     remote_call->func_args = func_args;
+    remote_call->args_pool = args_pool;
+    remote_call->inherit_priority = inherit_priority;
+    if (inherit_priority)
+        Thread_priority_inherit(scheduler->thread, inherit_priority);
     remote_call->result = result;
     remote_call->sem = sem;
+    remote_call->cost = cost;
+    remote_call->enqueue_time = OsGetTimestamp();
+    remote_call->seq = scheduler->seq++;
+    *p_seq = remote_call->seq;
+    remote_call->has_deadline = params && params->deadline;
+    remote_call->deadline = remote_call->enqueue_time +
+                            (params ? params->deadline : 0);
+    remote_call->deadline_missed = FALSE;
 
     /*
      * Make sure the info makes it to memory.  Make sure to do this BEFORE
-     * queue_wr index is updated.
+     * queue_wr index or the heap is updated.
      */
     os_data_sync_barrier();
 
-    scheduler->queue_wr = new_wr;
+    if (SCHEDULER_ORDER_EDF == scheduler->order)
+    {
+        scheduler->heap[scheduler->heap_count] = slot;
+        scheduler->heap_count++;
+        scheduler_heap_sift_up_(scheduler, scheduler->heap_count - 1);
+    }
+    else
+    {
+        scheduler->queue_wr = new_wr;
+    }
 exit:
     os_spinlock_release(&scheduler->lock);
 
     return local_result;
 }
 
-static void scheduler_process_(T_SCHEDULER *scheduler)
+/**
+ *  Execute queued calls while both the grant and the round robin deficit
+ *  cover their cost. Returns TRUE if the scheduler stopped on its deficit
+ *  only and wants another round.
+ */
+static BOOL scheduler_process_(T_SCHEDULER *scheduler)
 {
     T_SCHEDULER_REMOTE_CALL *remote_call;
     T_RESULT call_result;
-    U16 queue_rd;
+    U32 wait_time;
+    BOOL more = FALSE;
 
     if (!scheduler || (scheduler->state != SCHEDULER_RUN))
-        return;
+        return FALSE;
 
-    queue_rd = scheduler->queue_rd;
-    while (scheduler->current_grant && (queue_rd != scheduler->queue_wr))
-    {
+    scheduler_refill_(scheduler, OsGetTimestamp());
 
-        remote_call = &scheduler->queue[queue_rd];
+    while (NULL != (remote_call = scheduler_peek_(scheduler)))
+    {
         if (!remote_call->processed)
         {
+            if (scheduler_check_deadline_(scheduler, remote_call))
+            {
+                if (scheduler_claim_(scheduler, remote_call))
+                {
+                    scheduler->stat.deadline_dropped++;
+                    scheduler_complete_(scheduler, remote_call, RESULT_TIMEOUT);
+                }
+                scheduler_pop_(scheduler, remote_call);
+                continue;
+            }
+            if (scheduler->current_grant < remote_call->cost)
+            {
+                /* don't bank deficit while waiting for grant */
+                if (scheduler->deficit > remote_call->cost)
+                    scheduler->deficit = remote_call->cost;
+                scheduler_starve_begin_(scheduler, OsGetTimestamp());
+                break;
+            }
+            if (scheduler->deficit < remote_call->cost)
+            {
+                more = TRUE;
+                break;
+            }
+            if (!scheduler_claim_(scheduler, remote_call))
+            {
+                scheduler_pop_(scheduler, remote_call);
+                continue;
+            }
+            scheduler_starve_end_(scheduler, OsGetTimestamp());
+
+            wait_time = OsGetTimestamp() - remote_call->enqueue_time;
+            scheduler->stat.wait_time += wait_time;
+            if (wait_time > scheduler->stat.wait_time_max)
+                scheduler->stat.wait_time_max = wait_time;
+
+            /* take the grant before the call, so nested inline calls
+             * can not spend it twice */
+            scheduler_grant_decr_(scheduler, remote_call->cost);
+            scheduler->deficit -= remote_call->cost;
+
+            Thread_watch_begin(scheduler->thread, (T_THREAD_FUNC)remote_call->func);
             call_result = remote_call->func(remote_call->func_args);
-            if (remote_call->result)
-                *remote_call->result = call_result;
+            Thread_watch_end(scheduler->thread);
+            scheduler_complete_(scheduler, remote_call, call_result);
 
-            /* Make sure all the memory operations are complete before
-             * signalling completion. */
-            os_data_sync_barrier();
+            scheduler->stat.calls++;
+            scheduler->stat.grant_consumed += remote_call->cost;
+        }
 
-            if (remote_call->sem)
-                OsSemRelease(remote_call->sem);
+        scheduler_pop_(scheduler, remote_call);
+    }
 
-            remote_call->processed = TRUE;
+    /* an idle scheduler does not keep its deficit */
+    if (!remote_call)
+        scheduler->deficit = 0;
+
+    return more;
+}
+
+/**
+ *  Serve all schedulers of a thread with deficit round robin. Every round
+ *  adds share * SCHEDULER_DRR_QUANTUM to the deficit of each scheduler
+ *  with queued calls, rounds repeat until no scheduler is left waiting
+ *  on its deficit alone.
+ */
+static void scheduler_service_thread_(T_THREAD *thread)
+{
+    T_SCHEDULER *scheduler;
+    BOOL more;
+
+    do
+    {
+        more = FALSE;
+        for (scheduler = (T_SCHEDULER *)thread->schedulers; scheduler;
+             scheduler = scheduler->next)
+        {
+            /* moved to another thread by a re-init meanwhile, its next
+             * link may be on that list already: start over */
+            if (scheduler->thread != thread)
+            {
+                more = TRUE;
+                break;
+            }
+            if (scheduler->state != SCHEDULER_RUN ||
+                !scheduler_peek_(scheduler))
+                continue;
+
+            scheduler->deficit += (scheduler->share ? scheduler->share : 1) *
+                                  SCHEDULER_DRR_QUANTUM;
+            if (scheduler_process_(scheduler))
+                more = TRUE;
         }
+    } while (more);
+}
 
-        queue_rd = (queue_rd + 1) % scheduler->queue_length;
-        scheduler->queue_rd = queue_rd;
+/* Take the scheduler off the set of the thread it was served by */
+static void scheduler_unlink_(T_SCHEDULER *scheduler)
+{
+    T_THREAD *thread = scheduler->thread;
+    T_SCHEDULER *it;
+
+    if (!thread)
+        return;
 
-        scheduler_grant_decr_(scheduler, SCHEDULER_GRANT_1);
+    if (thread->schedulers == scheduler)
+    {
+        thread->schedulers = scheduler->next;
     }
+    else
+    {
+        for (it = (T_SCHEDULER *)thread->schedulers; it; it = it->next)
+        {
+            if (it->next == scheduler)
+            {
+                it->next = scheduler->next;
+                break;
+            }
+        }
+    }
+    os_data_sync_barrier();
+}
+
+/* Add the scheduler to the set served by its thread (once) */
+static void scheduler_link_(T_SCHEDULER *scheduler, T_THREAD *thread)
+{
+    T_SCHEDULER *it;
+
+    for (it = (T_SCHEDULER *)thread->schedulers; it; it = it->next)
+    {
+        if (it == scheduler)
+            return;
+    }
+
+    scheduler->next = (T_SCHEDULER *)thread->schedulers;
+    os_data_sync_barrier();
+    thread->schedulers = scheduler;
+}
+
+/**
+ *  Scheduler_run from the scheduler's own thread: the queue is served by
+ *  this very thread, so waiting for it would deadlock. Run func() right
+ *  away instead, ahead of the queued calls, with the same grant
+ *  accounting as a queued call.
+ */
+static T_RESULT scheduler_run_inline_(T_SCHEDULER *scheduler,
+                                      T_SCHEDULER_CALLBACK func,
+                                      void *func_args,
+                                      const T_SCHEDULER_CALL_PARAMS *params)
+{
+    U32 cost = params ? params->cost : SCHEDULER_GRANT_1;
+    T_RESULT result;
+
+    if (scheduler->state != SCHEDULER_RUN)
+        return RESULT_WRONG_STATE;
+
+    scheduler_refill_(scheduler, OsGetTimestamp());
+    if (scheduler->current_grant < cost)
+        return RESULT_NO_RESOURCES_AVAILABLE;
+
+    scheduler_grant_decr_(scheduler, cost);
+    Thread_watch_begin(scheduler->thread, (T_THREAD_FUNC)func);
+    result = func(func_args);
+    Thread_watch_end(scheduler->thread);
+
+    scheduler->stat.calls++;
+    scheduler->stat.inline_calls++;
+    scheduler->stat.grant_consumed += cost;
+
+    return result;
 }
 
 /*******************************************************************
@@ -119,27 +713,105 @@ T_RESULT Scheduler_init(T_SCHEDULER *scheduler,
                                      T_THREAD *thread,
                                      U32 initial_grant)
 {
+    U16 slot;
+
     if (!scheduler || !thread)
         return RESULT_PARAMETER_ERROR;
 
+    /* calls dropped by a re-init give their argument copies and
+     * inherited priorities back, blocked callers return RESULT_CANCELLED */
+    for (slot = 0; scheduler->initialized && slot < scheduler->queue_length; slot++)
+    {
+        if (scheduler->queue[slot].func && !scheduler->queue[slot].processed)
+            scheduler_complete_(scheduler, &scheduler->queue[slot],
+                                RESULT_CANCELLED);
+    }
+
+    /* a re-init onto another thread leaves the list of the old one */
+    if (scheduler->initialized && scheduler->thread != thread)
+        scheduler_unlink_(scheduler);
     scheduler->thread = thread;
+    os_data_sync_barrier();
     scheduler->state = SCHEDULER_RUN;
 
     os_spinlock_init(&scheduler->lock);
 
     scheduler->current_grant = initial_grant;
+    scheduler->last_refill = OsGetTimestamp();
+    scheduler->starving = FALSE;
+    scheduler->deficit = 0;
+    memset(&scheduler->stat, 0x00, sizeof(scheduler->stat));
 
     scheduler->queue_wr = 0;
     scheduler->queue_rd = 0;
+    scheduler->heap_count = 0;
 
     scheduler->initialized = TRUE;
 
     memset(scheduler->queue, 0x00,
            sizeof(T_SCHEDULER_REMOTE_CALL) * scheduler->queue_length);
 
+    scheduler_link_(scheduler, thread);
+
+    return RESULT_OK;
+}
+
+/**
+ *  Set the weight of the scheduler among all schedulers sharing its
+ *  thread. A scheduler of share N runs N times the grant of a scheduler
+ *  of share 1 per round.
+ */
+T_RESULT Scheduler_set_share(T_SCHEDULER *scheduler, U32 share)
+{
+    if (!scheduler || !share)
+        return RESULT_PARAMETER_ERROR;
+
+    scheduler->share = share;
+
     return RESULT_OK;
 }
 
+/**
+ *  Select FIFO or earliest deadline first execution. Late calls are
+ *  reported through miss_cb (if set) and, with drop_missed, completed
+ *  with RESULT_TIMEOUT instead of being executed. The order can only be
+ *  changed while the queue is empty.
+ */
+T_RESULT Scheduler_set_order(T_SCHEDULER *scheduler,
+                                     T_SCHEDULER_ORDER order,
+                                     BOOL drop_missed,
+                                     T_SCHEDULER_MISS_CB miss_cb)
+{
+    T_RESULT local_result = RESULT_OK;
+
+    if (!scheduler || (SCHEDULER_ORDER_EDF == order && !scheduler->heap))
+        return RESULT_PARAMETER_ERROR;
+
+    os_spinlock_obtain(&scheduler->lock);
+
+    if (scheduler->queue_rd != scheduler->queue_wr || scheduler->heap_count)
+    {
+        local_result = RESULT_WRONG_STATE;
+        goto exit;
+    }
+
+    if (scheduler->order != order)
+    {
+        /* EDF hands out free slots (func == NULL) in any order */
+        memset(scheduler->queue, 0x00,
+               sizeof(T_SCHEDULER_REMOTE_CALL) * scheduler->queue_length);
+        scheduler->queue_wr = 0;
+        scheduler->queue_rd = 0;
+        scheduler->order = order;
+    }
+    scheduler->drop_missed = drop_missed;
+    scheduler->miss_cb = miss_cb;
+exit:
+    os_spinlock_release(&scheduler->lock);
+
+    return local_result;
+}
+
 T_RESULT Scheduler_grant(T_SCHEDULER *scheduler, U32 grant)
 {
     T_SCHEDULER_EVENT grant_event;
@@ -162,12 +834,67 @@ T_RESULT Scheduler_grant(T_SCHEDULER *scheduler, U32 grant)
                                     &grant_event, sizeof(grant_event),THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
 }
 
+/**
+ *  Enable token bucket behaviour: refill_amount grant is added every
+ *  refill_period up to burst, waking the scheduler thread when queued
+ *  calls wait for it. A refill_period of 0 turns automatic refill off.
+ */
+T_RESULT Scheduler_set_rate(T_SCHEDULER *scheduler,
+                                    U32 refill_amount,
+                                    U32 refill_period,
+                                    U32 burst)
+{
+    U32 rc;
+
+    if (!scheduler)
+        return RESULT_PARAMETER_ERROR;
+
+    if (refill_period && (!refill_amount || burst < refill_amount))
+        return RESULT_PARAMETER_ERROR;
+
+    if (refill_period && !scheduler->refill_timer)
+    {
+#if defined(DRV_STATIC_ALLOC)
+        rc = OsTimerCreateStatic(&scheduler->refill_timer, scheduler->scheduler_name,
+                                 scheduler_refill_timer_cb_, scheduler,
+                                 &scheduler->refill_timer_mem);
+#else
+        rc = OsTimerCreate(&scheduler->refill_timer, scheduler->scheduler_name,
+                           scheduler_refill_timer_cb_, scheduler);
+#endif
+        if (rc != OS_SUCCESS || !scheduler->refill_timer)
+            return RESULT_NO_RESOURCES_AVAILABLE;
+    }
+
+    scheduler->refill_period = 0;
+    os_data_sync_barrier();
+
+    scheduler->refill_amount = refill_amount;
+    scheduler->burst = burst;
+    scheduler->last_refill = OsGetTimestamp();
+    os_data_sync_barrier();
+
+    scheduler->refill_period = refill_period;
+
+    return RESULT_OK;
+}
+
 T_RESULT Scheduler_run_async(T_SCHEDULER *scheduler,
                                           T_SCHEDULER_CALLBACK func,
                                           void *func_args)
+{
+    return Scheduler_run_async_ex(scheduler, func, func_args, NULL);
+}
+
+T_RESULT Scheduler_run_async_ex(T_SCHEDULER *scheduler,
+                                     T_SCHEDULER_CALLBACK func,
+                                     void *func_args,
+                                     const T_SCHEDULER_CALL_PARAMS *params)
 {
     T_THREAD *thread;
     T_SCHEDULER_EVENT run_event;
+    T_RESULT local_result;
+    U32 seq;
 
     if (!scheduler || !func)
         return RESULT_PARAMETER_ERROR;
@@ -176,26 +903,43 @@ T_RESULT Scheduler_run_async(T_SCHEDULER *scheduler,
     if (!thread)
         return RESULT_PARAMETER_ERROR;
 
-    scheduler_enqueue_(scheduler, func, func_args, NULL, NULL);
+    local_result = scheduler_enqueue_(scheduler, func, func_args, NULL, NULL,
+                                      params, 0, &seq);
+    if (FAILED(local_result))
+        return local_result;
 
     run_event.scheduler = scheduler;
     run_event.tag = 0;
 
     /* notify associated thread */
-    return Thread_send_event_ex(thread, THREAD_EVENT_SCHED_RUN,
+    local_result = Thread_send_event_ex(thread, THREAD_EVENT_SCHED_RUN,
                                     &run_event, sizeof(run_event),THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
+
+    /* event lane full, take the call back unless it already ran */
+    if (FAILED(local_result) && RESULT_OK != scheduler_cancel_(scheduler, seq))
+        local_result = RESULT_OK;
+
+    return local_result;
 }
 
 T_RESULT Scheduler_run(T_SCHEDULER *scheduler,
                                     T_SCHEDULER_CALLBACK func,
                                     void *func_args)
+{
+    return Scheduler_run_ex(scheduler, func, func_args, NULL);
+}
+
+T_RESULT Scheduler_run_ex(T_SCHEDULER *scheduler,
+                               T_SCHEDULER_CALLBACK func,
+                               void *func_args,
+                               const T_SCHEDULER_CALL_PARAMS *params)
 {
     T_THREAD *thread;
-    T_RESULT result, local_result;
+    T_RESULT result = RESULT_TIMEOUT, local_result;
     T_SCHEDULER_EVENT run_event;
     OsSem sem;
-    U32 rc;
-    OsThread *current_thread;
+    U32 rc, seq;
+    OsThread current_thread;
 
     if (!scheduler || !func)
         return RESULT_PARAMETER_ERROR;
@@ -214,17 +958,19 @@ T_RESULT Scheduler_run(T_SCHEDULER *scheduler,
     if (!current_thread)
         return RESULT_WRONG_CONTEXT;
 
-    if (current_thread == &thread->event_thread_id)
-        return RESULT_WRONG_CONTEXT;
+    if (current_thread == thread->event_thread_id)
+        return scheduler_run_inline_(scheduler, func, func_args, params);
 
     rc = OsSemCreate(&sem, "SCHEDULER_REMOTE_CALL", 0,
                         OS_SEM_TIMEOUT_SUPPORT);
     if (rc != OS_SUCCESS)
         return RESULT_NO_RESOURCES_AVAILABLE;
 
-    /* enqueue remote procedure call */
+    /* enqueue remote procedure call, the scheduler thread inherits our
+     * priority until the call is done */
     local_result =
-        scheduler_enqueue_(scheduler, func, func_args, &result, &sem);
+        scheduler_enqueue_(scheduler, func, func_args, &result, &sem,
+                           params, OsThreadGetPriority(&current_thread), &seq);
     if (FAILED(local_result))
     {
         result = local_result;
@@ -239,14 +985,33 @@ T_RESULT Scheduler_run(T_SCHEDULER *scheduler,
                            THREAD_EVENT_SCHED_RUN,
                            &run_event, sizeof(run_event)
                            ,THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
-    if (FAILED(local_result))
+
+    /* event lane full, take the call back unless it already runs */
+    if (FAILED(local_result) && RESULT_OK == scheduler_cancel_(scheduler, seq))
     {
         result = local_result;
         goto exit;
     }
 
     /* wait until func() has been processed in the associated thread */
-    OsSemObtain(&sem, OS_INFINITE, OS_INFINITE);
+    rc = OsSemObtain(&sem, OS_INFINITE, OS_INFINITE);
+
+    /* timed out, drop the call unless it already runs */
+    if (rc != OS_SUCCESS)
+    {
+        local_result = scheduler_cancel_(scheduler, seq);
+        if (RESULT_WRONG_STATE == local_result)
+        {
+            while (rc != OS_SUCCESS)
+                rc = OsSemObtain(&sem, OS_INFINITE, OS_INFINITE);
+        }
+        else if (RESULT_NOT_HANDLED == local_result)
+        {
+            /* released meanwhile, take it once so it can not satisfy a
+             * later wait of this task */
+            rc = OsSemObtain(&sem, OS_INFINITE, OS_INFINITE);
+        }
+    }
 
 exit:
     /* delete semaphore */
@@ -261,7 +1026,13 @@ BOOL Scheduler_event_hdlr(T_THREAD_EVENT *event)
     {
         case THREAD_EVENT_SCHED_GRANT:
         case THREAD_EVENT_SCHED_RUN:
-            scheduler_process_(event->parameters.scheduler_event.scheduler);
+        {
+            T_SCHEDULER *scheduler = event->parameters.scheduler_event.scheduler;
+
+            /* serve every scheduler of the thread, not only the named one */
+            if (scheduler && scheduler->thread)
+                scheduler_service_thread_(scheduler->thread);
+        }
         break;
         default:
         return FALSE;
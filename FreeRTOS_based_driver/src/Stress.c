@@ -0,0 +1,335 @@
+/*****************************************************************************/
+/* INCLUDES                                                                  */
+/*****************************************************************************/
+#include <stdint.h>
+#include "Stress.h"
+#include "Main.h"
+
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+/** \brief Thread event tags are packed into the completion callback data */
+#define STRESS_TAG_PRODUCER_SHIFT 24
+#define STRESS_TAG_SEQ_MASK ((1U << STRESS_TAG_PRODUCER_SHIFT) - 1)
+
+/*****************************************************************************/
+/* TYPE DEFINES                                                              */
+/*****************************************************************************/
+/**
+ * \brief Paths with their own FIFO guarantee
+ */
+typedef enum
+{
+    STRESS_PATH_EVENT = 0,
+    STRESS_PATH_SCHEDULER,
+    STRESS_PATH_MAX
+} T_STRESS_PATH;
+
+/**
+ * \brief Tag of a scheduler call, copied into the queue slot
+ */
+typedef struct
+{
+    U32 producer;
+    U32 seq;
+    U32 post_time;
+} T_STRESS_TAG;
+
+/**
+ * \brief Checker state of one path. Bit n of window is set if tag
+ * expected - 1 - n was seen.
+ */
+typedef struct
+{
+    U32 expected;
+    U32 window;
+    U32 received;
+    U32 lost;
+    U32 duplicated;
+    U32 reordered;
+} T_STRESS_CHECK;
+
+typedef struct
+{
+    U32 index;
+    U32 rand;
+    U32 seq[STRESS_PATH_MAX];            /**< Next tag to post */
+    T_STRESS_CHECK check[STRESS_PATH_MAX]; /**< Driver thread side */
+    U32 rejected;
+    U32 irqs;
+} T_STRESS_PRODUCER;
+
+/*****************************************************************************/
+/* LOCAL DATA                                                                */
+/*****************************************************************************/
+static struct
+{
+    T_STRESS_CFG cfg;
+    U32 mix_total;
+    t_base_cfg mode;
+    volatile BOOL running;
+    volatile U32 active; /**< Producer tasks not yet finished */
+    U32 latency_max;
+    U32 latency_total;
+    T_STRESS_PRODUCER producer[STRESS_PRODUCERS_MAX];
+} stress;
+
+/*****************************************************************************/
+/* LOCAL FUNCTIONS                                                           */
+/*****************************************************************************/
+static U32 Stress_rand(T_STRESS_PRODUCER * p_producer)
+{
+    p_producer->rand = p_producer->rand * 1664525U + 1013904223U;
+    return p_producer->rand >> 8;
+}
+
+/* Checker, runs on the driver thread */
+static void Stress_check(U32 producer, T_STRESS_PATH path, U32 seq)
+{
+    T_STRESS_CHECK *check;
+    U32 distance;
+
+    if (producer >= STRESS_PRODUCERS_MAX)
+        return;
+    check = &stress.producer[producer].check[path];
+    check->received++;
+
+    if (seq >= check->expected)
+    {
+        /* tags skipped over count as lost until they show up late */
+        distance = seq - check->expected + 1;
+        check->lost += distance - 1;
+        check->window = distance < 32 ? (check->window << distance) | 1 : 1;
+        check->expected = seq + 1;
+        return;
+    }
+
+    distance = check->expected - 1 - seq;
+    if (distance >= 32 || (check->window & (1U << distance)))
+    {
+        check->duplicated++;
+        return;
+    }
+    check->window |= 1U << distance;
+    check->lost--;
+    check->reordered++;
+}
+
+static void Stress_cb_event(void * p_data)
+{
+    U32 tag = (U32)(uintptr_t)p_data;
+
+    Stress_check(tag >> STRESS_TAG_PRODUCER_SHIFT, STRESS_PATH_EVENT,
+                 tag & STRESS_TAG_SEQ_MASK);
+}
+
+static T_RESULT Stress_cb_call(void * p_data)
+{
+    const T_STRESS_TAG *P_TAG = (const T_STRESS_TAG *)p_data;
+    U32 latency = OsGetTimestamp() - P_TAG->post_time;
+
+    stress.latency_total += latency;
+    if (latency > stress.latency_max)
+        stress.latency_max = latency;
+    Stress_check(P_TAG->producer, STRESS_PATH_SCHEDULER, P_TAG->seq);
+    return RESULT_OK;
+}
+
+static T_STRESS_OP Stress_pickOp(T_STRESS_PRODUCER * p_producer)
+{
+    U32 r = Stress_rand(p_producer) % stress.mix_total;
+    U32 op;
+
+    for (op = 0; op < STRESS_OP_MAX - 1; op++)
+    {
+        if (r < stress.cfg.mix[op])
+            break;
+        r -= stress.cfg.mix[op];
+    }
+    return (T_STRESS_OP)op;
+}
+
+static T_RESULT Stress_postEvent(T_STRESS_PRODUCER * p_producer)
+{
+    T_EVENT_CFG event;
+    U32 tag = (p_producer->index << STRESS_TAG_PRODUCER_SHIFT) |
+              (p_producer->seq[STRESS_PATH_EVENT] & STRESS_TAG_SEQ_MASK);
+
+    event.cfg_type = CFG_SET_MODE;
+    event.cfg.P_CFG = &stress.mode;
+    event.completion_callback = Stress_cb_event;
+    event.p_completion_callback_data = (void *)(uintptr_t)tag;
+    event.device = NULL;
+    return Thread_send_event_ex(stress.cfg.thread, THREAD_EVENT_SET_CFG,
+                                &event, sizeof(event),
+                                THREAD_EVENT_SEND_OPTION_DO_NOT_OR);
+}
+
+static T_RESULT Stress_postCall(T_STRESS_PRODUCER * p_producer, BOOL sync)
+{
+    T_SCHEDULER_CALL_PARAMS params = { 0 };
+    T_STRESS_TAG tag;
+
+    tag.producer = p_producer->index;
+    tag.seq = p_producer->seq[STRESS_PATH_SCHEDULER];
+    tag.post_time = OsGetTimestamp();
+    params.args_size = sizeof(tag);
+
+    if (sync)
+        return Scheduler_run_ex(stress.cfg.scheduler, Stress_cb_call, &tag, &params);
+    return Scheduler_run_async_ex(stress.cfg.scheduler, Stress_cb_call, &tag, &params);
+}
+
+static void Stress_producerTask(void * p_param)
+{
+    T_STRESS_PRODUCER *p_producer = (T_STRESS_PRODUCER *)p_param;
+    T_RESULT result;
+    T_STRESS_PATH path;
+
+    while (stress.running)
+    {
+        switch (Stress_pickOp(p_producer))
+        {
+            case STRESS_OP_EVENT:
+                path = STRESS_PATH_EVENT;
+                result = Stress_postEvent(p_producer);
+                break;
+            case STRESS_OP_RUN_ASYNC:
+                path = STRESS_PATH_SCHEDULER;
+                result = Stress_postCall(p_producer, FALSE);
+                break;
+            case STRESS_OP_RUN:
+                path = STRESS_PATH_SCHEDULER;
+                result = Stress_postCall(p_producer, TRUE);
+                break;
+            default:
+                Test_simulate_SW_TIMER_interrupt_generation();
+                p_producer->irqs++;
+                continue;
+        }
+
+        if (SUCCEEDED(result))
+        {
+            p_producer->seq[path]++;
+        }
+        else
+        {
+            /* queue full, give the driver thread time to catch up */
+            p_producer->rejected++;
+            taskYIELD();
+        }
+    }
+
+    taskENTER_CRITICAL();
+    stress.active--;
+    taskEXIT_CRITICAL();
+    vTaskDelete(NULL);
+}
+
+/* Tags posted but not seen yet */
+static U32 Stress_outstanding(void)
+{
+    U32 i, path, outstanding = 0;
+    T_STRESS_CHECK *check;
+
+    for (i = 0; i < stress.cfg.producers; i++)
+    {
+        for (path = 0; path < STRESS_PATH_MAX; path++)
+        {
+            check = &stress.producer[i].check[path];
+            outstanding += stress.producer[i].seq[path] -
+                           (check->received - check->duplicated);
+        }
+    }
+    return outstanding;
+}
+
+/*****************************************************************************/
+/* EXPORTED FUNCTIONS                                                        */
+/*****************************************************************************/
+/**
+ * \brief Run the producers for P_CFG->duration, wait for the driver to
+ * work off the load and check the tags. Blocks the calling task.
+ *
+ * @return RESULT_FAILURE if a tag was lost, duplicated or reordered
+ */
+T_RESULT Stress_run(const T_STRESS_CFG * P_CFG, T_STRESS_REPORT * p_report)
+{
+    U32 i, path, start, duration, calls = 0;
+    T_STRESS_CHECK *check;
+    T_MAIN_STATE_SNAPSHOT state;
+
+    if (!P_CFG || !p_report || !P_CFG->thread || !P_CFG->scheduler ||
+        !P_CFG->producers || P_CFG->producers > STRESS_PRODUCERS_MAX)
+        return RESULT_PARAMETER_ERROR;
+
+    if (stress.active)
+        return RESULT_WRONG_STATE;
+
+    memset(&stress, 0, sizeof(stress));
+    stress.cfg = *P_CFG;
+    for (i = 0; i < STRESS_OP_MAX; i++)
+        stress.mix_total += P_CFG->mix[i];
+    if (!stress.mix_total)
+        return RESULT_PARAMETER_ERROR;
+
+    /* thread events re-apply the current mode, a no-op for the HW */
+    Main_readState(&state);
+    stress.mode.mode = state.mode;
+
+    stress.running = TRUE;
+    start = OsGetTimestamp();
+    for (i = 0; i < P_CFG->producers; i++)
+    {
+        stress.producer[i].index = i;
+        stress.producer[i].rand = P_CFG->seed + i;
+        if (pdPASS == xTaskCreate(Stress_producerTask, "Stress",
+                                  configMINIMAL_STACK_SIZE, &stress.producer[i],
+                                  STRESS_PRODUCER_PRIORITY, NULL))
+        {
+            taskENTER_CRITICAL();
+            stress.active++;
+            taskEXIT_CRITICAL();
+        }
+    }
+
+    vTaskDelay(P_CFG->duration);
+    stress.running = FALSE;
+    while (stress.active)
+        vTaskDelay(1);
+    duration = OsGetTimestamp() - start;
+
+    start = OsGetTimestamp();
+    while (Stress_outstanding() && OsGetTimestamp() - start < STRESS_DRAIN_TIMEOUT)
+        vTaskDelay(1);
+
+    memset(p_report, 0, sizeof(*p_report));
+    for (i = 0; i < P_CFG->producers; i++)
+    {
+        for (path = 0; path < STRESS_PATH_MAX; path++)
+        {
+            check = &stress.producer[i].check[path];
+            p_report->posted += stress.producer[i].seq[path];
+            p_report->received += check->received;
+            /* the tail never seen is lost too */
+            p_report->lost += check->lost +
+                              stress.producer[i].seq[path] - check->expected;
+            p_report->duplicated += check->duplicated;
+            p_report->reordered += check->reordered;
+        }
+        p_report->rejected += stress.producer[i].rejected;
+        p_report->irqs += stress.producer[i].irqs;
+        calls += stress.producer[i].check[STRESS_PATH_SCHEDULER].received;
+    }
+
+    p_report->duration = duration;
+    if (duration)
+        p_report->throughput = p_report->received * configTICK_RATE_HZ / duration;
+    p_report->latency_max = stress.latency_max;
+    if (calls)
+        p_report->latency_avg = stress.latency_total / calls;
+
+    if (p_report->lost || p_report->duplicated || p_report->reordered)
+        return RESULT_FAILURE;
+    return RESULT_OK;
+}
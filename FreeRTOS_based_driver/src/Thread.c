@@ -12,13 +12,522 @@
 #include "Thread.h"
 #include "Internal.h"
 
+/*****************************************************************************/
+/* DEFINES                                                                   */
+/*****************************************************************************/
+#define THREAD_TIMER_SLOT_MASK (THREAD_TIMER_SLOTS - 1U)
+#define THREAD_TIMER_SHIFT(level_) ((level_) * THREAD_TIMER_SLOT_BITS)
+
 /*****************************************************************************/
 /* LOCAL FUNCTIONS                                                           */
 /*****************************************************************************/
+static BOOL thread_lane_pending_(const T_THREAD_EVENT_LANE *lane)
+{
+    return lane->thread_event_rd != lane->thread_event_wr;
+}
+
+/* Event lock of a post, which may come from an interrupt handler */
+static U32 thread_post_lock_(T_THREAD *thread, BOOL in_isr)
+{
+    if (in_isr)
+        return os_spinlock_obtain_isr(&thread->event_lock);
+
+    os_spinlock_obtain(&thread->event_lock);
+    return 0;
+}
+
+static void thread_post_unlock_(T_THREAD *thread, BOOL in_isr, U32 mask)
+{
+    if (in_isr)
+        os_spinlock_release_isr(&thread->event_lock, mask);
+    else
+        os_spinlock_release(&thread->event_lock);
+}
+
+static BOOL thread_queue_pending_(T_THREAD *thread)
+{
+    return 0 != thread->lanes_pending;
+}
+
+/* Account of a callback, a free one is taken on its first call */
+static T_THREAD_ACCOUNT *thread_account_find_(T_THREAD *thread, T_THREAD_FUNC func)
+{
+    U32 i;
+
+    for (i = 0; i < THREAD_ACCOUNT_ENTRIES; i++)
+    {
+        T_THREAD_ACCOUNT *account = &thread->account[i];
+
+        if (account->func == func)
+            return account;
+        if (!account->func)
+        {
+            account->func = func;
+            return account;
+        }
+    }
+    return NULL;
+}
+
+/* Run an event through the event handlers until one takes it */
+static BOOL thread_event_dispatch_(T_THREAD *thread, T_THREAD_EVENT *event)
+{
+    BOOL processed = FALSE;
+    T_THREAD_CB_LIST hdlr = thread->event_handlers;
+
+    thread->current_event = event->event;
+    while (hdlr && !processed)
+    {
+        if (*hdlr)
+        {
+            Thread_watch_begin(thread, (T_THREAD_FUNC)*hdlr);
+            processed = (*hdlr)(event);
+            Thread_watch_end(thread);
+            hdlr++;
+        }
+        else
+        {
+            log_event(thread_event_func_NOT_PROCESSED, processed);
+            break;
+        }
+    }
+    return processed;
+}
+
+/*
+ * Scheduler events carry the wake up of the queued calls, which have
+ * deadlines of their own, close, timer, export and completion events
+ * must never be lost
+ */
+static BOOL thread_event_expirable_(T_THREAD_EVENT_TYPE event)
+{
+    switch (event)
+    {
+        case THREAD_EVENT_SCHED_RUN:
+        case THREAD_EVENT_SCHED_GRANT:
+        case THREAD_CLOSE:
+        case THREAD_EVENT_TIMER:
+        case THREAD_EVENT_EXPORT_FLUSH:
+        case THREAD_EVENT_EXPORT_SYNC:
+        case THREAD_EVENT_COMPLETION:
+            return FALSE;
+        default:
+            return event < THREAD_EVENT_MAX;
+    }
+}
+
+/* Hand a stale event to the expired handler instead of the handlers */
+static BOOL thread_event_expire_(T_THREAD *thread, T_THREAD_EVENT_LANE *lane,
+                                 T_THREAD_EVENT *event)
+{
+    BOOL processed = FALSE;
+
+    lane->stat.expired++;
+    LOG_EVENT(THREAD_EVENT_EXPIRED, event->event);
+    if (thread->event_expired)
+    {
+        thread->current_event = event->event;
+        Thread_watch_begin(thread, (T_THREAD_FUNC)thread->event_expired);
+        processed = thread->event_expired(event);
+        Thread_watch_end(thread);
+    }
+    return processed;
+}
+
+/* Run an async handler up to its next await, thread context */
+static void thread_async_step_(T_THREAD_ASYNC *async)
+{
+    T_THREAD_ASYNC_STATE state;
+
+    Thread_watch_begin(async->thread, (T_THREAD_FUNC)async->func);
+    state = async->func(async);
+    Thread_watch_end(async->thread);
+
+    if (THREAD_ASYNC_DONE == state)
+    {
+        async->running = FALSE;
+        if (async->done_cb)
+            async->done_cb(async);
+    }
+}
+
+/* Take an async handler off the list of those awaiting an event */
+static void thread_async_unlink_(T_THREAD_ASYNC *async)
+{
+    T_THREAD_ASYNC **link = &async->thread->async_waiting;
+
+    while (*link && *link != async)
+        link = &(*link)->next;
+    if (*link)
+        *link = async->next;
+    async->next = NULL;
+    async->event = THREAD_EVENT_MAX;
+}
+
+/* Sleep, poll and await timeout of an async handler, on its thread */
+static void thread_async_timer_cb_(void *p_data)
+{
+    T_THREAD_ASYNC *async = (T_THREAD_ASYNC *)p_data;
+
+    if (!async->running)
+        return;
+
+    if (THREAD_EVENT_MAX != async->event)
+    {
+        thread_async_unlink_(async);
+        async->timed_out = TRUE;
+        async->P_EVENT = NULL;
+    }
+    thread_async_step_(async);
+}
+
+/* Resume the async handlers awaiting the event just handled, in the
+ * order they began to wait */
+static void thread_async_notify_(T_THREAD *thread, const T_THREAD_EVENT *P_EVENT)
+{
+    T_THREAD_ASYNC **link = &thread->async_waiting;
+    T_THREAD_ASYNC *async, *ready = NULL, **ready_tail = &ready;
+
+    while ((async = *link) != NULL)
+    {
+        if (async->event == P_EVENT->event)
+        {
+            *link = async->next;
+            async->next = NULL;
+            *ready_tail = async;
+            ready_tail = &async->next;
+        }
+        else
+        {
+            link = &async->next;
+        }
+    }
+
+    while ((async = ready) != NULL)
+    {
+        ready = async->next;
+        async->next = NULL;
+        async->event = THREAD_EVENT_MAX;
+        async->P_EVENT = P_EVENT;
+        Thread_timer_stop(thread, &async->timer);
+        thread_async_step_(async);
+    }
+}
+
+/* Run the oldest entry of a lane through the event handlers */
+static void thread_lane_process_(T_THREAD *thread, T_THREAD_EVENT_LANE *lane)
+{
+    T_THREAD_EVENT_INDEX thread_event_rd = lane->thread_event_rd;
+    T_THREAD_EVENT_ENTRY *event_entry = &lane->thread_event[thread_event_rd];
+    BOOL cancelled, processed = FALSE;
+    U32 latency;
+
+    /* Make sure all the memory operations are complete before
+     * accessing the event. */
+    log_event(thread_event_func_TO_BE_PROCESSED, thread_event_rd);
+    os_data_sync_barrier();
+
+    latency = OsGetTimestamp() - event_entry->post_time;
+    lane->stat.events++;
+    lane->stat.latency_total += latency;
+    if (latency > lane->stat.latency_max)
+        lane->stat.latency_max = latency;
+
+    /* claim the entry, Thread_cancel_events leaves it alone from now on.
+     * The OR post that queued it lets the next one in; a cancelled entry
+     * gave up the flag already, it may belong to a newer post by now. */
+    os_spinlock_obtain(&thread->event_lock);
+    cancelled = event_entry->processed;
+    event_entry->processed = TRUE;
+    if (!cancelled && event_entry->or_posted)
+        thread->thread_event_already_queued[event_entry->event.event] = FALSE;
+    os_spinlock_release(&thread->event_lock);
+
+    if (!cancelled && event_entry->ttl && latency > event_entry->ttl)
+    {
+        processed = thread_event_expire_(thread, lane, &event_entry->event);
+    }
+    else if (!cancelled)
+    {
+        log_event(thread_event_func_START_PROCESSING, thread_event_rd);
+        processed = thread_event_dispatch_(thread, &event_entry->event);
+        if (!processed)
+            lane->stat.unhandled++;
+        if (thread->async_waiting)
+            thread_async_notify_(thread, &event_entry->event);
+    }
+
+    log_event(thread_event_func_PROCESSED, processed);
+    lane->thread_event_rd = (thread_event_rd + 1) % MAX_THREAD_EVENT_ENTRIES;
+    thread->last_active = OsGetTimestamp();
+}
+
+/**
+ *  Poll the event queue for up to spin_polls iterations before the caller
+ *  falls back to OsEventWait. The window tracks the recent inter-arrival
+ *  distance: a hit moves it towards twice the poll count the event was
+ *  caught at, a miss halves it, so an idle thread decays to
+ *  THREAD_SPIN_POLLS_MIN and stops burning the core. An event arriving
+ *  soon after a miss widens it again, see thread_spin_learn_. At most
+ *  THREAD_SPIN_BUDGET cycles are spun between two blocks.
+ *
+ *  Returns TRUE if the queue has work and the kernel wait can be skipped.
+ */
+static BOOL thread_spin_wait_(T_THREAD *thread)
+{
+    U32 polls;
+    U32 window = thread->spin_polls;
+
+    if (window < THREAD_SPIN_POLLS_MIN)
+        window = THREAD_SPIN_POLLS_MIN;
+
+    thread->spin_start = OsGetCycles();
+
+    /* out of budget, block once so the tasks below get the core */
+    if (thread->spin_cycles >= THREAD_SPIN_BUDGET)
+    {
+        thread->spin_cycles = 0;
+        thread->stat.spin_yields++;
+        return FALSE;
+    }
+
+    thread->consumer_spinning = TRUE;
+    os_data_sync_barrier();
+
+    for (polls = 0; polls < window; polls++)
+    {
+        if (thread_queue_pending_(thread))
+            break;
+        OsCpuRelax();
+    }
+
+    thread->spin_cycles += OsGetCycles() - thread->spin_start;
+    if (polls < window)
+    {
+        thread->consumer_spinning = FALSE;
+        thread->stat.spin_hits++;
+        window = (window + 2 * (polls + 1)) / 2;
+        if (window > THREAD_SPIN_POLLS_MAX)
+            window = THREAD_SPIN_POLLS_MAX;
+        thread->spin_polls = window;
+        return TRUE;
+    }
+
+    thread->consumer_spinning = FALSE;
+    thread->stat.spin_misses++;
+    thread->spin_polls = window / 2;
+    thread->spin_cycles = 0;
+    thread->spin_cost = (OsGetCycles() - thread->spin_start) / window;
+    if (!thread->spin_cost)
+        thread->spin_cost = 1;
+
+    /* Producers which saw the spinning flag skipped OsEventSet, so look at
+     * the queue once more after clearing it and before blocking. */
+    os_data_sync_barrier();
+    return thread_queue_pending_(thread);
+}
+
+/*
+ * The thread blocked after a missed spin and an event woke it. If a window
+ * of THREAD_SPIN_POLLS_MAX polls would have covered the gap, widen the
+ * window to it, so a steady event rate above the window is found from
+ * the misses; longer gaps are left to the halving.
+ */
+static void thread_spin_learn_(T_THREAD *thread)
+{
+    U32 polls = (OsGetCycles() - thread->spin_start) / thread->spin_cost;
+
+    polls += polls / 4;
+    if (polls <= THREAD_SPIN_POLLS_MAX && polls > thread->spin_polls)
+        thread->spin_polls = polls;
+}
+
+static void thread_timer_link_(T_THREAD_TIMER **pp_head, T_THREAD_TIMER *timer)
+{
+    timer->next = *pp_head;
+    if (timer->next)
+        timer->next->pprev = &timer->next;
+    timer->pprev = pp_head;
+    *pp_head = timer;
+}
+
+static void thread_timer_unlink_(T_THREAD_TIMER *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/* File a timer by the distance of its expiry to the last processed tick */
+static void thread_timer_insert_(T_THREAD_TIMER_WHEEL *wheel, T_THREAD_TIMER *timer)
+{
+    U32 delta = timer->expiry - wheel->now;
+    U32 level, slot;
+
+    for (level = 0; level < THREAD_TIMER_LEVELS - 1; level++)
+    {
+        if (delta < (1U << THREAD_TIMER_SHIFT(level + 1)))
+            break;
+    }
+
+    if (THREAD_TIMER_SHIFT(level + 1) < 32 &&
+        delta >= (1U << THREAD_TIMER_SHIFT(level + 1)))
+    {
+        /* beyond the wheel: park it in the top level slot refiled last */
+        slot = (wheel->now >> THREAD_TIMER_SHIFT(level)) & THREAD_TIMER_SLOT_MASK;
+    }
+    else
+    {
+        slot = (timer->expiry >> THREAD_TIMER_SHIFT(level)) & THREAD_TIMER_SLOT_MASK;
+    }
+    thread_timer_link_(&wheel->slot[level][slot], timer);
+}
+
+/**
+ *  Advance the wheel by one tick. Levels whose lower levels wrapped are
+ *  refiled first, then the level 0 slot of the tick becomes the expired
+ *  batch.
+ */
+static void thread_timer_tick_(T_THREAD_TIMER_WHEEL *wheel)
+{
+    T_THREAD_TIMER *list, *timer;
+    U32 level, slot;
+
+    wheel->now++;
+
+    for (level = 1; level < THREAD_TIMER_LEVELS; level++)
+    {
+        if (wheel->now & ((1U << THREAD_TIMER_SHIFT(level)) - 1U))
+            break;
+
+        slot = (wheel->now >> THREAD_TIMER_SHIFT(level)) & THREAD_TIMER_SLOT_MASK;
+        list = wheel->slot[level][slot];
+        wheel->slot[level][slot] = NULL;
+        while (list)
+        {
+            timer = list;
+            list = list->next;
+            thread_timer_insert_(wheel, timer);
+            wheel->stat.cascaded++;
+        }
+    }
+
+    slot = wheel->now & THREAD_TIMER_SLOT_MASK;
+    list = wheel->slot[0][slot];
+    if (list)
+    {
+        wheel->slot[0][slot] = NULL;
+        wheel->expired = list;
+        list->pprev = &wheel->expired;
+    }
+}
+
+/**
+ *  Bring the wheel up to the current tick and deliver every expiry as a
+ *  THREAD_EVENT_TIMER, tick by tick. A periodic timer is re-armed from its
+ *  expiry, not from the delivery time, before its event runs so the
+ *  handler may stop it.
+ */
+static void thread_timer_run_(T_THREAD *thread)
+{
+    T_THREAD_TIMER_WHEEL *wheel = &thread->timers;
+    T_THREAD_TIMER *timer;
+    T_THREAD_EVENT event;
+    U32 now = OsGetTimestamp();
+
+    if (wheel->now == now)
+        return;
+
+    event.event = THREAD_EVENT_TIMER;
+    os_spinlock_obtain(&thread->event_lock);
+    while (wheel->now != now)
+    {
+        if (!wheel->count)
+        {
+            wheel->now = now;
+            break;
+        }
+        thread_timer_tick_(wheel);
+
+        while ((timer = wheel->expired) != NULL)
+        {
+            thread_timer_unlink_(timer);
+            event.parameters.timer_event.timer = timer;
+            event.parameters.timer_event.callback = timer->callback;
+            event.parameters.timer_event.p_data = timer->p_data;
+            event.parameters.timer_event.lateness = now - timer->expiry;
+            if (event.parameters.timer_event.lateness > wheel->stat.late_max)
+                wheel->stat.late_max = event.parameters.timer_event.lateness;
+            wheel->stat.expired++;
+
+            if (timer->period)
+            {
+                timer->expiry += timer->period;
+                thread_timer_insert_(wheel, timer);
+            }
+            else
+            {
+                wheel->count--;
+            }
+
+            os_spinlock_release(&thread->event_lock);
+            thread_event_dispatch_(thread, &event);
+            thread->last_active = OsGetTimestamp();
+            os_spinlock_obtain(&thread->event_lock);
+        }
+    }
+    os_spinlock_release(&thread->event_lock);
+}
+
+/**
+ *  Ticks until the wheel has to run again: the next level 0 slot with a
+ *  timer or the next refile of a higher level slot with one, whichever
+ *  comes first. OS_INFINITE with no timer armed.
+ */
+static U32 thread_timer_timeout_(T_THREAD *thread)
+{
+    T_THREAD_TIMER_WHEEL *wheel = &thread->timers;
+    U32 level, pos, i, ticks, elapsed;
+    U32 timeout = OS_INFINITE;
+
+    os_spinlock_obtain(&thread->event_lock);
+    for (level = 0; wheel->count && level < THREAD_TIMER_LEVELS; level++)
+    {
+        pos = wheel->now >> THREAD_TIMER_SHIFT(level);
+        for (i = 1; i <= THREAD_TIMER_SLOTS; i++)
+        {
+            if (wheel->slot[level][(pos + i) & THREAD_TIMER_SLOT_MASK])
+            {
+                ticks = ((pos + i) << THREAD_TIMER_SHIFT(level)) - wheel->now;
+                if (ticks < timeout)
+                    timeout = ticks;
+                break;
+            }
+        }
+    }
+
+    if (OS_INFINITE != timeout)
+    {
+        /* the wheel lags the clock by the time spent delivering */
+        elapsed = OsGetTimestamp() - wheel->now;
+        timeout = timeout > elapsed ? timeout - elapsed : 0;
+        wheel->wake = OsGetTimestamp() + timeout;
+    }
+    else
+    {
+        wheel->wake = OsGetTimestamp() + (OS_INFINITE >> 1);
+    }
+    os_spinlock_release(&thread->event_lock);
+    return timeout;
+}
+
 static void thread_event_func(void *param) {
 
     T_THREAD *thread = (T_THREAD *)param;
-    T_THREAD_EVENT_INDEX thread_event_rd;
+    OsEventBits lanes;
+    U32 prio;
     if (!thread)
         return;
 
@@ -31,45 +540,59 @@ static void thread_event_func(void *param) {
     do
     {
         log_event(thread_event_func_START, 0);
-        S32 res = (S32)OsEventWait(
-            &thread->event_id, OS_INFINITE, OS_INFINITE);
-        ASSERT(OS_SUCCESS, res, EVENT_WAIT);
+        thread_timer_run_(thread);
+        lanes = 0;
+        if (THREAD_WAIT_MODE_ADAPTIVE != thread->wait_mode ||
+            !thread_spin_wait_(thread))
+        {
+            U32 timeout = thread_timer_timeout_(thread);
+            U32 idle_timeout;
 
-        log_event(thread_event_func_EVENT_RECEIVED, 0);
+            /* let the owner step down while there is nothing to do */
+            if (thread->thread_idle)
+            {
+                idle_timeout = thread->thread_idle(OsGetTimestamp() - thread->last_active);
+                if (idle_timeout < timeout)
+                    timeout = idle_timeout;
+            }
+
+            lanes = OsEventWait(
+                &thread->event_id, THREAD_EVENT_LANE_MASK, timeout);
+            ASSERT(TRUE, (OS_INFINITE != timeout ||
+                          0 != (lanes & THREAD_EVENT_LANE_MASK)), EVENT_WAIT);
+            if (THREAD_WAIT_MODE_ADAPTIVE == thread->wait_mode &&
+                thread->spin_cost && (lanes & THREAD_EVENT_LANE_MASK))
+                thread_spin_learn_(thread);
+        }
 
-        thread_event_rd = thread->thread_event_rd;
-        while (thread_event_rd != thread->thread_event_wr && THREAD_STATE_RUN == thread->state)
+        log_event(thread_event_func_EVENT_RECEIVED, lanes);
+
+        /*
+         * Process one event at a time from the most urgent lane with work,
+         * so an urgent post overtakes the rest of a normal burst. The
+         * lowest bit of lanes_pending names it; it also holds the lanes
+         * posted to after the wakeup or while spinning without event bits.
+         */
+        while (thread->lanes_pending && THREAD_STATE_RUN == thread->state)
         {
-            T_THREAD_EVENT_ENTRY *event_entry = &thread->thread_event[thread_event_rd];
-            thread->thread_event_already_queued[event_entry->event.event] = FALSE;
-            /* Make sure all the memory operations are complete before
-             * accessing the event. */
-            log_event(thread_event_func_TO_BE_PROCESSED, thread_event_rd);
-            os_data_sync_barrier();
-
-            if (!event_entry->processed)
+            T_THREAD_EVENT_LANE *lane;
+            U32 pending = thread->lanes_pending;
+
+            /* a handful of lanes, a scan is as cheap as a bit scan builtin */
+            for (prio = 0; !(pending & THREAD_EVENT_LANE_BIT(prio)); prio++)
+                ;
+            lane = &thread->lane[prio];
+            thread_lane_process_(thread, lane);
+            /* timers keep their tick under a steady event load */
+            thread_timer_run_(thread);
+
+            if (!thread_lane_pending_(lane))
             {
-                log_event(thread_event_func_START_PROCESSING, thread_event_rd);
-                /* run through all event handlers*/
-                T_THREAD_CB_LIST hdlr = thread->event_handlers;
-                while (hdlr && !event_entry->processed)
-                {
-                    if (*hdlr)
-                    {
-                        event_entry->processed = (*hdlr)(&event_entry->event);
-                        hdlr++;
-                    }
-                    else
-                    {
-                        log_event(thread_event_func_NOT_PROCESSED, event_entry->processed);
-                        break;
-                    }
-                }
+                os_spinlock_obtain(&thread->event_lock);
+                if (!thread_lane_pending_(lane))
+                    thread->lanes_pending &= ~THREAD_EVENT_LANE_BIT(prio);
+                os_spinlock_release(&thread->event_lock);
             }
-
-            log_event(thread_event_func_PROCESSED, event_entry->processed);
-            thread_event_rd = (thread_event_rd + 1) % MAX_THREAD_EVENT_ENTRIES;
-            thread->thread_event_rd = thread_event_rd;
         }
     } while (THREAD_STATE_RUN == thread->state);
 }
@@ -84,21 +607,51 @@ T_RESULT Thread_create(T_THREAD *thread)
           return RESULT_PARAMETER_ERROR;
 
     /* create thread event */
+#if defined(DRV_STATIC_ALLOC)
+    if (OsEventCreateStatic(&thread->event_id, thread->thread_event_name,
+                            OS_EVENT_AUTO_RESET, &thread->event_mem) != OS_SUCCESS)
+        return RESULT_NO_RESOURCES_AVAILABLE;
+#else
     if (OsEventCreate(&thread->event_id, thread->thread_event_name,
                          OS_EVENT_AUTO_RESET) != OS_SUCCESS)
         return RESULT_NO_RESOURCES_AVAILABLE;
+#endif
 
     os_spinlock_init(&thread->event_lock);
 
-    thread->thread_event_wr = 0;
-    thread->thread_event_rd = 0;
+    memset(thread->lane, 0x00, sizeof(thread->lane));
+    thread->lanes_pending = 0;
+
+    thread->consumer_spinning = FALSE;
+    thread->spin_polls = THREAD_SPIN_POLLS_MIN;
+    thread->last_active = OsGetTimestamp();
+    memset(&thread->stat, 0x00, sizeof(thread->stat));
+
+    thread->watch_depth = 0;
+    memset(thread->account, 0x00, sizeof(thread->account));
+
+    memset(&thread->timers, 0x00, sizeof(thread->timers));
+    thread->async_waiting = NULL;
+    thread->timers.now = OsGetTimestamp();
+    thread->timers.wake = thread->timers.now + (OS_INFINITE >> 1);
 
     /* create thread */
     thread->state = THREAD_STATE_INIT;
+#if defined(DRV_STATIC_ALLOC)
+    if (OsThreadCreateStatic(
+            &thread->event_thread_id, thread->thread_name,
+            thread_event_func, thread, &thread->thread_mem) != OS_SUCCESS)
+        return RESULT_NO_RESOURCES_AVAILABLE;
+#else
     if (OsThreadCreate(
             &thread->event_thread_id, thread->thread_name,
             thread_event_func, thread) != OS_SUCCESS)
         return RESULT_NO_RESOURCES_AVAILABLE;
+#endif
+
+    thread->base_priority = OsThreadGetPriority(&thread->event_thread_id);
+    thread->active_priority = thread->base_priority;
+    memset(thread->waiters, 0x00, sizeof(thread->waiters));
 
     /* start thread */
     if (OsThreadStart(&thread->event_thread_id) != OS_SUCCESS)
@@ -107,79 +660,575 @@ T_RESULT Thread_create(T_THREAD *thread)
     return RESULT_OK;
 }
 
+/* Number of events queued over all lanes */
+U32 Thread_queue_depth(const T_THREAD *thread)
+{
+    U32 prio, depth = 0;
+
+    if (!thread)
+        return 0;
+
+    for (prio = 0; prio < THREAD_EVENT_PRIORITY_MAX; prio++)
+    {
+        const T_THREAD_EVENT_LANE *lane = &thread->lane[prio];
+
+        depth += (lane->thread_event_wr + MAX_THREAD_EVENT_ENTRIES -
+                  lane->thread_event_rd) % MAX_THREAD_EVENT_ENTRIES;
+    }
+    return depth;
+}
+
+/* Run the thread at the highest priority of its base and its waiters */
+static void thread_priority_update_(T_THREAD *thread)
+{
+    U32 priority;
+
+    for (priority = OS_THREAD_PRIORITY_MAX - 1;
+         priority > thread->base_priority; priority--)
+    {
+        if (thread->waiters[priority])
+            break;
+    }
+
+    if (priority != thread->active_priority)
+    {
+        thread->active_priority = priority;
+        OsThreadSetPriority(&thread->event_thread_id, priority);
+    }
+}
+
+/**
+ *  A caller of the given priority blocks until this thread has served it.
+ *  The thread runs at least at that priority until the matching
+ *  Thread_priority_release, so medium priority tasks can not delay it.
+ */
+void Thread_priority_inherit(T_THREAD *thread, U32 priority)
+{
+    if (!thread || priority >= OS_THREAD_PRIORITY_MAX)
+        return;
+
+    os_spinlock_obtain(&thread->event_lock);
+    thread->waiters[priority]++;
+    thread_priority_update_(thread);
+    os_spinlock_release(&thread->event_lock);
+}
+
+void Thread_priority_release(T_THREAD *thread, U32 priority)
+{
+    if (!thread || priority >= OS_THREAD_PRIORITY_MAX)
+        return;
+
+    os_spinlock_obtain(&thread->event_lock);
+    if (thread->waiters[priority])
+        thread->waiters[priority]--;
+    thread_priority_update_(thread);
+    os_spinlock_release(&thread->event_lock);
+}
+
+/**
+ *  Set the TTL of the event type, used by every post that does not give
+ *  one. An event dequeued more than ttl ticks after it was posted is
+ *  handed to event_expired instead of the event handlers. ttl 0 turns it
+ *  off; scheduler, close, timer and export events never expire.
+ */
+T_RESULT Thread_set_ttl(T_THREAD *thread, T_THREAD_EVENT_TYPE event, U32 ttl)
+{
+    if (!thread || event >= THREAD_EVENT_MAX ||
+        (ttl && !thread_event_expirable_(event)))
+        return RESULT_PARAMETER_ERROR;
+
+    thread->ttl[event] = ttl;
+    return RESULT_OK;
+}
+
+/**
+ *  Install a callback seeing every event posted to the thread from now
+ *  on, NULL to remove it. Posts dropped by THREAD_EVENT_SEND_OPTION_OR
+ *  are not seen.
+ */
+T_RESULT Thread_set_post_cb(T_THREAD *thread, T_THREAD_POST_CB post_cb)
+{
+    if (!thread)
+        return RESULT_PARAMETER_ERROR;
+
+    thread->post_cb = post_cb;
+    return RESULT_OK;
+}
+
+/**
+ *  Mark every queued event the predicate selects as processed, so the
+ *  thread drops it unseen. All lanes are scanned in one critical section,
+ *  an event the thread has started on is never cancelled. Completion
+ *  callbacks of cancelled events are not called. Scheduler events only
+ *  wake the thread up, cancelling them leaves the calls queued.
+ *
+ *  @return number of events cancelled
+ */
+U32 Thread_cancel_events(T_THREAD *thread,
+                         T_THREAD_EVENT_PREDICATE predicate, void *p_data)
+{
+    T_THREAD_EVENT_INDEX index;
+    U32 prio, cancelled = 0;
+
+    if (!thread || !predicate)
+        return 0;
+
+    os_spinlock_obtain(&thread->event_lock);
+    for (prio = 0; prio < THREAD_EVENT_PRIORITY_MAX; prio++)
+    {
+        T_THREAD_EVENT_LANE *lane = &thread->lane[prio];
+
+        for (index = lane->thread_event_rd; index != lane->thread_event_wr;
+             index = (index + 1) % MAX_THREAD_EVENT_ENTRIES)
+        {
+            T_THREAD_EVENT_ENTRY *event_entry = &lane->thread_event[index];
+
+            if (event_entry->processed ||
+                !predicate(&event_entry->event, p_data))
+                continue;
+
+            event_entry->processed = TRUE;
+            /* the next OR post has to queue again, or it is lost */
+            if (event_entry->or_posted)
+                thread->thread_event_already_queued[event_entry->event.event] = FALSE;
+            lane->stat.cancelled++;
+            cancelled++;
+        }
+    }
+    os_spinlock_release(&thread->event_lock);
+
+    LOG_EVENT(THREAD_EVENTS_CANCELLED, cancelled);
+    return cancelled;
+}
+
+/**
+ *  Arm a timer of the thread timer service, O(1). It expires delay ticks
+ *  from now (at least one) and then every period ticks, period 0 for a
+ *  one shot timer. Every expiry runs through the thread's event handlers
+ *  as a THREAD_EVENT_TIMER. Starting an armed timer re-arms it.
+ */
+T_RESULT Thread_timer_start(T_THREAD *thread, T_THREAD_TIMER *timer,
+                            U32 delay, U32 period)
+{
+    T_THREAD_TIMER_WHEEL *wheel;
+    BOOL wake;
+    U32 now;
+
+    if (!thread || !timer || !timer->callback)
+        return RESULT_PARAMETER_ERROR;
+    wheel = &thread->timers;
+
+    now = OsGetTimestamp();
+    os_spinlock_obtain(&thread->event_lock);
+    if (timer->pprev)
+    {
+        thread_timer_unlink_(timer);
+    }
+    else
+    {
+        /* an empty wheel jumps to now instead of ticking through the
+         * idle time */
+        if (!wheel->count)
+            wheel->now = now;
+        wheel->count++;
+    }
+
+    timer->expiry = now + (delay ? delay : 1);
+    timer->period = period;
+    thread_timer_insert_(wheel, timer);
+    /* a waiting thread has to shorten its timeout */
+    wake = (S32)(timer->expiry - wheel->wake) < 0;
+    os_spinlock_release(&thread->event_lock);
+
+    if (wake && THREAD_STATE_RUN == thread->state)
+    {
+        S32 res = (S32)OsEventSet(&thread->event_id,
+                                  THREAD_EVENT_LANE_BIT(THREAD_EVENT_PRIORITY_NORMAL));
+        ASSERT(OS_SUCCESS, res, THREAD_EVENT_NOT_SET);
+    }
+    return RESULT_OK;
+}
+
+/**
+ *  Disarm a timer, O(1). An expiry already handed to the event handlers
+ *  when a task other than the thread stops the timer is still delivered.
+ *
+ *  @return RESULT_NOT_HANDLED if the timer was not armed
+ */
+T_RESULT Thread_timer_stop(T_THREAD *thread, T_THREAD_TIMER *timer)
+{
+    T_RESULT result = RESULT_NOT_HANDLED;
+
+    if (!thread || !timer)
+        return RESULT_PARAMETER_ERROR;
+
+    os_spinlock_obtain(&thread->event_lock);
+    if (timer->pprev)
+    {
+        thread_timer_unlink_(timer);
+        thread->timers.count--;
+        result = RESULT_OK;
+    }
+    os_spinlock_release(&thread->event_lock);
+    return result;
+}
+
+/**
+ *  Start an async handler. Its first step runs on the thread at the next
+ *  tick, the thread's event handlers have to deliver THREAD_EVENT_TIMER.
+ *  Any context.
+ */
+T_RESULT Thread_async_start(T_THREAD *thread, T_THREAD_ASYNC *async)
+{
+    if (!thread || !async || !async->func)
+        return RESULT_PARAMETER_ERROR;
+
+    if (async->running)
+        return RESULT_WRONG_STATE;
+
+    async->thread = thread;
+    async->resume = 0;
+    async->timed_out = FALSE;
+    async->event = THREAD_EVENT_MAX;
+    async->P_EVENT = NULL;
+    async->next = NULL;
+    async->timer.callback = thread_async_timer_cb_;
+    async->timer.p_data = async;
+    async->running = TRUE;
+
+    return Thread_timer_start(thread, &async->timer, 0, 0);
+}
+
+/**
+ *  Drop a started async handler at its current await, done_cb is not
+ *  called. Thread context.
+ *
+ *  @return RESULT_NOT_HANDLED if it was not running
+ */
+T_RESULT Thread_async_cancel(T_THREAD_ASYNC *async)
+{
+    if (!async)
+        return RESULT_PARAMETER_ERROR;
+
+    if (!async->running)
+        return RESULT_NOT_HANDLED;
+
+    if (THREAD_EVENT_MAX != async->event)
+        thread_async_unlink_(async);
+    Thread_timer_stop(async->thread, &async->timer);
+    async->running = FALSE;
+    return RESULT_OK;
+}
+
+void Thread_async_sleep_(T_THREAD_ASYNC *async, U32 ticks)
+{
+    Thread_timer_start(async->thread, &async->timer, ticks, 0);
+}
+
+BOOL Thread_async_expired_(T_THREAD_ASYNC *async, U32 timeout)
+{
+    if (OsGetTimestamp() - async->since >= timeout)
+        async->timed_out = TRUE;
+    return async->timed_out;
+}
+
+void Thread_async_wait_event_(T_THREAD_ASYNC *async,
+                              T_THREAD_EVENT_TYPE event, U32 timeout)
+{
+    T_THREAD_ASYNC **link = &async->thread->async_waiting;
+
+    async->timed_out = FALSE;
+    async->P_EVENT = NULL;
+    async->event = event;
+    async->next = NULL;
+    while (*link)
+        link = &(*link)->next;
+    *link = async;
+    if (timeout)
+        Thread_timer_start(async->thread, &async->timer, timeout, 0);
+}
+
+/**
+ *  Start timing a callback run by the thread. Calls nest, every begin
+ *  needs its Thread_watch_end once the callback returned.
+ */
+void Thread_watch_begin(T_THREAD *thread, T_THREAD_FUNC func)
+{
+    U32 depth = thread->watch_depth;
+
+    if (depth < THREAD_WATCH_DEPTH)
+    {
+        T_THREAD_WATCH *watch = &thread->watch[depth];
+
+        watch->func = func;
+        watch->nested = 0;
+        watch->hung = FALSE;
+        watch->start = OsGetCycles();
+    }
+    /* the watchdog may look at the entry from now on */
+    os_data_sync_barrier();
+    thread->watch_depth = depth + 1;
+}
+
+/**
+ *  Charge the self time of the innermost watched callback to its account
+ *  and report it if it overran the budget of the current event type.
+ */
+void Thread_watch_end(T_THREAD *thread)
+{
+    U32 depth = thread->watch_depth - 1;
+    T_THREAD_ACCOUNT *account;
+    T_THREAD_WATCH *watch;
+    U32 elapsed, cycles, budget;
+
+    if (depth >= THREAD_WATCH_DEPTH)
+    {
+        thread->watch_depth = depth;
+        return;
+    }
+    watch = &thread->watch[depth];
+    elapsed = OsGetCycles() - watch->start;
+    cycles = elapsed > watch->nested ? elapsed - watch->nested : 0;
+    if (depth)
+        thread->watch[depth - 1].nested += elapsed;
+    thread->watch_depth = depth;
+
+    /* the budget holds for callbacks the table has no room for too */
+    account = thread_account_find_(thread, watch->func);
+    if (account)
+    {
+        account->calls++;
+        account->cycles_total += cycles;
+        if (cycles > account->cycles_max)
+            account->cycles_max = cycles;
+    }
+    else
+    {
+        thread->stat.account_full++;
+    }
+
+    budget = thread->budget[thread->current_event];
+    if (budget && cycles > budget)
+    {
+        if (account)
+            account->overruns++;
+        thread->stat.overruns++;
+        LOG_EVENT(THREAD_BUDGET_OVERRUN, thread->current_event);
+        if (thread->overrun_cb)
+            thread->overrun_cb(watch->func, thread->current_event, cycles, FALSE);
+    }
+}
+
+/**
+ *  Cycles a single callback may use while the thread handles the given
+ *  event type, 0 for no limit. Scheduler calls count under the scheduler
+ *  event which served them (THREAD_EVENT_SCHED_RUN or _GRANT), completion
+ *  callbacks under the event they complete.
+ */
+T_RESULT Thread_set_budget(T_THREAD *thread, T_THREAD_EVENT_TYPE event,
+                           U32 cycles)
+{
+    if (!thread || event >= THREAD_EVENT_MAX)
+        return RESULT_PARAMETER_ERROR;
+
+    thread->budget[event] = cycles;
+    return RESULT_OK;
+}
+
+/* Overrun report and hang limit of Thread_watchdog_check, 0 turns it off */
+T_RESULT Thread_set_watchdog(T_THREAD *thread, U32 limit,
+                             T_THREAD_OVERRUN_CB overrun_cb)
+{
+    if (!thread)
+        return RESULT_PARAMETER_ERROR;
+
+    thread->overrun_cb = overrun_cb;
+    thread->watchdog_limit = limit;
+    return RESULT_OK;
+}
+
+/**
+ *  Soft watchdog, to be called periodically from outside the thread (timer
+ *  or tick hook). Reports the innermost watched callback once if it has
+ *  been running for longer than the watchdog limit.
+ *
+ *  @return TRUE while the thread is stuck in a callback
+ */
+BOOL Thread_watchdog_check(T_THREAD *thread)
+{
+    T_THREAD_WATCH *watch;
+    U32 depth, elapsed;
+
+    if (!thread || !thread->watchdog_limit)
+        return FALSE;
+
+    depth = thread->watch_depth;
+    if (!depth)
+        return FALSE;
+    if (depth > THREAD_WATCH_DEPTH)
+        depth = THREAD_WATCH_DEPTH;
+    os_data_sync_barrier();
+
+    watch = &thread->watch[depth - 1];
+    elapsed = OsGetCycles() - watch->start;
+    if (elapsed < thread->watchdog_limit)
+        return FALSE;
+
+    if (!watch->hung)
+    {
+        watch->hung = TRUE;
+        thread->stat.hangs++;
+        LOG_EVENT(THREAD_WATCHDOG_HANG, thread->current_event);
+        if (thread->overrun_cb)
+            thread->overrun_cb(watch->func, thread->current_event, elapsed, TRUE);
+    }
+    return TRUE;
+}
+
+/* Copy of the account of a callback, RESULT_NOT_HANDLED if it never ran */
+T_RESULT Thread_get_account(T_THREAD *thread, T_THREAD_FUNC func,
+                            T_THREAD_ACCOUNT *account)
+{
+    U32 i;
+
+    if (!thread || !func || !account)
+        return RESULT_PARAMETER_ERROR;
+
+    for (i = 0; i < THREAD_ACCOUNT_ENTRIES; i++)
+    {
+        if (thread->account[i].func == func)
+        {
+            *account = thread->account[i];
+            return RESULT_OK;
+        }
+    }
+    return RESULT_NOT_HANDLED;
+}
+
 T_RESULT Thread_close(T_THREAD *thread)
 {
     return RESULT_NOT_SUPPORTED;
 }
 /**
- *  if option = THREAD_EVENT_SEND_OPTION_OR case ,it will only post
- *  this event_type if it's' not present in Thread event Queue.
+ *  Post an event to the normal priority lane.
  */
 T_RESULT Thread_send_event_ex(T_THREAD *thread,
                                             T_THREAD_EVENT_TYPE event, void *data,
                                             U32 size, T_THREAD_EVENT_SEND_OPTION option)
+{
+    return Thread_send_event_prio(thread, event, data, size, option,
+                                  THREAD_EVENT_PRIORITY_NORMAL);
+}
+
+/**
+ *  if option = THREAD_EVENT_SEND_OPTION_OR case ,it will only post
+ *  this event_type if it's' not present in Thread event Queue.
+ *  Events in a lower prio lane are always processed before any event
+ *  of a higher one; FIFO order holds within a lane only.
+ */
+T_RESULT Thread_send_event_prio(T_THREAD *thread,
+                                T_THREAD_EVENT_TYPE event, void *data,
+                                U32 size, T_THREAD_EVENT_SEND_OPTION option,
+                                T_THREAD_EVENT_PRIORITY prio)
+{
+    if (!thread || event >= THREAD_EVENT_MAX)
+        return RESULT_PARAMETER_ERROR;
+
+    return Thread_send_event_ttl(thread, event, data, size, option, prio,
+                                 thread->ttl[event]);
+}
+
+/**
+ *  Same as Thread_send_event_prio with the TTL of this post, overriding
+ *  the one of the event type. ttl 0 posts an event that never expires.
+ */
+T_RESULT Thread_send_event_ttl(T_THREAD *thread,
+                               T_THREAD_EVENT_TYPE event, void *data,
+                               U32 size, T_THREAD_EVENT_SEND_OPTION option,
+                               T_THREAD_EVENT_PRIORITY prio, U32 ttl)
 {
     T_THREAD_EVENT_ENTRY *event_entry;
-    T_THREAD_EVENT_INDEX thread_event_rd;
+    T_THREAD_EVENT_LANE *lane;
+    T_THREAD_EVENT_INDEX thread_event_wr;
+    BOOL in_isr = OsIsInIsr();
+    U32 mask;
 
-    if (!thread)
+    if (!thread || prio >= THREAD_EVENT_PRIORITY_MAX ||
+        (ttl && !thread_event_expirable_(event)))
         return RESULT_PARAMETER_ERROR;
+    lane = &thread->lane[prio];
 
     if (thread->state != THREAD_STATE_RUN)
         return RESULT_NOT_HANDLED;
 
-    os_spinlock_obtain(&thread->event_lock);
+    if (data && size > sizeof(event_entry->event.parameters))
+        return RESULT_PARAMETER_ERROR;
+
+    mask = thread_post_lock_(thread, in_isr);
 
     if(THREAD_EVENT_SEND_OPTION_OR == option)
     {
         if(TRUE == thread->thread_event_already_queued[event])
         {
-            os_spinlock_release(&thread->event_lock);
+            thread_post_unlock_(thread, in_isr, mask);
             return RESULT_OK;
         }
-        else
-        {
-            thread->thread_event_already_queued[event] = TRUE;
-        }
     }
-    event_entry = &thread->thread_event[thread->thread_event_wr];
+
+    /* a full lane rejects the post, the queued events stay intact */
+    thread_event_wr = (lane->thread_event_wr + 1) % MAX_THREAD_EVENT_ENTRIES;
+    if (thread_event_wr == lane->thread_event_rd)
+    {
+        lane->stat.overruns++;
+        thread_post_unlock_(thread, in_isr, mask);
+        return RESULT_NO_RESOURCES_AVAILABLE;
+    }
+
+    if(THREAD_EVENT_SEND_OPTION_OR == option)
+        thread->thread_event_already_queued[event] = TRUE;
+
+    event_entry = &lane->thread_event[lane->thread_event_wr];
     event_entry->processed = FALSE;
+    event_entry->or_posted = THREAD_EVENT_SEND_OPTION_OR == option;
     event_entry->event.event = event;
+    event_entry->post_time = OsGetTimestamp();
+    event_entry->ttl = ttl;
 
     if (data)
-    {
-        if (size > sizeof(event_entry->event.parameters))
-        {
-            os_spinlock_release(&thread->event_lock);
-            return RESULT_PARAMETER_ERROR;
-        }
         memcpy_s(&event_entry->event.parameters, size, data, size);
-    }
 
     /*
      * Make sure the info makes it to main memory.  Make sure to do this BEFORE
      * the thread_event_wr index is updated.
      */
     os_data_sync_barrier();
+    lane->thread_event_wr = thread_event_wr;
+    thread->lanes_pending |= THREAD_EVENT_LANE_BIT(prio);
 
-    /*
-     * Get read index before updating write index in case
-     * read thread processes event and updates rd index
-     * before reaching overflow check
-     */
-    thread_event_rd = thread->thread_event_rd;
-    thread->thread_event_wr = (thread->thread_event_wr + 1) % MAX_THREAD_EVENT_ENTRIES;
+    thread_post_unlock_(thread, in_isr, mask);
+
+    if (thread->post_cb)
+        thread->post_cb(thread, event, data, data ? size : 0, prio, ttl);
 
-    /* Check for overflow */
-    if (thread->thread_event_wr == thread_event_rd)
+    /* A spinning consumer picks the entry up from the queue by itself */
+    os_data_sync_barrier();
+    if (thread->consumer_spinning)
     {
-        FATAL(RESULT_FAILURE, THREAD_EVENT_QUEUE_OVERRUN);
+        mask = thread_post_lock_(thread, in_isr);
+        thread->stat.wakeups_skipped++;
+        thread_post_unlock_(thread, in_isr, mask);
+        return RESULT_OK;
     }
 
-    os_spinlock_release(&thread->event_lock);
-
-    S32 res = (S32)OsEventSet(&thread->event_id);
-    ASSERT(OS_SUCCESS, res, THREAD_EVENT_NOT_SET);
+    if (in_isr)
+    {
+        OsEventSetFromIsr(&thread->event_id, THREAD_EVENT_LANE_BIT(prio));
+    }
+    else
+    {
+        S32 res = (S32)OsEventSet(&thread->event_id, THREAD_EVENT_LANE_BIT(prio));
+        ASSERT(OS_SUCCESS, res, THREAD_EVENT_NOT_SET);
+    }
 
     return RESULT_OK;
 }